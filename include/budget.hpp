@@ -0,0 +1,68 @@
+#ifndef __BUDGET_H__
+#define __BUDGET_H__
+
+/**
+ * @file budget.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Keep the pairs being processed at once within a memory budget
+ *
+ * Each pair's peak memory is estimated from its size and the options.
+ * A pair only starts once its estimate fits in what is left of the
+ * budget, running fewer of its augmentations at once if that helps.
+ * The estimates are scaled up if the process's resident memory shows
+ * they are too low.
+ *
+ */
+
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+#include "options.hpp"
+
+// Roughly what a pair holds at its peak
+typedef struct {
+    size_t base = 0;        // For the whole pair - the files, processed volume and mask
+    size_t per_aug = 0;     // For each augmentation running at once
+} PairMemory;
+
+// What a pair was admitted with, handed back to Release. The charge is
+// kept as it was, as the scale may go up while the pair runs.
+typedef struct {
+    size_t augs = 1;        // Augmentations it may run at once
+    size_t charged = 0;     // Scaled bytes taken from the budget
+    size_t estimated = 0;   // The same, unscaled
+} BudgetGrant;
+
+PairMemory EstimatePairMemory(Options const &options, size_t width, size_t height);
+bool ParseBytes(std::string const &text, size_t &bytes);
+size_t CurrentRSS();
+size_t PeakRSS();
+size_t FileBytes(std::string const &path);
+
+class MemoryBudget {
+public:
+    void SetBudget(size_t budget);
+    BudgetGrant Reserve(size_t bytes);
+    BudgetGrant Admit(PairMemory const &estimate, size_t max_augs, BudgetGrant const &held = BudgetGrant());
+    void Release(BudgetGrant const &grant);
+    size_t InUse();
+    void Report();
+
+private:
+    size_t _Cost(PairMemory const &estimate, size_t augs) const;
+    void _Check();
+
+    size_t _budget = 0;     // 0 means no limit
+    size_t _baseline = 0;   // Resident memory before any pairs
+    size_t _estimated = 0;  // Unscaled estimates of the pairs running now
+    size_t _used = 0;       // Scaled, as admitted, along with what is reserved
+    size_t _reserved = 0;   // Files read ahead for pairs not yet admitted
+    size_t _degraded = 0;   // Pairs run with fewer augmentations at once
+    double _scale = 1.0;
+    std::mutex _mutex;
+    std::condition_variable _freed;
+};
+
+#endif
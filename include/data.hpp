@@ -19,11 +19,57 @@
 #include <numeric>
 #include <cstdlib>
 #include <thread>
+#include <unordered_map>
+#include <cstdint>
+
+// An annotation tiff with its log, dat and AutoStack input
+typedef struct {
+    std::string anno;
+    std::string log;
+    std::string dat;
+    std::string input;
+} Pair;
+
+// Every file we pair, found in one scan of each directory. Logs and dats
+// are keyed by the ID token of their name, inputs by the AutoStack number.
+typedef struct {
+    std::vector<std::string> annotations;       // Sorted by ID, as FindAnnotations
+    std::unordered_map<std::string, std::vector<std::string>> logs;
+    std::unordered_map<std::string, std::vector<std::string>> dats;
+    std::unordered_map<int, std::vector<std::string>> inputs;
+} DataIndex;
+
+// One acquisition - a directory of input stacks and the directory of their annotations
+typedef struct {
+    std::string image_path;
+    std::string annotation_path;
+} Acquisition;
+
+// One neuron's line from a .dat file, tokens cleaned of commas and brackets.
+// Kept as text so they pass into the database and CSV rows unchanged.
+typedef struct {
+    std::string name;       // ASI-1, ASI-2, ASJ-1 or ASJ-2
+    std::string fl;
+    std::string bg;
+    std::string x;
+    std::string y;
+    std::string z;
+    std::string mode_fl;
+    std::string min_fl;
+    std::string rsize;
+} NeuronRecord;
 
 int GetOffetNumber(std::string output_path);
 std::vector<std::string> FindLogFiles(std::string annotation_path);
 std::vector<std::string> FindDatFiles(std::string annotation_path);
 std::vector<std::string> FindAnnotations(std::string annotation_path);
 std::vector<std::string> FindInputFiles(std::string image_path);
+DataIndex IndexData(std::string annotation_path, std::string image_path);
+std::vector<Pair> PairData(DataIndex const &index, bool need_input, std::vector<std::string> &unpaired, std::vector<std::string> &unused);
+std::vector<Acquisition> ReadManifest(std::string manifest_path);
+void ReportUnmatched(std::vector<std::string> const &unpaired, std::vector<std::string> const &unused);
+std::vector<NeuronRecord> ParseNeuronDat(std::vector<std::string> const &lines);
+uint64_t HashString(std::string const &text, uint64_t hash = 14695981039346656037ULL);
+std::string FileStamp(std::string const &path);
 
 #endif
\ No newline at end of file
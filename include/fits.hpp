@@ -0,0 +1,51 @@
+#ifndef __FITS_H__
+#define __FITS_H__
+
+/**
+ * @file fits.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Encode FITS files in memory so they can be written in one go
+ *
+ * Optionally the images are tile compressed, which astropy and DS9
+ * read without any changes.
+ *
+ */
+
+#include <fitsio.h>
+#include <imagine/imagine.hpp>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <libcee/string.hpp>
+#include "quantise.hpp"
+
+// Tile compression. Integer images use Rice, float images GZIP.
+typedef struct {
+    bool compress = false;
+    float quantize = 0;     // Float quantisation level (noise sigma / q). 0 is lossless.
+    long tile_x = 0;        // Tile size - 0 means the whole axis
+    long tile_y = 0;
+    long tile_z = 1;
+} FitsCompression;
+
+std::vector<char> EncodeFITS(imagine::ImageU8L const &image, FitsCompression const &comp = FitsCompression(),
+    Precision precision = Precision::F32, QuantError *error = nullptr);
+std::vector<char> EncodeFITS(imagine::ImageU8L3D const &image, FitsCompression const &comp = FitsCompression(),
+    Precision precision = Precision::F32, QuantError *error = nullptr);
+std::vector<char> EncodeFITS(imagine::ImageU16L const &image, FitsCompression const &comp = FitsCompression(),
+    Precision precision = Precision::F32, QuantError *error = nullptr);
+std::vector<char> EncodeFITS(imagine::ImageU16L3D const &image, FitsCompression const &comp = FitsCompression(),
+    Precision precision = Precision::F32, QuantError *error = nullptr);
+std::vector<char> EncodeFITS(imagine::ImageF32L const &image, FitsCompression const &comp = FitsCompression(),
+    Precision precision = Precision::F32, QuantError *error = nullptr);
+std::vector<char> EncodeFITS(imagine::ImageF32L3D const &image, FitsCompression const &comp = FitsCompression(),
+    Precision precision = Precision::F32, QuantError *error = nullptr);
+
+bool ParseTile(std::string const &text, FitsCompression &comp);
+
+void WriteFileAtomic(std::string const &path, std::vector<char> const &bytes);
+
+#endif
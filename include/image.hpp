@@ -26,7 +26,9 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
 
-bool SetNeuron(imagine::ImageU16L &image_in, imagine::ImageU8L3D &image_out, std::vector<std::vector<size_t>> &neurons, int neuron_id, bool flip_depth, bool flip_height, int id_to_write);
+std::vector<std::vector<size_t>> ParseNeuronLog(std::vector<std::string> const &lines);
+std::vector<uint8_t> NeuronLUT(std::vector<std::vector<size_t>> const &neurons);
+std::vector<bool> SetNeurons(imagine::ImageU16L const &image_in, imagine::ImageU8L3D &image_out, std::vector<uint8_t> const &lut, std::vector<uint8_t> const &ids_to_write, bool flip_depth, bool flip_height);
 imagine::ImageU8L3D StackMask(imagine::ImageU16L &image_in, size_t width, size_t height, size_t stacksize);
 imagine::ImageU8L Flatten(imagine::ImageU8L3D &mask);
 bool non_zero(imagine::ImageU8L3D &image);
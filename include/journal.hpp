@@ -0,0 +1,65 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+/**
+ * @file journal.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief A build journal, so a dataset build can carry on where it stopped
+ *
+ * Each finished pair gets a journal entry holding hashes of its inputs
+ * and of the options for each stage, the files it wrote and its CSV
+ * rows. The processed source volume can also be cached, so changing
+ * only the augmentation skips loading and deconvolution.
+ *
+ */
+
+#include <imagine/imagine.hpp>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "options.hpp"
+#include "data.hpp"
+
+// Hashes of what each stage depends on
+typedef struct {
+    std::string input;      // The pair's files - paths, sizes and times
+    std::string mask;       // Mask and ROI options
+    std::string source;     // Source processing options
+    std::string aug;        // Augmentation and output options, with the pair's seed
+} StageKeys;
+
+typedef struct {
+    int idx = 0;
+    StageKeys keys;
+    std::vector<std::string> outputs;
+    std::vector<std::string> rows;
+    std::vector<size_t> records;    // The shard record for each row, if writing shards
+    std::vector<std::string> counts;    // The combined run's counts.csv row
+    std::vector<std::string> neurons;   // and its neurons.csv rows
+} JournalEntry;
+
+StageKeys MakeStageKeys(Options const &options, Pair const &pair, unsigned int seed);
+bool SameKeys(StageKeys const &a, StageKeys const &b);
+bool OutputsValid(std::vector<std::string> const &outputs);
+
+class Journal {
+public:
+    void Open(std::string const &output_path);
+    bool Find(int idx, JournalEntry &entry) const;
+    void Forget(int idx) const;
+    void Queue(JournalEntry const &entry) const;
+    std::vector<JournalEntry> All() const;
+    void RewriteCSV(std::string const &csv_path, std::string const &header,
+        std::vector<std::string> JournalEntry::*rows = &JournalEntry::rows) const;
+
+private:
+    std::string _Path(int idx) const;
+    std::string _dir;
+};
+
+std::string StageCachePath(std::string const &output_path, StageKeys const &keys);
+bool LoadStageCache(std::string const &path, imagine::ImageF32L3D &image, int &background);
+void QueueStageCache(std::string const &path, imagine::ImageF32L3D const &image, int background);
+
+#endif
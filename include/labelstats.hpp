@@ -0,0 +1,64 @@
+#ifndef __LABELSTATS_H__
+#define __LABELSTATS_H__
+
+/**
+ * @file labelstats.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Intensity statistics under each label of a mask, in one pass
+ *
+ */
+
+#include <imagine/imagine.hpp>
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include "sparse.hpp"
+#include "data.hpp"
+#include "tiffstack.hpp"
+
+// One bin per intensity up to the last, which holds everything above it too
+const size_t LABEL_STATS_BINS = 4096;
+
+// The intensities under one label
+typedef struct {
+    std::array<uint32_t, LABEL_STATS_BINS> histogram{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t top_sum = 0;       // The exact sum of the values in the last bin
+    uint16_t min = 0xffff;
+    uint16_t max = 0;
+} LabelStats;
+
+// The count for each neuron
+typedef struct {
+    int64_t asi1 = 0;
+    int64_t asi2 = 0;
+    int64_t asj1 = 0;
+    int64_t asj2 = 0;
+} Counts;
+
+// The counts in a .dat file, and the background mode for each neuron
+typedef struct {
+    int64_t asi1 = 0;
+    int64_t asi2 = 0;
+    int64_t asj1 = 0;
+    int64_t asj2 = 0;
+    int64_t asi1_mode = 0;
+    int64_t asi2_mode = 0;
+    int64_t asj1_mode = 0;
+    int64_t asj2_mode = 0;
+} BaseCounts;
+
+std::vector<LabelStats> MeasureLabelStats(imagine::ImageU16L3D const &raw, SparseLabel3D const &mask, size_t labels);
+uint64_t TopSum(LabelStats const &stats, size_t k);
+uint16_t StatsMode(LabelStats const &stats);
+uint16_t StatsPercentile(LabelStats const &stats, double percent);
+double StatsMean(LabelStats const &stats);
+BaseCounts DatCounts(std::vector<NeuronRecord> const &records);
+Counts CountLabels(imagine::ImageU16L3D const &raw, SparseLabel3D const &mask, BaseCounts const &base, size_t top_k);
+std::string CountPair(Pair const &pair, SparseLabel3D const &mask, size_t channels, size_t channel, size_t stacksize, size_t top_k,
+    TiffBytes const &bytes = nullptr);
+
+#endif
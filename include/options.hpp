@@ -10,12 +10,17 @@
  */
 
 #include <string>
+#include <vector>
+#include <memory>
+#include "fits.hpp"
+#include "writer.hpp"
 
 // Our command line options, held in a struct.
 typedef struct {
     std::string image_path = ".";       // Path to the source images
     std::string output_path = ".";      // Output path
     std::string annotation_path = ".";  // Path to the annotations
+    std::string manifest = "";          // File listing image and annotation directory pairs
     std::string prefix = "";            // Prefix for the new files if renamed
     std::string psf_path = "./images/PSF_born_wolf_3d.tif"; // The path to the deconvolution kernel.
     std::string base_path = "";         // Used in stack/mask as the part to replace
@@ -35,6 +40,7 @@ typedef struct {
     bool deconv = false;            // Do we deconvolve?
     bool max_intensity = false;     // If flattening, use max intensity
     bool contrast = false;          // Apply a contrast function
+    bool bricked = false;           // Sample augmentations from a bricked (Z-order) volume
     int channels = 2;               // 2 Channels initially in these images
     int stacksize = 51;             // How many stacks in our input 2D image
     int final_depth = 51;           // number of z-slices - TODO - should be set automatically along with width and height
@@ -46,6 +52,25 @@ typedef struct {
     uint16_t cutoff = 270;          // Background value
     float depth_scale = 6.2;        // Ratio of Z/Depth to XY
     int num_augs = 1;
+    size_t brick_dim = 8;           // Brick size for the bricked layout, 4 or 8
+    int threads = 0;                // Threads in the shared pool - 0 means one per core
+    int prefetch = 1;               // How many pairs the loader may read ahead
+    int jobs = 1;                   // How many pairs wiggle processes at once
+    size_t aug_width = 0;           // Augmentations run at once - 0 means no limit
+    size_t mem_budget = 0;          // Bytes the pairs in flight may use - 0 means no limit
+    int write_queue = 8;            // How many files may wait for the writer
+    FitsCompression fits;           // Tile compression for the FITS outputs
+    Precision precision = Precision::F32;   // How the source volumes are stored
+    bool shards = false;            // Write samples into shard files instead of FITS
+    size_t shard_records = 1024;    // Records in each shard file
+    size_t preview_scale = 1;       // Downsample factor for the JPG previews - 0 means none
+    bool montage = false;           // One contact sheet of previews per image
+    bool resume = false;            // Keep a build journal and skip pairs already built
+    bool stage_cache = false;       // Cache processed source volumes between runs
+    bool combined = false;          // Also write the counts, full size masks and database rows
+    int count_channel = 0;          // The channel a combined run counts in - 0, as count does by default
+    std::shared_ptr<WriteGroup> writes; // Counts the failed writes of the pair being built
+    std::vector<size_t> records;    // Shard records the pair was written to before, to use again
 } Options;
 
 
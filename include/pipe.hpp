@@ -24,14 +24,36 @@
 #include "data.hpp"
 #include "options.hpp"
 #include "image.hpp"
+#include "sparse.hpp"
+#include "tiffstack.hpp"
+#include "pool.hpp"
+#include "writer.hpp"
+#include "shard.hpp"
+#include "preview.hpp"
+#include "journal.hpp"
+#include "labelstats.hpp"
 
 typedef struct {
     ROI roi;
     glm::quat rot;
+    size_t record = 0;      // The shard record for this augmentation, if writing shards
 } Transform;
 
+// The rows a combined run adds for a pair - for the count CSV and the
+// neuron CSV the database is loaded from
+typedef struct {
+    std::string count;
+    std::vector<std::string> neurons;
+} CombinedRows;
+
 imagine::ImageF32L3D ProcessPipe(imagine::ImageU16L3D const &image_in, bool autoback, float noise, bool deconv, const std::string &psf_path, int deconv_rounds, bool contrast);
-int TiffToFits(const Options &options, const Transform &master_t, const std::vector<Transform> &transforms, std::string &tiff_path, int image_idx);
-bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path, std::string &coord_path, int image_idx, Transform &master_t, std::vector<Transform> &transforms);
+int FirstPairIndex(const Options &options, bool offset_given);
+std::string SourceID(const Options &options, std::string const &tiff_path, int image_idx);
+std::vector<std::string> PairOutputs(const Options &options, std::string const &tiff_path, int image_idx);
+int TiffToFits(const Options &options, const Transform &master_t, const std::vector<Transform> &transforms, std::string &tiff_path, int image_idx,
+    TiffBytes const &bytes = nullptr, std::string const &cache_path = "");
+bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path, std::string &coord_path, int image_idx, Transform &master_t, std::vector<Transform> &transforms, TiffBytes const &bytes = nullptr,
+    SparseLabel3D *full_mask = nullptr);
+void CombinedOutputs(const Options &options, SparseLabel3D const &full_mask, Pair const &pair, int image_idx, TiffBytes const &bytes, CombinedRows &rows);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+/**
+ * @file pool.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief The thread pool shared by all the parallel parts of wiggle
+ *
+ */
+
+#include <libcee/threadpool.hpp>
+#include <functional>
+#include <cstdlib>
+
+void SetPoolSize(size_t num_threads);
+size_t PoolSize();
+libcee::ThreadPool &SharedPool();
+void ParallelFor(size_t count, std::function<void(size_t)> func, size_t width = 0);
+
+#endif
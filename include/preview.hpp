@@ -0,0 +1,46 @@
+#ifndef __PREVIEW_H__
+#define __PREVIEW_H__
+
+/**
+ * @file preview.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Small JPG previews of the outputs, written in the background
+ *
+ * Previews are downsampled and stretched to 8 bit in one pass, then
+ * encoded on the low priority preview writer. With montages on, the
+ * previews for each image are gathered into one contact sheet.
+ *
+ */
+
+#include <imagine/imagine.hpp>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+
+imagine::ImageU8L MakePreview(imagine::ImageF32L const &image, size_t scale);
+imagine::ImageU8L MakePreview(imagine::ImageU8L const &image, size_t scale);
+imagine::ImageU8L MakeMontage(std::vector<imagine::ImageU8L> const &tiles);
+
+void QueuePreview(std::string const &path, imagine::ImageU8L const &preview);
+
+// Contact sheets waiting for the rest of their tiles
+class PreviewSheets {
+public:
+    void Add(std::string const &path, size_t index, size_t count, imagine::ImageU8L const &tile);
+    void Finish();
+
+private:
+    typedef struct {
+        std::vector<imagine::ImageU8L> tiles;
+        size_t added = 0;
+    } Sheet;
+
+    std::mutex _mutex;
+    std::map<std::string, Sheet> _sheets;
+};
+
+PreviewSheets &SharedPreviewSheets();
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __QUANTISE_H__
+#define __QUANTISE_H__
+
+/**
+ * @file quantise.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Store float volumes at a lower precision - float16 or scaled uint16
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+enum class Precision { F32, F16, U16 };
+
+// How far the stored values are from the originals
+typedef struct {
+    double max_error = 0;
+    double rms_error = 0;
+    double scale = 1.0;     // original = stored * scale + zero, for U16
+    double zero = 0.0;
+} QuantError;
+
+bool ParsePrecision(std::string const &text, Precision &precision);
+std::string PrecisionName(Precision precision);
+size_t PrecisionBytes(Precision precision);
+
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t half);
+
+QuantError QuantiseF16(const float *in, size_t count, uint16_t *out);
+QuantError QuantiseU16(const float *in, size_t count, uint16_t *out);
+
+#endif
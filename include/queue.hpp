@@ -0,0 +1,154 @@
+#ifndef __QUEUE_H__
+#define __QUEUE_H__
+
+/**
+ * @file queue.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief A bounded, blocking queue to join the stages of a pipeline
+ *
+ * Push blocks while the queue is full, so a fast stage can only run
+ * so far ahead of a slow one. Once closed, Pop drains what is left
+ * and then returns false.
+ *
+ * InOrder puts back the order that parallel stages lose - tasks are
+ * handed in tagged with a slot, and run one at a time in slot order.
+ *
+ */
+
+#include <deque>
+#include <map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdlib>
+
+template<typename T>
+class BoundedQueue {
+public:
+    BoundedQueue(size_t capacity) : _capacity(capacity == 0 ? 1 : capacity) {}
+
+    // Returns false if the queue was closed before there was room
+    bool Push(T item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this] () { return _closed || _items.size() < _capacity; });
+
+        if (_closed) {
+            return false;
+        }
+
+        _items.push_back(std::move(item));
+        _not_empty.notify_one();
+        return true;
+    }
+
+    // Returns false once the queue is closed and empty
+    bool Pop(T &item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this] () { return _closed || !_items.empty(); });
+
+        if (_items.empty()) {
+            return false;
+        }
+
+        item = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        return true;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_full.notify_all();
+        _not_empty.notify_all();
+    }
+
+    // Open the queue again after it has been closed and drained
+    void Reopen() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = false;
+    }
+
+    size_t Size() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _items.size();
+    }
+
+    size_t Capacity() const { return _capacity; }
+
+private:
+    size_t _capacity;
+    bool _closed = false;
+    std::deque<T> _items;
+    std::mutex _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+};
+
+// Runs tasks on its own thread in slot order 0, 1, 2 ... whatever
+// order they are committed in. Every slot needs a task, even one that
+// does nothing, or the slots after it wait until Finish.
+class InOrder {
+public:
+    InOrder() : _thread(&InOrder::_Run, this) {}
+    ~InOrder() { Finish(); }
+    InOrder(InOrder const &) = delete;
+    InOrder &operator=(InOrder const &) = delete;
+
+    void Commit(size_t slot, std::function<void()> task) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending[slot] = std::move(task);
+        _ready.notify_one();
+    }
+
+    // Run everything committed, skipping over any missing slots, then stop
+    void Finish() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+            _ready.notify_one();
+        }
+
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+    }
+
+private:
+    void _Run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true) {
+            _ready.wait(lock, [this] () { return _closed || _pending.count(_next) > 0; });
+
+            if (_pending.empty()) {
+                return;
+            }
+
+            // Once closed, nothing more is coming, so close up any gaps
+            auto next = _pending.find(_next);
+
+            if (next == _pending.end()) {
+                next = _pending.begin();
+            }
+
+            std::function<void()> task = std::move(next->second);
+            _next = next->first + 1;
+            _pending.erase(next);
+            lock.unlock();
+            task();
+            lock.lock();
+        }
+    }
+
+    size_t _next = 0;
+    bool _closed = false;
+    std::map<size_t, std::function<void()>> _pending;
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::thread _thread;
+};
+
+#endif
@@ -19,6 +19,80 @@
 #include <numeric>
 #include <cstdlib>
 #include <thread>
+#include <cstdint>
+#include <cmath>
+#include "sparse.hpp"
+
+/**
+ * A summed volume table - the 3D integral image. Entry (x, y, z) holds
+ * the sum of every value before it on all three axes, so the sum over
+ * any box is eight lookups, however big the box.
+ */
+template<typename T>
+class SummedVolume {
+public:
+    SummedVolume() {}
+
+    // value(x, y, z) gives what to sum at each voxel
+    template<typename F>
+    SummedVolume(size_t w, size_t h, size_t d, F value) : width(w), height(h), depth(d) {
+        _table.assign((w + 1) * (h + 1) * (d + 1), 0);
+
+        for (size_t z = 0; z < d; z++) {
+            for (size_t y = 0; y < h; y++) {
+                T *row = &_table[_Index(1, y + 1, z + 1)];
+
+                for (size_t x = 0; x < w; x++) {
+                    row[x] = value(x, y, z);
+                }
+            }
+        }
+
+        // Running sums along each axis in turn. Unsigned types may wrap
+        // during a lookup but the results are still exact.
+        for (size_t z = 1; z <= d; z++) {
+            for (size_t y = 1; y <= h; y++) {
+                for (size_t x = 1; x <= w; x++) {
+                    _table[_Index(x, y, z)] += _table[_Index(x - 1, y, z)];
+                }
+            }
+        }
+
+        for (size_t z = 1; z <= d; z++) {
+            for (size_t y = 1; y <= h; y++) {
+                for (size_t x = 1; x <= w; x++) {
+                    _table[_Index(x, y, z)] += _table[_Index(x, y - 1, z)];
+                }
+            }
+        }
+
+        for (size_t z = 1; z <= d; z++) {
+            for (size_t y = 1; y <= h; y++) {
+                for (size_t x = 1; x <= w; x++) {
+                    _table[_Index(x, y, z)] += _table[_Index(x, y, z - 1)];
+                }
+            }
+        }
+    }
+
+    // The sum over the box starting at (x, y, z) of size (w, h, d)
+    T Box(size_t x, size_t y, size_t z, size_t w, size_t h, size_t d) const {
+        size_t x1 = x + w, y1 = y + h, z1 = z + d;
+        return _table[_Index(x1, y1, z1)] - _table[_Index(x, y1, z1)] - _table[_Index(x1, y, z1)] - _table[_Index(x1, y1, z)]
+            + _table[_Index(x, y, z1)] + _table[_Index(x, y1, z)] + _table[_Index(x1, y, z)] - _table[_Index(x, y, z)];
+    }
+
+    size_t width = 0;
+    size_t height = 0;
+    size_t depth = 0;
+
+private:
+    size_t _Index(size_t x, size_t y, size_t z) const {
+        return (z * (height + 1) + y) * (width + 1) + x;
+    }
+
+    std::vector<T> _table;
+};
 
 typedef struct {
     size_t x;
@@ -31,5 +105,7 @@ typedef struct {
 
 ROI FindROI(imagine::ImageU16L3D &input, size_t xy, size_t depth);
 ROI FindROI(imagine::ImageU8L3D &input, size_t xy, size_t depth);
+ROI FindROI(SparseLabel3D const &mask, size_t xy, size_t depth);
+bool ROIFromLabels(SparseLabel3D const &mask, size_t xy, size_t depth, ROI &roi);
 
 #endif
\ No newline at end of file
@@ -36,47 +36,31 @@
 #include <glm/gtx/hash.hpp>
 
 #include "roi.hpp"
+#include "brick.hpp"
 
-extern std::default_random_engine RANDROT_GENERATOR;
+// One per thread, so pairs processed at the same time each draw from their own seed
+extern thread_local std::default_random_engine RANDROT_GENERATOR;
 
 /**
- * Augment the input images 
- * 
+ * Scale the input image along Z so we have a cube to rotate.
+ *
  * @param image - the starting image
- * @param rot - a random rotation
  * @param zscale - the scale on Z depth
- * @param final_xy - the final width and height of the image
- * @param final_depth - the final depth of the image
- * @return the augmented image
- * 
- * Augmentation works by rotating the volume around the origin. We scale 
- * the volume based on the image dimensions and the zscale (as z pixels 
- * often count for 6 times x and y), then we rotate and scale back.
- * 
- * The final image is smaller than the input as we rotate a bigger
- * volume in order to get a more complete rotated final image.
- * 
+ * @param iterz - interpolate along Z
+ * @param store - called with (z, y, x, value) for each voxel of the cube
+ *
+ * The store function lets us write straight into whichever layout
+ * the sampler reads from.
  */
 
-
-template<typename T>
-T Augment(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool subpixel, bool iterz) {
-    assert(image.width == image.height);
-    assert(cube_dim < image.width);
-    assert(cube_dim / zscale < image.depth);
-
-    T resampled(image.width, image.width, image.width);
-
-    // Essentially, we want a cube, smaller than the input image.
-    // Z is a special case and requires scaling.
-    T augmented(cube_dim, cube_dim, cube_dim);
-
-    float aug_ratio = static_cast<float>(cube_dim) / static_cast<float>(image.width);
+template<typename T, typename S>
+void _AugmentResample(T const &image, float zscale, bool iterz, S store) {
+    size_t dim = image.width;
 
     // Create our sampler
-    for (size_t z = 0; z < resampled.depth; z++) {
-        for (size_t y = 0; y < resampled.height; y++) {
-            for (size_t x = 0; x < resampled.width; x++) {
+    for (size_t z = 0; z < dim; z++) {
+        for (size_t y = 0; y < dim; y++) {
+            for (size_t x = 0; x < dim; x++) {
                 size_t it =  static_cast<size_t>(floor(static_cast<float>(z) / zscale));
 
                 if (iterz){
@@ -105,16 +89,30 @@ T Augment(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool sub
                     }
 
                     float interped = mix_og * static_cast<float>(image.data[it][y][x]) + mix_n * static_cast<float>(image.data[ic][y][x]); 
-                    resampled.data[z][y][x] = interped; // TODO - this is naughty as we can't assume the float goes to the proper type of resampled
-
+                    store(z, y, x, interped); // TODO - this is naughty as we can't assume the float goes to the proper type of resampled
                 } else {
-                    resampled.data[z][y][x] = image.data[it][y][x];
+                    store(z, y, x, image.data[it][y][x]);
                 }
             }
         }
     }
+}
+
+/**
+ * Rotate and sample the Z-scaled cube into the augmented image.
+ *
+ * @param augmented - the output image, already sized
+ * @param dim - the width, height and depth of the resampled cube
+ * @param aug_ratio - the ratio of the output to the resampled cube
+ * @param rot - the rotation
+ * @param subpixel - use subpixel sampling
+ * @param fetch - called with (z, y, x) to read the resampled cube
+ */
 
+template<typename T, typename F>
+void _AugmentSample(T &augmented, size_t dim, float aug_ratio, glm::quat rot, bool subpixel, F fetch) {
     glm::mat4 rotmat = glm::toMat4(rot);
+    int rdim = static_cast<int>(dim);
     
     // now do the sampling
     for (size_t z = 0; z < augmented.depth; z++) {
@@ -142,9 +140,9 @@ T Augment(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool sub
                     float gy = v.y - ffy;
                     float gz = v.z - ffz;
 
-                    int cx = static_cast <int>((v.x + 1.0) / 2.0 * resampled.width);
-                    int cy = static_cast <int>((v.y + 1.0) / 2.0 * resampled.height);
-                    int cz = static_cast <int>((v.z + 1.0) / 2.0 * resampled.depth);
+                    int cx = static_cast <int>((v.x + 1.0) / 2.0 * dim);
+                    int cy = static_cast <int>((v.y + 1.0) / 2.0 * dim);
+                    int cz = static_cast <int>((v.z + 1.0) / 2.0 * dim);
 
                     // 27 samples so get values for all - left to right, top to bottom, front to back
                     float val = 0;
@@ -155,7 +153,6 @@ T Augment(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool sub
                                 int rx = cx + dx;
                                 int ry = cy + dy;
                                 int rz = cz + dz;
-
                                 float ddx = 0.5 + static_cast<float>(dx) - gx;
                                 float ddy = 0.5 + static_cast<float>(dy) - gy;
                                 float ddz = 0.5 + static_cast<float>(dz) - gz;
@@ -163,10 +160,10 @@ T Augment(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool sub
                                 float dist = sqrt(ddx * ddx + ddy * ddy + ddz * ddz);
 
                                 if (dist < 1.0) {
-                                    if (rx >= 0 && rx < resampled.width &&
-                                    ry >= 0 && ry < resampled.height &&
-                                    rz >= 0 && rz < resampled.depth) {
-                                        val += static_cast<float>(resampled.data[rz][ry][rx]) * (1.0 - dist);
+                                    if (rx >= 0 && rx < rdim &&
+                                    ry >= 0 && ry < rdim &&
+                                    rz >= 0 && rz < rdim) {
+                                        val += static_cast<float>(fetch(rz, ry, rx)) * (1.0 - dist);
                                     }
                                 }
                             }
@@ -175,17 +172,99 @@ T Augment(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool sub
 
                     augmented.data[z][y][x] = val; // TODO - are we being naughty here as val is a float and we can't be sure augmented.data is a float
                 } else {
-                    int cx = static_cast <int>((v.x + 1.0) / 2.0 * resampled.width);
-                    int cy = static_cast <int>((v.y + 1.0) / 2.0 * resampled.height);
-                    int cz = static_cast <int>((v.z + 1.0) / 2.0 * resampled.depth);
+                    int cx = static_cast <int>((v.x + 1.0) / 2.0 * dim);
+                    int cy = static_cast <int>((v.y + 1.0) / 2.0 * dim);
+                    int cz = static_cast <int>((v.z + 1.0) / 2.0 * dim);
+
                     if (cx >= 0 && cy >= 0 && cz >= 0 
-                        && cx < resampled.width && cy < resampled.height && cz < resampled.depth ) {
-                        augmented.data[z][y][x] = resampled.data[cz][cy][cx];
+                        && cx < rdim && cy < rdim && cz < rdim ) {
+                        augmented.data[z][y][x] = fetch(cz, cy, cx);
                     }
                 }
             }
         }
     }
+}
+
+/**
+ * Augment the input images 
+ * 
+ * @param image - the starting image
+ * @param rot - a random rotation
+ * @param zscale - the scale on Z depth
+ * @param final_xy - the final width and height of the image
+ * @param final_depth - the final depth of the image
+ * @return the augmented image
+ * 
+ * Augmentation works by rotating the volume around the origin. We scale 
+ * the volume based on the image dimensions and the zscale (as z pixels 
+ * often count for 6 times x and y), then we rotate and scale back.
+ * 
+ * The final image is smaller than the input as we rotate a bigger
+ * volume in order to get a more complete rotated final image.
+ * 
+ */
+
+template<typename T>
+T Augment(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool subpixel, bool iterz) {
+    assert(image.width == image.height);
+    assert(cube_dim < image.width);
+    assert(cube_dim / zscale < image.depth);
+
+    T resampled(image.width, image.width, image.width);
+
+    // Essentially, we want a cube, smaller than the input image.
+    // Z is a special case and requires scaling.
+    T augmented(cube_dim, cube_dim, cube_dim);
+
+    float aug_ratio = static_cast<float>(cube_dim) / static_cast<float>(image.width);
+
+    _AugmentResample(image, zscale, iterz, [&resampled](size_t z, size_t y, size_t x, auto v) {
+        resampled.data[z][y][x] = v;
+    });
+
+    _AugmentSample(augmented, resampled.width, aug_ratio, rot, subpixel, [&resampled](int z, int y, int x) {
+        return resampled.data[z][y][x];
+    });
+
+    return augmented;
+}
+
+/**
+ * Augment the input images, sampling from a bricked volume
+ * 
+ * @param image - the starting image
+ * @param rot - a random rotation
+ * @param zscale - the scale on Z depth
+ * @param subpixel - use subpixel sampling
+ * @param iterz - interpolate along Z
+ * @param brick_dim - the brick size, 4 or 8
+ * @return the augmented image
+ * 
+ * Identical output to Augment, but the Z-scaled cube is written 
+ * straight into a bricked layout (see brick.hpp). A rotated ray
+ * then touches far fewer cache lines at steep angles.
+ */
+
+template<typename T>
+T AugmentBricked(T const &image, glm::quat rot, size_t cube_dim, float zscale, bool subpixel, bool iterz, size_t brick_dim) {
+    assert(image.width == image.height);
+    assert(cube_dim < image.width);
+    assert(cube_dim / zscale < image.depth);
+
+    typedef typename std::decay<decltype(image.data[0][0][0])>::type V;
+    BrickedVolume<V> resampled(image.width, image.width, image.width, brick_dim);
+    T augmented(cube_dim, cube_dim, cube_dim);
+
+    float aug_ratio = static_cast<float>(cube_dim) / static_cast<float>(image.width);
+
+    _AugmentResample(image, zscale, iterz, [&resampled](size_t z, size_t y, size_t x, auto v) {
+        resampled.Set(x, y, z, static_cast<V>(v));
+    });
+
+    _AugmentSample(augmented, resampled.width, aug_ratio, rot, subpixel, [&resampled](int z, int y, int x) {
+        return resampled.Get(x, y, z);
+    });
 
     return augmented;
 }
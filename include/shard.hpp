@@ -0,0 +1,120 @@
+#ifndef __SHARD_H__
+#define __SHARD_H__
+
+/**
+ * @file shard.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Packed, fixed record dataset shards that can be memory mapped
+ *
+ * Each record holds one sample - the source volume, the mask volume
+ * and a small metadata block - at fixed offsets, so record r of a
+ * shard starts at r * record_size. layout.json describes the record
+ * and index.csv holds the master_dataset.csv columns for each record.
+ *
+ */
+
+#include <libcee/string.hpp>
+#include <libcee/file.hpp>
+#include <imagine/imagine.hpp>
+#include <string>
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include "quantise.hpp"
+#include "writer.hpp"
+
+// The metadata block at the end of each record. 64 bytes, little endian.
+typedef struct {
+    uint32_t valid = 0;         // 1 once the record is complete
+    uint32_t image_idx = 0;
+    uint32_t aug = 0;
+    int32_t roi_x = 0;
+    int32_t roi_y = 0;
+    int32_t roi_z = 0;
+    int32_t roi_xy = 0;
+    int32_t roi_depth = 0;
+    int32_t background = 0;
+    uint32_t reserved[7] = {0, 0, 0, 0, 0, 0, 0};
+} ShardMeta;
+
+// Where everything sits in a record. Sections are 64 byte aligned
+// and records are padded to a whole number of 4096 byte pages.
+// The scale section holds two doubles, scale and zero, so a u16
+// source is source * scale + zero.
+typedef struct {
+    size_t width = 0;
+    size_t height = 0;
+    size_t depth = 0;
+    size_t records_per_shard = 1024;
+    Precision precision = Precision::F32;
+    size_t source_offset = 0;
+    size_t source_bytes = 0;
+    size_t scale_offset = 0;
+    size_t mask_offset = 0;
+    size_t mask_bytes = 0;
+    size_t meta_offset = 0;
+    size_t record_size = 0;
+} ShardLayout;
+
+ShardLayout MakeShardLayout(size_t width, size_t height, size_t depth, size_t records_per_shard,
+    Precision precision = Precision::F32);
+ShardLayout ReadShardLayout(std::string const &dir);
+
+class ShardSet {
+public:
+    void Open(std::string const &dir, ShardLayout const &layout);
+    bool IsOpen() const { return _open; }
+    ShardLayout const &Layout() const { return _layout; }
+    size_t Allocate();
+    std::string ShardPath(size_t record) const;
+
+    void QueueSource(size_t record, imagine::ImageF32L3D const &image, std::shared_ptr<WriteGroup> const &group = nullptr);
+    void QueueSource(size_t record, imagine::ImageF32L const &image, std::shared_ptr<WriteGroup> const &group = nullptr);
+    void QueueMask(size_t record, imagine::ImageU8L3D const &image, std::shared_ptr<WriteGroup> const &group = nullptr);
+    void QueueMask(size_t record, imagine::ImageU8L const &image, std::shared_ptr<WriteGroup> const &group = nullptr);
+    void QueueMeta(size_t record, ShardMeta const &meta, std::string const &csv_line);
+    void RewriteIndex(std::vector<std::pair<size_t, std::string>> const &records);
+
+private:
+    std::string _IndexLine(size_t record, std::string const &csv_line) const;
+    void _QueueBytes(size_t record, size_t offset, std::vector<char> bytes, std::shared_ptr<WriteGroup> const &group = nullptr);
+    void _QueueSource(size_t record, std::string const &name, std::vector<float> const &flat, std::shared_ptr<WriteGroup> const &group);
+
+    bool _open = false;
+    std::string _dir;
+    ShardLayout _layout;
+    std::atomic<size_t> _next{0};
+    std::mutex _index_mutex;
+    std::ofstream _index;
+};
+
+ShardSet &SharedShards();
+
+// A read only, memory mapped view of one shard file
+class ShardFile {
+public:
+    ShardFile(std::string const &path, ShardLayout const &layout);
+    ~ShardFile();
+    ShardFile(ShardFile const &) = delete;
+    ShardFile &operator=(ShardFile const &) = delete;
+
+    size_t NumRecords() const { return _size / _layout.record_size; }
+    std::vector<float> Source(size_t r) const;
+    const uint8_t *Mask(size_t r) const;
+    const ShardMeta *Meta(size_t r) const;
+
+private:
+    const char *_Record(size_t r) const;
+
+    ShardLayout _layout;
+    const char *_data = nullptr;
+    size_t _size = 0;
+};
+
+#endif
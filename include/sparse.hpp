@@ -0,0 +1,65 @@
+#ifndef __SPARSE_H__
+#define __SPARSE_H__
+
+/**
+ * @file sparse.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Run-length sparse label volumes for the neuron masks
+ *
+ */
+
+#include <imagine/imagine.hpp>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+// A run of voxels along x, all with the same label.
+typedef struct {
+    uint16_t z;
+    uint16_t y;
+    uint16_t x0;        // First voxel in the run
+    uint16_t x1;        // One past the last voxel in the run
+    uint8_t label;
+} Span;
+
+// A label volume held as spans, sorted by z, then y, then x0.
+// Zero (background) is never stored.
+typedef struct {
+    size_t width = 0;
+    size_t height = 0;
+    size_t depth = 0;
+    std::vector<Span> spans;
+} SparseLabel3D;
+
+// Bounding box (inclusive) and centroid of a label
+typedef struct {
+    size_t min_x = 0;
+    size_t min_y = 0;
+    size_t min_z = 0;
+    size_t max_x = 0;
+    size_t max_y = 0;
+    size_t max_z = 0;
+    size_t count = 0;
+    double cx = 0;
+    double cy = 0;
+    double cz = 0;
+} LabelBounds;
+
+SparseLabel3D ToSparse(imagine::ImageU8L3D const &image);
+imagine::ImageU8L3D Densify(SparseLabel3D const &mask);
+imagine::ImageU8L ProjectSparse(SparseLabel3D const &mask);
+SparseLabel3D FlattenSparse(SparseLabel3D const &mask);
+SparseLabel3D CropSparse(SparseLabel3D const &mask, size_t x, size_t y, size_t z, size_t width, size_t height, size_t depth);
+SparseLabel3D ResizeSparse(SparseLabel3D const &mask, size_t width, size_t height, size_t depth);
+SparseLabel3D ResizeLabels(SparseLabel3D const &mask, size_t width, size_t height, size_t depth, imagine::ImageU8L *mip = nullptr);
+void RelabelSparse(SparseLabel3D &mask, std::vector<uint8_t> const &labels);
+LabelBounds MeasureLabel(SparseLabel3D const &mask, uint8_t label);
+size_t CountLabelled(SparseLabel3D const &mask);
+bool non_zero(SparseLabel3D const &mask);
+std::vector<char> EncodeSparse(SparseLabel3D const &mask);
+bool LoadSparse(std::string const &path, SparseLabel3D &mask);
+
+#endif
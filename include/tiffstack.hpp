@@ -0,0 +1,49 @@
+#ifndef __TIFFSTACK_H__
+#define __TIFFSTACK_H__
+
+/**
+ * @file tiffstack.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Read one channel of an AutoStack tiff straight into a 3D stack.
+ *
+ */
+
+#include <tiffio.h>
+#include <imagine/imagine.hpp>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <memory>
+#include <fstream>
+#include "roi.hpp"
+#include "pool.hpp"
+
+// A window into the stack. A zero width, height or depth means
+// 'to the end' along that axis.
+typedef struct {
+    size_t x = 0;
+    size_t y = 0;
+    size_t z = 0;
+    size_t width = 0;
+    size_t height = 0;
+    size_t depth = 0;
+} StackWindow;
+
+// A whole tiff file held in memory, shared between the decoding threads
+typedef std::shared_ptr<const std::vector<char>> TiffBytes;
+
+StackWindow WindowFromROI(ROI const &roi);
+TiffBytes ReadTiffBytes(std::string const &tiff_path);
+bool TiffSize(std::string const &tiff_path, TiffBytes const &bytes, size_t &width, size_t &height);
+std::vector<imagine::ImageU16L3D> DeinterleaveStack(imagine::ImageU16L const &image, size_t channels, std::vector<size_t> const &wanted, size_t stacksize, StackWindow const &window);
+std::vector<imagine::ImageU16L3D> LoadTiffChannels(std::string const &tiff_path, size_t channels, std::vector<size_t> const &wanted, size_t stacksize,
+    StackWindow const &window, TiffBytes const &bytes = nullptr);
+imagine::ImageU16L3D LoadTiffStack(std::string const &tiff_path, size_t channels, size_t channel, size_t stacksize, StackWindow const &window, TiffBytes const &bytes = nullptr);
+imagine::ImageU16L LoadTiffImage(std::string const &tiff_path, TiffBytes const &bytes = nullptr);
+imagine::ImageU16L3D LoadTiffVolume(std::string const &tiff_path);
+
+#endif
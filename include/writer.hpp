@@ -0,0 +1,122 @@
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+/**
+ * @file writer.hpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief A background writer, so the compute threads don't wait on disk
+ *
+ */
+
+#include <imagine/imagine.hpp>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <type_traits>
+#include "queue.hpp"
+#include "fits.hpp"
+
+// One file to write. Either the bytes are written, or save is
+// called with the temporary path to write to. With an offset, the
+// bytes are written into the existing file at that offset instead.
+// With neither, nothing is written - done is just called once every
+// job queued before it has been. done is called on the writer thread,
+// with whether the write worked.
+typedef struct {
+    std::string path;
+    std::shared_ptr<const std::vector<char>> bytes;
+    std::function<void(std::string const &)> save;
+    long long offset = -1;
+    std::function<void(bool)> done;
+} WriteJob;
+
+// Counts the failed writes among a group of jobs, such as all the
+// files for one pair, so what depends on them can be held back.
+typedef struct {
+    std::atomic<size_t> failed{0};
+} WriteGroup;
+
+void TrackWrite(WriteJob &job, std::shared_ptr<WriteGroup> const &group);
+
+// How the writer is getting on
+typedef struct {
+    size_t files = 0;
+    size_t failed = 0;
+    size_t bytes = 0;
+    double seconds = 0;         // Time spent writing
+    size_t queued = 0;          // Jobs waiting right now
+    size_t max_queued = 0;
+    size_t capacity = 0;
+} WriterStats;
+
+// A background writer runs at a lower priority, for files nothing
+// else waits on, like previews.
+class Writer {
+public:
+    Writer(size_t depth, bool background = false) : _queue(depth), _background(background) {}
+    ~Writer() { Finish(); }
+
+    void Write(WriteJob job);
+    void Finish();
+    WriterStats Stats();
+    void Report();
+
+private:
+    void _Run();
+    void _WriteOne(WriteJob const &job);
+
+    BoundedQueue<WriteJob> _queue;
+    bool _background = false;
+    std::thread _thread;
+    std::thread::id _thread_id;
+    std::mutex _mutex;
+    WriterStats _stats;
+};
+
+void SetWriterDepth(size_t depth);
+Writer &SharedWriter();
+Writer &SharedPreviewWriter();
+
+/**
+ * Encode an image as FITS on the calling thread and hand it
+ * to the shared writer. Float images stored at a lower precision
+ * report how far they are from the originals.
+ */
+template<typename T>
+void QueueFITS(std::string const &path, T const &image, FitsCompression const &comp = FitsCompression(),
+    Precision precision = Precision::F32, std::shared_ptr<WriteGroup> const &group = nullptr) {
+    WriteJob job;
+    job.path = path;
+    TrackWrite(job, group);
+    QuantError error;
+    job.bytes = std::make_shared<const std::vector<char>>(EncodeFITS(image, comp, precision, &error));
+
+    bool is_float = std::is_same<T, imagine::ImageF32L>::value || std::is_same<T, imagine::ImageF32L3D>::value;
+
+    if (is_float && precision != Precision::F32) {
+        // FITS has no half float, so f16 is stored as u16 too
+        std::cout << "Quantised " << path << " to u16, max error " << error.max_error << ", rms " << error.rms_error << std::endl;
+    }
+
+    SharedWriter().Write(job);
+}
+
+/**
+ * Hand a JPG to a writer, which encodes it.
+ */
+template<typename T>
+void QueueJPG(std::string const &path, T const &image, Writer &writer = SharedWriter()) {
+    WriteJob job;
+    job.path = path;
+    std::shared_ptr<const T> copy = std::make_shared<const T>(image);
+    job.save = [copy] (std::string const &tmp_path) { imagine::SaveJPG(tmp_path, *copy); };
+    writer.Write(job);
+}
+
+#endif
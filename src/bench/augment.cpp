@@ -0,0 +1,102 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file augment.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Benchmark the row-major and bricked Augment layouts
+ * 
+ * Rotates a synthetic, master ROI sized volume at several angles
+ * and reports the time for each layout.
+ * 
+ * ./release/bench_augment [roi_xy] [repeats]
+ *
+ */
+
+#include <imagine/imagine.hpp>
+#include <chrono>
+#include <random>
+#include "rots.hpp"
+
+using namespace imagine;
+
+double TimeAugment(ImageF32L3D &image, glm::quat q, size_t cube_dim, float zscale, size_t brick_dim, int repeats, ImageF32L3D &result) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < repeats; i++) {
+        if (brick_dim == 0) {
+            result = Augment(image, q, cube_dim, zscale, true, true);
+        } else {
+            result = AugmentBricked(image, q, cube_dim, zscale, true, true, brick_dim);
+        }
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(repeats);
+}
+
+
+int main (int argc, char ** argv) {
+    size_t roi_xy = 200;
+    int repeats = 3;
+    float zscale = 6.2;
+
+    if (argc > 1) { roi_xy = libcee::FromString<size_t>(argv[1]); }
+    if (argc > 2) { repeats = libcee::FromString<int>(argv[2]); }
+
+    // Same sizing as the master ROI in ProcessMask
+    float half_roi = static_cast<float>(roi_xy) / 2.0;
+    size_t d = static_cast<size_t>(ceil(sqrt(2.0f * half_roi * half_roi))) * 2;
+    size_t depth = static_cast<size_t>(ceil(static_cast<float>(d) / zscale));
+
+    ImageF32L3D image(d, d, depth);
+    std::default_random_engine generator(42);
+    std::uniform_real_distribution<float> distrib(0.0f, 4096.0f);
+
+    for (size_t z = 0; z < image.depth; z++) {
+        for (size_t y = 0; y < image.height; y++) {
+            for (size_t x = 0; x < image.width; x++) {
+                image.data[z][y][x] = distrib(generator);
+            }
+        }
+    }
+
+    std::vector<float> angles = {0.0f, 15.0f, 30.0f, 45.0f, 90.0f};
+    std::vector<size_t> layouts = {0, 4, 8};
+    std::cout << "angle,layout,ms,max_diff" << std::endl;
+
+    for (float angle : angles) {
+        glm::quat q(1.0, 0, 0, 0);
+        float rads = angle / 180.0f * M_PI;
+        q = glm::rotate(q, rads, glm::vec3(1.0, 0.0, 0.0));
+        q = glm::rotate(q, rads, glm::vec3(0.0, 1.0, 0.0));
+
+        ImageF32L3D reference;
+
+        for (size_t brick_dim : layouts) {
+            ImageF32L3D result;
+            double ms = TimeAugment(image, q, roi_xy, zscale, brick_dim, repeats, result);
+            float max_diff = 0;
+
+            if (brick_dim == 0) {
+                reference = result;
+            } else {
+                for (size_t z = 0; z < result.depth; z++) {
+                    for (size_t y = 0; y < result.height; y++) {
+                        for (size_t x = 0; x < result.width; x++) {
+                            max_diff = std::max(max_diff, std::abs(result.data[z][y][x] - reference.data[z][y][x]));
+                        }
+                    }
+                }
+            }
+
+            std::string layout = brick_dim == 0 ? "rows" : "brick" + libcee::ToString(brick_dim);
+            std::cout << angle << "," << layout << "," << ms << "," << max_diff << std::endl;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
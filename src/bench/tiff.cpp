@@ -0,0 +1,87 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file tiff.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Benchmark imagine's LoadTiff against the parallel strip decoder
+ * 
+ * With no arguments, AutoStack sized uncompressed and LZW tiffs are
+ * written to the current directory and used. Otherwise each argument
+ * is a 16 bit tiff to load.
+ * 
+ * ./release/bench_tiff [tiff ...]
+ *
+ */
+
+#include <imagine/imagine.hpp>
+#include <chrono>
+#include "tiffstack.hpp"
+
+using namespace imagine;
+
+void WriteBenchTiff(std::string const &path, uint32_t width, uint32_t length, uint16_t compression) {
+    TIFF *tif = TIFFOpen(path.c_str(), "w");
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, length);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 16);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 16);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    std::vector<uint16_t> row(width);
+
+    for (uint32_t y = 0; y < length; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            // Smooth-ish so LZW has something to do
+            row[x] = static_cast<uint16_t>(200 + ((x / 8 + y / 8) % 64) * 50 + (x * y) % 7);
+        }
+        TIFFWriteScanline(tif, row.data(), y, 0);
+    }
+
+    TIFFClose(tif);
+}
+
+template<typename F>
+double TimeMs(F func, int repeats) {
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < repeats; i++) {
+        func();
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(repeats);
+}
+
+
+int main (int argc, char ** argv) {
+    std::vector<std::string> paths;
+    int repeats = 3;
+
+    for (int i = 1; i < argc; i++) {
+        paths.push_back(std::string(argv[i]));
+    }
+
+    if (paths.empty()) {
+        // 640 x 300, 2 channels, 51 slices
+        paths.push_back("./bench_uncompressed.tif");
+        paths.push_back("./bench_lzw.tif");
+        WriteBenchTiff(paths[0], 640, 300 * 2 * 51, COMPRESSION_NONE);
+        WriteBenchTiff(paths[1], 640, 300 * 2 * 51, COMPRESSION_LZW);
+    }
+
+    std::cout << "file,LoadTiff_ms,parallel_ms,threads" << std::endl;
+
+    for (std::string path : paths) {
+        double imagine_ms = TimeMs([&path] () { ImageU16L image = LoadTiff<ImageU16L>(path); }, repeats);
+        double parallel_ms = TimeMs([&path] () { ImageU16L image = LoadTiffImage(path); }, repeats);
+        std::cout << path << "," << imagine_ms << "," << parallel_ms << "," << PoolSize() << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -68,24 +68,14 @@ bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path
     }
 
     // Read the dat file and write out the coordinates in order as an entry in a CSV file
-    std::vector<std::string> lines = libcee::ReadFileLines(coord_path);
-    if(lines.size() != 4) {  return false; }
+    std::vector<NeuronRecord> records = ParseNeuronDat(libcee::ReadFileLines(coord_path));
+    if(records.size() != 4) {  return false; }
 
     // Should be ASI-1, ASI-2, ASJ-1, ASJ-2
 
     int type_idx = 1;
     // Get the required data from the .dat files in the annotation
-    for (std::string line : lines) {
-        std::vector<std::string> tokens = libcee::SplitStringWhitespace(line);
-        std::string x = libcee::RemoveChar(libcee::RemoveChar(tokens[4], ','), ' ');
-        std::string y = libcee::RemoveChar(libcee::RemoveChar(libcee::RemoveChar(tokens[3], ','), ' '), '[');
-        std::string z = libcee::RemoveChar(libcee::RemoveChar(libcee::RemoveChar(tokens[5], ','), ' '), ']');
-    
-        std::string fl = libcee::RemoveChar(libcee::RemoveChar(tokens[1], ','), ' ');
-        std::string mode_fl = libcee::RemoveChar(libcee::RemoveChar(tokens[6], ','), ' ');
-        std::string min_fl = libcee::RemoveChar(libcee::RemoveChar(tokens[7], ','), ' ');
-        std::string bg = libcee::RemoveChar(libcee::RemoveChar(tokens[2], ','), ' ');
-        std::string rsize = libcee::RemoveChar(libcee::RemoveChar(tokens[8], ','), ' ');
+    for (NeuronRecord const &r : records) {
         std::string type = libcee::ToString(type_idx);
 
         try {
@@ -93,7 +83,7 @@ bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path
             std::string sql_string = "INSERT INTO wormz (tifffile, logfile, datfile, x, y, z, fl, mode_fl, min_fl, bg, rsize, type) VALUES (";
             std::string D = ", ";
             std::string Q = "'";
-            sql_string += Q + tiff_path + Q + D + Q + log_path + Q + D + Q + coord_path + Q + D + x + D + y + D + z + D + fl + D + mode_fl + D + min_fl + D + bg + D + rsize + D + type;
+            sql_string += Q + tiff_path + Q + D + Q + log_path + Q + D + Q + coord_path + Q + D + r.x + D + r.y + D + r.z + D + r.fl + D + r.mode_fl + D + r.min_fl + D + r.bg + D + r.rsize + D + type;
             sql_string += ")";
             // Create a transactional object
             work W(C);
@@ -191,66 +181,24 @@ int main (int argc, char ** argv) {
 
     std::cout << "Loading annotation images from " << options.annotation_path << std::endl;
 
-    // First, find and sort the annotation files
-    std::vector<std::string> tiff_anno_files = FindAnnotations(options.annotation_path);
-
-    // Next, find the annotation dat files
-    std::vector<std::string> dat_files = FindDatFiles(options.annotation_path);
-
-    // Next, find the annotation log files
-    std::vector<std::string> log_files = FindLogFiles(options.annotation_path);
-
-    std::vector<std::string> tiff_input_files = FindInputFiles(options.image_path);
+    // Find the annotations, logs, dats and input files in one scan of each directory
+    DataIndex index = IndexData(options.annotation_path, options.image_path);
 
     // Pair up the tiffs with their log file and then the input and process them.
-    for (std::string tiff_anno : tiff_anno_files) {
-        bool paired = false;
-        std::vector<std::string> tokens = libcee::SplitStringChars(libcee::FilenameFromPath(tiff_anno), "_.-");
-        std::string id = tokens[0];
-
-        for (std::string log : log_files) {
-            std::vector<std::string> tokens_log = libcee::SplitStringChars(libcee::FilenameFromPath(log), "_.-");
-            if (tokens_log[0] == id) {
-
-                for (std::string dat : dat_files) {
-                    std::vector<std::string> tokens_dat = libcee::SplitStringChars(libcee::FilenameFromPath(dat), "_.-");
-                    if (tokens_dat[0] == id) {
-                        
-                        for (std::string tiff_input : tiff_input_files) {
-                            // Find the matching input stack
-                            std::vector<std::string> tokens1 = libcee::SplitStringChars(libcee::FilenameFromPath(tiff_input), "_.-");
-                            int tidx = 0;
-
-                            for (std::string t : tokens1) {
-                                if (libcee::StringContains(t, "AutoStack")) {
-                                    break;
-                                }
-                                tidx += 1;
-                            }
-                            
-                            int ida = libcee::FromString<int>(libcee::StringRemove(tokens1[tidx], "0xAutoStack"));
-                            int idb = libcee::FromString<int>(libcee::StringRemove(id, "ID"));
-
-                            if (ida == idb) {
-                                try {
-                                    std::cout << "Masking: " << dat << std::endl;
-                                    ProcessMask(options, tiff_anno, log, dat, image_idx, C);
-                                    paired = true;
-                    
-                                } catch (const std::exception &e) {
-                                    std::cout << "An exception occured with" << tiff_anno << " and " <<  tiff_input << std::endl;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
+    std::vector<std::string> unpaired, unused;
+    std::vector<Pair> pairs = PairData(index, true, unpaired, unused);
+    ReportUnmatched(unpaired, unused);
 
-        if (!paired){
-            std::cout << "Failed to pair or insert" << tiff_anno << std::endl;
+    for (Pair pair : pairs) {
+        try {
+            std::cout << "Masking: " << pair.dat << std::endl;
+            ProcessMask(options, pair.anno, pair.log, pair.dat, image_idx, C);
+        } catch (const std::exception &e) {
+            std::cout << "An exception occured with" << pair.anno << " and " <<  pair.input << std::endl;
+            std::cout << "Failed to pair or insert" << pair.anno << std::endl;
         }
     }
+
     // Version 7 of the library (on Proto) doesnt have this
     // C.disconnect ();
 
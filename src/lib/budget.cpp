@@ -0,0 +1,290 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file budget.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Memory estimates and admission for concurrent pairs.
+ *
+ */
+
+#include "budget.hpp"
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Estimate a pair's peak memory. Without an ROI the whole stack is
+ * processed, otherwise just the master ROI, which is large enough to
+ * rotate the final ROI within.
+ *
+ * @param options - the options for the run
+ * @param width, height - the size of the input images
+ *
+ * @return PairMemory
+ */
+
+PairMemory EstimatePairMemory(Options const &options, size_t width, size_t height) {
+    size_t stack = static_cast<size_t>(options.stacksize);
+    size_t w = width, h = height, d = stack;
+
+    if (!options.noroi) {
+        size_t side = static_cast<size_t>(std::ceil(static_cast<double>(options.roi_xy) * std::sqrt(2.0)));
+        w = std::min(width, side);
+        h = std::min(height, side);
+        d = std::min(stack, static_cast<size_t>(std::ceil(static_cast<double>(side) / options.depth_scale)) * 2);
+    }
+
+    size_t voxels = w * h * d;
+    size_t final_voxels = static_cast<size_t>(options.final_width) * static_cast<size_t>(options.final_height) *
+        (options.flatten ? 1 : static_cast<size_t>(options.final_depth));
+    PairMemory memory;
+
+    // Both files in memory, the annotation as 16 bit and as a mask
+    memory.base += width * height * stack * static_cast<size_t>(options.channels) * 2;
+    memory.base += width * height * 2 * 2;
+    // The 16 bit window, then float copies through processing, and the dense master mask
+    memory.base += voxels * 2 + voxels * 4 * 2 + voxels;
+
+    if (options.deconv) {
+        // Complex spectra of the volume, the kernel and their product
+        memory.base += voxels * 8 * 3;
+    }
+
+    // Each augmentation scales the volume along Z, rotates out its ROI, then
+    // resizes. The result waits, encoded, on the writer.
+    double scaled = static_cast<double>(voxels) * options.depth_scale;
+    double roi = static_cast<double>(options.roi_xy * options.roi_xy * options.roi_depth) * options.depth_scale;
+    memory.per_aug = static_cast<size_t>((scaled + roi) * 4.0) + final_voxels * 4 * 2;
+    return memory;
+}
+
+/**
+ * Read a size like 4096, 512M or 32G, in bytes.
+ */
+bool ParseBytes(std::string const &text, size_t &bytes) {
+    char *end = NULL;
+    double value = std::strtod(text.c_str(), &end);
+
+    if (end == text.c_str() || value < 0) {
+        return false;
+    }
+
+    std::string unit(end);
+    double mult = 1.0;
+
+    if (unit == "K" || unit == "k") {
+        mult = 1024.0;
+    } else if (unit == "M" || unit == "m") {
+        mult = 1024.0 * 1024.0;
+    } else if (unit == "G" || unit == "g") {
+        mult = 1024.0 * 1024.0 * 1024.0;
+    } else if (!unit.empty()) {
+        return false;
+    }
+
+    bytes = static_cast<size_t>(value * mult);
+    return true;
+}
+
+// Resident memory now, from /proc/self/statm. 0 if we can't tell.
+size_t CurrentRSS() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+
+    if (!(statm >> pages >> resident)) {
+        return 0;
+    }
+
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// The highest resident memory so far, from VmHWM in /proc/self/status
+size_t PeakRSS() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            std::stringstream ss(line.substr(6));
+            size_t kb = 0;
+            ss >> kb;
+            return kb * 1024;
+        }
+    }
+
+    return 0;
+}
+
+// The size of a file on disk. 0 if it isn't there.
+size_t FileBytes(std::string const &path) {
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0) {
+        return 0;
+    }
+
+    return static_cast<size_t>(st.st_size);
+}
+
+void MemoryBudget::SetBudget(size_t budget) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _budget = budget;
+    _baseline = CurrentRSS();
+}
+
+size_t MemoryBudget::_Cost(PairMemory const &estimate, size_t augs) const {
+    return static_cast<size_t>(static_cast<double>(estimate.base + estimate.per_aug * augs) * _scale);
+}
+
+/**
+ * If the memory we are actually using is more than we estimated for
+ * the pairs running, scale up the estimates from now on.
+ */
+void MemoryBudget::_Check() {
+    size_t rss = CurrentRSS();
+
+    // Small differences are threads, buffers and the like, not the pairs
+    if (rss <= _baseline + (64ul << 20) || _estimated == 0) {
+        return;
+    }
+
+    double ratio = static_cast<double>(rss - _baseline) / static_cast<double>(_estimated);
+
+    if (ratio > _scale) {
+        _scale = std::min(ratio, 4.0);
+    }
+}
+
+/**
+ * Wait until there is room for files to be read ahead of their pair,
+ * or nothing else is using the budget. The reservation is handed to
+ * Admit, which swaps it for the pair's own charge.
+ *
+ * @param bytes - the size of the files
+ *
+ * @return BudgetGrant - what was reserved
+ */
+
+BudgetGrant MemoryBudget::Reserve(size_t bytes) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    BudgetGrant grant;
+
+    if (_budget == 0) {
+        return grant;
+    }
+
+    _freed.wait(lock, [&] () { return _used + bytes <= _budget || _used == 0; });
+    grant.charged = bytes;
+    grant.estimated = bytes;
+    _used += bytes;
+    _reserved += bytes;
+    _estimated += bytes;
+    return grant;
+}
+
+/**
+ * Wait until the pair fits in the budget. Rather than wait, a pair
+ * runs fewer augmentations at once. A pair that doesn't fit even on
+ * its own still runs, once no other pair is.
+ *
+ * @param estimate - from EstimatePairMemory
+ * @param max_augs - the most augmentations it would run at once
+ * @param held - what Reserve took for the pair's files, which the estimate covers
+ *
+ * @return BudgetGrant - how many augmentations it may run at once, and what it was charged
+ */
+
+BudgetGrant MemoryBudget::Admit(PairMemory const &estimate, size_t max_augs, BudgetGrant const &held) {
+    max_augs = std::max(static_cast<size_t>(1), max_augs);
+    std::unique_lock<std::mutex> lock(_mutex);
+    BudgetGrant grant;
+    grant.augs = max_augs;
+
+    if (_budget == 0) {
+        return grant;
+    }
+
+    size_t augs = 0;
+
+    _freed.wait(lock, [&] () {
+        _Check();
+        size_t others = _used - std::min(_used, held.charged);
+
+        for (augs = max_augs; augs > 0; augs--) {
+            if (others + _Cost(estimate, augs) <= _budget) {
+                return true;
+            }
+        }
+
+        // Files read ahead for other pairs don't hold this one up
+        augs = 1;
+        return _used == _reserved;
+    });
+
+    if (augs < max_augs) {
+        _degraded++;
+    }
+
+    if (_Cost(estimate, augs) > _budget) {
+        std::cout << "A pair needs about " << _Cost(estimate, augs) / (1024 * 1024) << " MB, more than the memory budget" << std::endl;
+    }
+
+    grant.augs = augs;
+    grant.charged = _Cost(estimate, augs);
+    grant.estimated = estimate.base + estimate.per_aug * augs;
+    _used = _used - std::min(_used, held.charged) + grant.charged;
+    _reserved -= std::min(_reserved, held.charged);
+    _estimated = _estimated - std::min(_estimated, held.estimated) + grant.estimated;
+
+    // Giving back the reservation may let the loader read more
+    if (held.charged > 0) {
+        _freed.notify_all();
+    }
+
+    return grant;
+}
+
+/**
+ * Give back exactly what a pair was charged when it was admitted.
+ */
+
+void MemoryBudget::Release(BudgetGrant const &grant) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_budget == 0) {
+        return;
+    }
+
+    _Check();
+    _used -= std::min(_used, grant.charged);
+    _estimated -= std::min(_estimated, grant.estimated);
+    _freed.notify_all();
+}
+
+/**
+ * The scaled bytes charged to the pairs running now.
+ */
+
+size_t MemoryBudget::InUse() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _used;
+}
+
+void MemoryBudget::Report() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_budget == 0) {
+        return;
+    }
+
+    std::cout << "Memory: budget " << _budget / (1024 * 1024) << " MB, peak resident " << PeakRSS() / (1024 * 1024)
+        << " MB, estimates scaled by " << _scale << ", " << _degraded << " pairs ran fewer augmentations at once" << std::endl;
+}
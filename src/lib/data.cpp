@@ -13,6 +13,9 @@
  */
 
 #include "data.hpp"
+#include <iostream>
+#include <fstream>
+#include <sys/stat.h>
 
 using namespace imagine;
 
@@ -162,3 +165,291 @@ std::vector<std::string> FindInputFiles(std::string image_path) {
     std::sort(tiff_input_files.begin(), tiff_input_files.end(), SortOrderInput);
     return tiff_input_files;
 }
+
+// The ID token of an annotation, log or dat name, e.g. ID123
+std::string _FileID(std::string const &path) {
+    std::vector<std::string> tokens = libcee::SplitStringChars(libcee::FilenameFromPath(path), "_.-");
+    return tokens.empty() ? std::string() : tokens[0];
+}
+
+// The number in an ID token, or -1
+int _IDNumber(std::string const &id) {
+    std::string number = libcee::StringRemove(id, "ID");
+
+    if (number.empty() || number.find_first_not_of("0123456789") != std::string::npos) {
+        return -1;
+    }
+
+    return libcee::FromString<int>(number);
+}
+
+// The AutoStack number of an input stack, or -1
+int _InputNumber(std::string const &path) {
+    std::vector<std::string> tokens = libcee::SplitStringChars(libcee::FilenameFromPath(path), "_.-");
+
+    for (std::string const &t : tokens) {
+        if (libcee::StringContains(t, "AutoStack")) {
+            return _IDNumber("ID" + libcee::StringRemove(t, "0xAutoStack"));
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Scan the annotation and input directories once each, sorting the
+ * files into the same groups as the Find functions, keyed by ID so
+ * pairing is a lookup rather than a search.
+ *
+ * @param annotation_path - the annotations directory
+ * @param image_path - the input directory, or empty to skip inputs
+ *
+ * @return DataIndex
+ */
+
+DataIndex IndexData(std::string annotation_path, std::string image_path) {
+    DataIndex index;
+    std::vector<std::pair<int, std::string>> annotations;
+
+    for (std::string const &filename : libcee::ListFiles(annotation_path)) {
+        if (libcee::StringContains(filename, ".log")) {
+            index.logs[_FileID(filename)].push_back(filename);
+        }
+
+        bool tagged = libcee::StringContains(filename, "ID");
+
+        if (tagged && libcee::StringContains(filename, ".dat") && libcee::StringContains(filename, "_2")) {
+            index.dats[_FileID(filename)].push_back(filename);
+        }
+
+        if (tagged && libcee::StringContains(filename, ".tif") && libcee::StringContains(filename, "WS")) {
+            annotations.push_back(std::make_pair(_IDNumber(_FileID(filename)), filename));
+        }
+    }
+
+    // Each name is only split once, for the sort key
+    std::stable_sort(annotations.begin(), annotations.end(),
+        [] (std::pair<int, std::string> const &a, std::pair<int, std::string> const &b) { return a.first < b.first; });
+
+    for (auto const &anno : annotations) {
+        index.annotations.push_back(anno.second);
+    }
+
+    if (!image_path.empty()) {
+        for (std::string const &filename : libcee::ListFiles(image_path)) {
+            if (libcee::StringContains(filename, ".tif") && libcee::StringContains(filename, "AutoStack")) {
+                index.inputs[_InputNumber(filename)].push_back(filename);
+            }
+        }
+    }
+
+    return index;
+}
+
+/**
+ * Match each annotation tiff to its log, dat and input stack by ID,
+ * in the same order as the annotations. An annotation with more than
+ * one log or dat gives a pair for each combination, as before.
+ *
+ * @param index - from IndexData
+ * @param need_input - whether a pair must have an input stack
+ * @param unpaired - annotations with nothing to pair with are added here
+ * @param unused - logs, dats and inputs no annotation used are added here
+ *
+ * @return std::vector<Pair>
+ */
+
+std::vector<Pair> PairData(DataIndex const &index, bool need_input, std::vector<std::string> &unpaired, std::vector<std::string> &unused) {
+    std::vector<Pair> pairs;
+    std::unordered_map<std::string, bool> used;
+
+    for (std::string const &tiff_anno : index.annotations) {
+        std::string id = _FileID(tiff_anno);
+        auto logs = index.logs.find(id);
+        auto dats = index.dats.find(id);
+        auto inputs = index.inputs.find(_IDNumber(id));
+        bool has_input = inputs != index.inputs.end() && _IDNumber(id) >= 0;
+
+        if (logs == index.logs.end() || dats == index.dats.end() || (need_input && !has_input)) {
+            unpaired.push_back(tiff_anno);
+            continue;
+        }
+
+        for (std::string const &log : logs->second) {
+            for (std::string const &dat : dats->second) {
+                Pair pair;
+                pair.anno = tiff_anno;
+                pair.log = log;
+                pair.dat = dat;
+
+                if (has_input) {
+                    pair.input = inputs->second.front();
+                    used[pair.input] = true;
+                }
+
+                used[log] = true;
+                used[dat] = true;
+                pairs.push_back(pair);
+            }
+        }
+    }
+
+    auto unused_in = [&used, &unused] (std::vector<std::string> const &files) {
+        for (std::string const &f : files) {
+            if (used.find(f) == used.end()) {
+                unused.push_back(f);
+            }
+        }
+    };
+
+    for (auto const &logs : index.logs) { unused_in(logs.second); }
+    for (auto const &dats : index.dats) { unused_in(dats.second); }
+
+    if (need_input) {
+        for (auto const &inputs : index.inputs) { unused_in(inputs.second); }
+    }
+
+    std::sort(unused.begin(), unused.end());
+    return pairs;
+}
+
+/**
+ * Read a manifest of acquisitions to build one dataset from. Each line
+ * holds an image directory then its annotation directory, split by a
+ * comma or spaces. Blank lines and lines starting with # are skipped.
+ * Relative directories are relative to the manifest.
+ *
+ * @param manifest_path - the manifest file
+ *
+ * @return std::vector<Acquisition> - in the order listed
+ */
+
+std::vector<Acquisition> ReadManifest(std::string manifest_path) {
+    std::ifstream file(manifest_path);
+
+    if (!file) {
+        throw std::runtime_error("Failed to open manifest " + manifest_path);
+    }
+
+    std::string base;
+    size_t slash = manifest_path.find_last_of('/');
+
+    if (slash != std::string::npos) {
+        base = manifest_path.substr(0, slash + 1);
+    }
+
+    auto resolve = [&base] (std::string const &path) {
+        return path[0] == '/' ? path : base + path;
+    };
+
+    std::vector<Acquisition> acquisitions;
+    std::string line;
+    size_t line_number = 0;
+
+    while (std::getline(file, line)) {
+        line_number++;
+        std::vector<std::string> tokens = libcee::SplitStringChars(line, ", \t\r");
+
+        if (tokens.empty() || tokens[0][0] == '#') {
+            continue;
+        }
+
+        if (tokens.size() != 2) {
+            throw std::runtime_error("Line " + libcee::ToString(line_number) + " of " + manifest_path + " should be an image and an annotation directory");
+        }
+
+        Acquisition acquisition;
+        acquisition.image_path = resolve(tokens[0]);
+        acquisition.annotation_path = resolve(tokens[1]);
+        acquisitions.push_back(acquisition);
+    }
+
+    return acquisitions;
+}
+
+/**
+ * Say which files could not be paired up.
+ */
+
+void ReportUnmatched(std::vector<std::string> const &unpaired, std::vector<std::string> const &unused) {
+    for (std::string const &tiff_anno : unpaired) {
+        std::cout << "Failed to pair " << tiff_anno << std::endl;
+    }
+
+    for (std::string const &f : unused) {
+        std::cout << "Unmatched " << f << std::endl;
+    }
+
+    if (!unpaired.empty() || !unused.empty()) {
+        std::cout << unpaired.size() << " annotations without a pair, " << unused.size() << " other files unmatched" << std::endl;
+    }
+}
+
+/**
+ * Read the lines of a .dat file - one neuron per line, as
+ * name fl bg [y, x, z] mode_fl min_fl rsize
+ * Lines too short to hold all of these are skipped.
+ *
+ * @param lines - the lines of the .dat file
+ *
+ * @return std::vector<NeuronRecord> in the order of the file
+ */
+
+std::vector<NeuronRecord> ParseNeuronDat(std::vector<std::string> const &lines) {
+    std::vector<NeuronRecord> records;
+
+    auto clean = [](std::string token) {
+        for (char c : {',', ' ', '[', ']'}) {
+            token = libcee::RemoveChar(token, c);
+        }
+        return token;
+    };
+
+    for (std::string const &line : lines) {
+        std::vector<std::string> tokens = libcee::SplitStringWhitespace(line);
+
+        if (tokens.size() < 9) {
+            continue;
+        }
+
+        NeuronRecord record;
+        record.name = clean(tokens[0]);
+        record.fl = clean(tokens[1]);
+        record.bg = clean(tokens[2]);
+        record.y = clean(tokens[3]);
+        record.x = clean(tokens[4]);
+        record.z = clean(tokens[5]);
+        record.mode_fl = clean(tokens[6]);
+        record.min_fl = clean(tokens[7]);
+        record.rsize = clean(tokens[8]);
+        records.push_back(record);
+    }
+
+    return records;
+}
+
+/**
+ * FNV-1a, 64 bit. Only used to spot changes, not for security.
+ */
+uint64_t HashString(std::string const &text, uint64_t hash) {
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/**
+ * Identify a file by its path, size and modification time, rather
+ * than reading the whole thing.
+ */
+std::string FileStamp(std::string const &path) {
+    struct stat st;
+
+    if (stat(path.c_str(), &st) != 0) {
+        return path + ":missing";
+    }
+
+    return path + ":" + libcee::ToString(st.st_size) + ":" + libcee::ToString(st.st_mtime);
+}
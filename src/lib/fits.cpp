@@ -0,0 +1,325 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file fits.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief FITS encoding to memory, and atomic file writes.
+ *
+ * cfitsio builds the whole file in a memory buffer, which we then
+ * write out with a single preallocated write. Pixels go in the same
+ * order as imagine's SaveFITS - x fastest, then rows, then slices -
+ * so the files are the same as before.
+ *
+ * With compression on, cfitsio writes an empty primary HDU and the
+ * image as a tile compressed binary table in the second. The masks
+ * are nearly all zero, so Rice shrinks them enormously.
+ */
+
+#include "fits.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+using namespace imagine;
+
+// The FITS types for each of our pixel types
+template<typename V> struct _FitsType {};
+template<> struct _FitsType<uint8_t> { static const int bitpix = BYTE_IMG; static const int datatype = TBYTE; static const int compression = RICE_1; };
+template<> struct _FitsType<uint16_t> { static const int bitpix = USHORT_IMG; static const int datatype = TUSHORT; static const int compression = RICE_1; };
+template<> struct _FitsType<int16_t> { static const int bitpix = SHORT_IMG; static const int datatype = TSHORT; static const int compression = RICE_1; };
+template<> struct _FitsType<float> { static const int bitpix = FLOAT_IMG; static const int datatype = TFLOAT; static const int compression = GZIP_2; };
+
+void _CheckFits(int status, std::string const &what) {
+    if (status != 0) {
+        char msg[FLEN_ERRMSG];
+        fits_get_errstatus(status, msg);
+        throw std::runtime_error("FITS " + what + " failed: " + std::string(msg));
+    }
+}
+
+/**
+ * Set up tile compression. Must come before the image is created.
+ */
+void _SetCompression(fitsfile *fptr, int compression, bool is_float, int naxis, long *naxes, FitsCompression const &comp, int *status) {
+    long tile[3] = {comp.tile_x, comp.tile_y, comp.tile_z};
+
+    for (int i = 0; i < naxis; i++) {
+        if (tile[i] <= 0 || tile[i] > naxes[i]) {
+            tile[i] = naxes[i];
+        }
+    }
+
+    fits_set_compression_type(fptr, compression, status);
+    fits_set_tile_dim(fptr, naxis, tile, status);
+
+    if (is_float) {
+        // A level of zero turns quantisation off, so GZIP is lossless
+        fits_set_quantize_level(fptr, comp.quantize, status);
+
+        if (comp.quantize > 0) {
+            fits_set_quantize_method(fptr, SUBTRACTIVE_DITHER_1, status);
+        }
+    }
+}
+
+/**
+ * Encode a flat, x fastest, pixel buffer as a FITS file.
+ */
+template<typename V>
+std::vector<char> _EncodeFITS(std::vector<V> &pixels, int naxis, long *naxes, FitsCompression const &comp, double bscale = 1.0, double bzero = 0.0) {
+    size_t size = 2880 * 16;
+    void *buffer = malloc(size);
+    fitsfile *fptr = NULL;
+    int status = 0;
+    LONGLONG headstart = 0, datastart = 0, dataend = 0;
+
+    fits_create_memfile(&fptr, &buffer, &size, 2880 * 64, realloc, &status);
+
+    if (comp.compress && status == 0) {
+        _SetCompression(fptr, _FitsType<V>::compression, _FitsType<V>::bitpix == FLOAT_IMG, naxis, naxes, comp, &status);
+    }
+
+    fits_create_img(fptr, _FitsType<V>::bitpix, naxis, naxes, &status);
+
+    if (bscale != 1.0 || bzero != 0.0) {
+        // Readers apply these, but we write the stored values as they are
+        fits_write_key(fptr, TDOUBLE, "BSCALE", &bscale, "physical = BZERO + BSCALE * stored", &status);
+        fits_write_key(fptr, TDOUBLE, "BZERO", &bzero, NULL, &status);
+        fits_set_bscale(fptr, 1.0, 0.0, &status);
+    }
+
+    fits_write_img(fptr, _FitsType<V>::datatype, 1, static_cast<LONGLONG>(pixels.size()), pixels.data(), &status);
+    fits_flush_file(fptr, &status);
+    // The buffer may be bigger than the file, so find where the last HDU ends
+    fits_get_hduaddrll(fptr, &headstart, &datastart, &dataend, &status);
+    int close_status = 0;
+
+    if (fptr != NULL) {
+        fits_close_file(fptr, &close_status);
+    }
+
+    if (status != 0 || close_status != 0) {
+        free(buffer);
+        _CheckFits(status != 0 ? status : close_status, "encoding");
+    }
+
+    size_t length = std::min(size, static_cast<size_t>((dataend + 2879) / 2880 * 2880));
+    std::vector<char> bytes(static_cast<char*>(buffer), static_cast<char*>(buffer) + length);
+    free(buffer);
+    return bytes;
+}
+
+/**
+ * Gather the rows, x fastest, into one buffer for cfitsio.
+ */
+template<typename V>
+std::vector<char> _EncodeRows(std::vector<std::vector<V> const*> const &rows, int naxis, long *naxes, FitsCompression const &comp, Precision, QuantError *) {
+    std::vector<V> pixels;
+    pixels.reserve(rows.size() * static_cast<size_t>(naxes[0]));
+
+    for (std::vector<V> const *row : rows) {
+        pixels.insert(pixels.end(), row->begin(), row->end());
+    }
+
+    return _EncodeFITS(pixels, naxis, naxes, comp);
+}
+
+/**
+ * Floats can be stored as scaled 16 bit integers, with BSCALE and
+ * BZERO to get them back. FITS has no half float, so F16 is stored
+ * this way too. The rows are read once for their range, then
+ * quantised and shifted straight into the one buffer cfitsio needs,
+ * with no float copy in between. The scaling is QuantiseU16's.
+ */
+std::vector<char> _EncodeRows(std::vector<std::vector<float> const*> const &rows, int naxis, long *naxes, FitsCompression const &comp, Precision precision, QuantError *error) {
+    if (precision == Precision::F32 || rows.empty() || rows[0]->empty()) {
+        return _EncodeRows<float>(rows, naxis, naxes, comp, precision, error);
+    }
+
+    float min = (*rows[0])[0], max = min;
+
+    for (std::vector<float> const *row : rows) {
+        for (float value : *row) {
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+    }
+
+    QuantError q;
+    double range = static_cast<double>(max) - static_cast<double>(min);
+    q.zero = static_cast<double>(min);
+    q.scale = range > 0 ? range / 65535.0 : 1.0;
+    double inv = 1.0 / q.scale;
+    double sum_sq = 0;
+    std::vector<int16_t> shifted;
+    shifted.reserve(rows.size() * rows[0]->size());
+
+    // FITS 16 bit integers are signed, so shift by 32768 and fold that into BZERO
+    for (std::vector<float> const *row : rows) {
+        for (float value : *row) {
+            double stored = std::round((static_cast<double>(value) - q.zero) * inv);
+            stored = std::min(std::max(stored, 0.0), 65535.0);
+            shifted.push_back(static_cast<int16_t>(static_cast<int32_t>(stored) - 32768));
+            double diff = std::fabs(stored * q.scale + q.zero - static_cast<double>(value));
+            q.max_error = std::max(q.max_error, diff);
+            sum_sq += diff * diff;
+        }
+    }
+
+    q.rms_error = std::sqrt(sum_sq / static_cast<double>(shifted.size()));
+
+    if (error != nullptr) {
+        *error = q;
+    }
+
+    return _EncodeFITS(shifted, naxis, naxes, comp, q.scale, q.zero + 32768.0 * q.scale);
+}
+
+template<typename V>
+std::vector<char> _Encode2D(std::vector<std::vector<V>> const &data, size_t width, size_t height, FitsCompression const &comp, Precision precision, QuantError *error) {
+    std::vector<std::vector<V> const*> rows;
+    rows.reserve(height);
+
+    for (size_t y = 0; y < height; y++) {
+        rows.push_back(&data[y]);
+    }
+
+    long naxes[2] = {static_cast<long>(width), static_cast<long>(height)};
+    return _EncodeRows(rows, 2, naxes, comp, precision, error);
+}
+
+template<typename V>
+std::vector<char> _Encode3D(std::vector<std::vector<std::vector<V>>> const &data, size_t width, size_t height, size_t depth, FitsCompression const &comp, Precision precision, QuantError *error) {
+    std::vector<std::vector<V> const*> rows;
+    rows.reserve(height * depth);
+
+    for (size_t z = 0; z < depth; z++) {
+        for (size_t y = 0; y < height; y++) {
+            rows.push_back(&data[z][y]);
+        }
+    }
+
+    long naxes[3] = {static_cast<long>(width), static_cast<long>(height), static_cast<long>(depth)};
+    return _EncodeRows(rows, 3, naxes, comp, precision, error);
+}
+
+/**
+ * Encode an image as a FITS file in memory.
+ *
+ * @param image - the image to encode
+ * @param comp - tile compression settings
+ * @param precision - how to store float images. Ignored for the others.
+ * @param error - if not null, set to the quantisation error
+ *
+ * @return std::vector<char> - the bytes of the file
+ */
+
+std::vector<char> EncodeFITS(ImageU8L const &image, FitsCompression const &comp, Precision precision, QuantError *error) {
+    return _Encode2D(image.data, image.width, image.height, comp, precision, error);
+}
+
+std::vector<char> EncodeFITS(ImageU8L3D const &image, FitsCompression const &comp, Precision precision, QuantError *error) {
+    return _Encode3D(image.data, image.width, image.height, image.depth, comp, precision, error);
+}
+
+std::vector<char> EncodeFITS(ImageU16L const &image, FitsCompression const &comp, Precision precision, QuantError *error) {
+    return _Encode2D(image.data, image.width, image.height, comp, precision, error);
+}
+
+std::vector<char> EncodeFITS(ImageU16L3D const &image, FitsCompression const &comp, Precision precision, QuantError *error) {
+    return _Encode3D(image.data, image.width, image.height, image.depth, comp, precision, error);
+}
+
+std::vector<char> EncodeFITS(ImageF32L const &image, FitsCompression const &comp, Precision precision, QuantError *error) {
+    return _Encode2D(image.data, image.width, image.height, comp, precision, error);
+}
+
+std::vector<char> EncodeFITS(ImageF32L3D const &image, FitsCompression const &comp, Precision precision, QuantError *error) {
+    return _Encode3D(image.data, image.width, image.height, image.depth, comp, precision, error);
+}
+
+/**
+ * Parse a tile size such as 64x64x1 or 640x300. Missing axes
+ * keep their current value.
+ *
+ * @param text - the tile size
+ * @param comp - the settings to update
+ *
+ * @return bool - false if the text isn't a tile size
+ */
+
+bool ParseTile(std::string const &text, FitsCompression &comp) {
+    std::vector<std::string> tokens = libcee::SplitStringChars(text, "x,");
+    long *axes[3] = {&comp.tile_x, &comp.tile_y, &comp.tile_z};
+
+    if (tokens.empty() || tokens.size() > 3) {
+        return false;
+    }
+
+    for (size_t i = 0; i < tokens.size(); i++) {
+        char *end = NULL;
+        long value = std::strtol(tokens[i].c_str(), &end, 10);
+
+        if (end == tokens[i].c_str() || *end != '\0' || value < 0) {
+            return false;
+        }
+
+        *axes[i] = value;
+    }
+
+    return true;
+}
+
+/**
+ * Write a file next to its final path, then rename it into place,
+ * so readers never see a half written file. The space is allocated
+ * up front and the bytes go out in as few writes as possible.
+ *
+ * @param path - the final path
+ * @param bytes - the whole file
+ */
+
+void WriteFileAtomic(std::string const &path, std::vector<char> const &bytes) {
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + tmp_path + ": " + std::strerror(errno));
+    }
+
+    if (!bytes.empty()) {
+        posix_fallocate(fd, 0, static_cast<off_t>(bytes.size()));
+    }
+
+    size_t written = 0;
+
+    while (written < bytes.size()) {
+        ssize_t n = write(fd, bytes.data() + written, bytes.size() - written);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            std::string err = std::strerror(errno);
+            close(fd);
+            std::remove(tmp_path.c_str());
+            throw std::runtime_error("Failed to write " + tmp_path + ": " + err);
+        }
+
+        written += static_cast<size_t>(n);
+    }
+
+    if (close(fd) != 0 || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("Failed to move " + tmp_path + " to " + path);
+    }
+}
@@ -13,6 +13,7 @@
  */
 
 #include "image.hpp"
+#include "pool.hpp"
 
 using namespace imagine;
 
@@ -42,44 +43,106 @@ ImageU8L3D StackMask(ImageU16L &image_in, size_t width, size_t height, size_t st
 
 
 /**
- * Check the area id against the neuron list, setting it to what it claims to be.
- * Look at one channel only though, top or bottom
+ * Read the watershed IDs of each neuron from an annotation log. IDs
+ * before the first 'associate' line are class 0 (none), then each
+ * 'associate' moves on to the next class - ASI-1, ASI-2, ASJ-1, ASJ-2.
+ *
+ * @param lines - the lines of the log file
+ *
+ * @return the IDs for each class
  */
-bool SetNeuron(ImageU16L &image_in, ImageU8L3D &image_out, std::vector<std::vector<size_t>> &neurons, int neuron_id, bool flip_depth, bool flip_height, int id_to_write) {
-    bool neuron_set = false;
 
-    for (uint32_t d = 0; d < image_out.depth; d++) {
+std::vector<std::vector<size_t>> ParseNeuronLog(std::vector<std::string> const &lines) {
+    std::vector<std::vector<size_t>> neurons(5);
+    size_t idx = 0;
 
-        for (uint32_t y = 0; y < image_out.height; y++) {
+    for (std::string const &line : lines) {
+        std::vector<std::string> tokens = libcee::SplitStringWhitespace(line);
 
-            for (uint32_t x = 0; x < image_out.width; x++) {
+        if (tokens.empty()) {
+            continue;
+        }
 
-                size_t channel = d * image_out.height;
-                uint16_t val = image_in.data[channel + y][x];
-                
-                if (val != 0) {
-                    std::vector<size_t>::iterator it = std::find(neurons[neuron_id].begin(),
-                        neurons[neuron_id].end(), static_cast<size_t>(val));
-                    if (it != neurons[neuron_id].end()) {
-                        neuron_set = true;
-                        size_t fd = d;
-                        size_t fy = y;
-
-                        if (flip_depth) {
-                            fd = image_out.depth - d - 1;
-                        }
-                        if (flip_height){
-                            fy = image_out.height - y - 1;
-                        }
-                        
-                        image_out.data[fd][fy][x] = static_cast<uint8_t>(id_to_write);
-
-                    } 
+        if (libcee::ToLower(tokens[0]) == "associate") {
+            idx += 1;
+
+            if (idx >= neurons.size()) {
+                neurons.resize(idx + 1);
+            }
+        } else {
+            neurons[idx].push_back(libcee::FromString<size_t>(tokens[0]));
+        }
+    }
+
+    return neurons;
+}
+
+/**
+ * A lookup table from every 16 bit watershed ID to its class, or 0.
+ * If an ID is listed under more than one class, the last one wins.
+ */
+std::vector<uint8_t> NeuronLUT(std::vector<std::vector<size_t>> const &neurons) {
+    std::vector<uint8_t> lut(65536, 0);
+
+    for (size_t neuron_id = 1; neuron_id < neurons.size(); neuron_id++) {
+        for (size_t id : neurons[neuron_id]) {
+            if (id != 0 && id < lut.size()) {
+                lut[id] = static_cast<uint8_t>(neuron_id);
+            }
+        }
+    }
+
+    return lut;
+}
+
+/**
+ * Label every neuron in one pass over the watershed image, each
+ * voxel's class coming from the lookup table. Slices are labelled in
+ * parallel. Look at one channel only though, top or bottom.
+ *
+ * @param image_in - the watershed image, one slice after another
+ * @param image_out - the mask to write into
+ * @param lut - from NeuronLUT
+ * @param ids_to_write - the label to write for each class
+ * @param flip_depth, flip_height - flip the mask as it is written
+ *
+ * @return which classes were found, indexed as ids_to_write
+ */
+
+std::vector<bool> SetNeurons(ImageU16L const &image_in, ImageU8L3D &image_out, std::vector<uint8_t> const &lut, std::vector<uint8_t> const &ids_to_write, bool flip_depth, bool flip_height) {
+    size_t classes = ids_to_write.size();
+    std::vector<uint8_t> found(image_out.depth * classes, 0);
+
+    ParallelFor(image_out.depth, [&] (size_t d) {
+        size_t fd = flip_depth ? image_out.depth - d - 1 : d;
+        size_t channel = d * image_out.height;
+        uint8_t *slice_found = &found[d * classes];
+
+        for (size_t y = 0; y < image_out.height; y++) {
+            size_t fy = flip_height ? image_out.height - y - 1 : y;
+            const uint16_t *in_row = image_in.data[channel + y].data();
+            uint8_t *out_row = image_out.data[fd][fy].data();
+
+            for (size_t x = 0; x < image_out.width; x++) {
+                uint8_t neuron_id = lut[in_row[x]];
+
+                if (neuron_id != 0 && neuron_id < classes) {
+                    slice_found[neuron_id] = 1;
+                    out_row[x] = ids_to_write[neuron_id];
                 }
             }
         }
+    });
+
+    std::vector<bool> present(classes, false);
+
+    for (size_t d = 0; d < image_out.depth; d++) {
+        for (size_t c = 0; c < classes; c++) {
+            present[c] = present[c] || found[d * classes + c] != 0;
+        }
     }
-    return neuron_set;
+
+    return present;
 }
 
 /**
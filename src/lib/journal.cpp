@@ -0,0 +1,300 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file journal.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief The build journal and stage cache.
+ *
+ * Entries live in output/journal, one file per pair index, and are
+ * written by the shared writer after the pair's own files. As the
+ * writer works in order, an entry on disk means the files before it
+ * were written too.
+ *
+ */
+
+#include "journal.hpp"
+#include "writer.hpp"
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <algorithm>
+
+using namespace imagine;
+
+std::string _Hex(uint64_t hash) {
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return ss.str();
+}
+
+/**
+ * Work out the keys for a pair. A change in a stage's key means that
+ * stage, and those after it, need doing again.
+ *
+ * @param options - the options for this run
+ * @param pair - the pair's files
+ * @param seed - the pair's random seed
+ *
+ * @return StageKeys
+ */
+
+StageKeys MakeStageKeys(Options const &options, Pair const &pair, unsigned int seed) {
+    StageKeys keys;
+    std::stringstream input, mask, source, aug;
+    input << FileStamp(pair.anno) << "|" << FileStamp(pair.log) << "|" << FileStamp(pair.dat) << "|" << FileStamp(pair.input);
+    mask << options.noroi << "|" << options.roi_xy << "|" << options.depth_scale << "|" << options.threeclass << "|" << options.safeaug;
+    source << options.noprocess << "|" << options.otsu << "|" << options.autoback << "|" << options.cutoff << "|" << options.deconv << "|"
+        << options.psf_path << "|" << options.deconv_rounds << "|" << options.contrast << "|" << options.bottom << "|"
+        << options.channels << "|" << options.stacksize;
+    aug << seed << "|" << options.num_augs << "|" << options.subpixel << "|" << options.interz << "|" << options.bricked << "|"
+        << options.brick_dim << "|" << options.flatten << "|" << options.max_intensity << "|" << options.roi_depth << "|"
+        << options.final_width << "|" << options.final_height << "|" << options.final_depth << "|" << options.rename << "|"
+        << PrecisionName(options.precision) << "|" << options.fits.compress << "|" << options.fits.quantize << "|"
+        << options.fits.tile_x << "|" << options.fits.tile_y << "|" << options.fits.tile_z << "|" << options.shards << "|"
+        << options.combined << "|" << options.count_channel;
+
+    // Each key covers the stages before it as well
+    uint64_t hash = HashString(input.str());
+    keys.input = _Hex(hash);
+    hash = HashString(mask.str(), hash);
+    keys.mask = _Hex(hash);
+    hash = HashString(source.str(), hash);
+    keys.source = _Hex(hash);
+    keys.aug = _Hex(HashString(aug.str(), hash));
+    return keys;
+}
+
+bool SameKeys(StageKeys const &a, StageKeys const &b) {
+    return a.input == b.input && a.mask == b.mask && a.source == b.source && a.aug == b.aug;
+}
+
+/**
+ * Check the files a pair wrote are all there. FITS files must be a
+ * whole number of blocks long, which a cut off write will not be.
+ */
+bool OutputsValid(std::vector<std::string> const &outputs) {
+    for (std::string const &path : outputs) {
+        struct stat st;
+
+        if (stat(path.c_str(), &st) != 0 || st.st_size == 0) {
+            return false;
+        }
+
+        if (libcee::StringContains(path, ".fits") && st.st_size % 2880 != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Journal::Open(std::string const &output_path) {
+    _dir = output_path + "/journal";
+    mkdir(_dir.c_str(), 0755);
+}
+
+std::string Journal::_Path(int idx) const {
+    return _dir + "/" + libcee::IntToStringLeadingZeroes(idx, 5) + ".txt";
+}
+
+bool _ReadEntry(std::string const &path, JournalEntry &entry) {
+    std::ifstream file(path);
+
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(file, line)) {
+        size_t space = line.find(' ');
+
+        if (space == std::string::npos) {
+            continue;
+        }
+
+        std::string key = line.substr(0, space);
+        std::string value = line.substr(space + 1);
+
+        if (key == "idx") {
+            entry.idx = libcee::FromString<int>(value);
+        } else if (key == "input") {
+            entry.keys.input = value;
+        } else if (key == "mask") {
+            entry.keys.mask = value;
+        } else if (key == "source") {
+            entry.keys.source = value;
+        } else if (key == "aug") {
+            entry.keys.aug = value;
+        } else if (key == "output") {
+            entry.outputs.push_back(value);
+        } else if (key == "row") {
+            entry.rows.push_back(value);
+        } else if (key == "record") {
+            entry.records.push_back(libcee::FromString<size_t>(value));
+        } else if (key == "count") {
+            entry.counts.push_back(value);
+        } else if (key == "neuron") {
+            entry.neurons.push_back(value);
+        }
+    }
+
+    return true;
+}
+
+bool Journal::Find(int idx, JournalEntry &entry) const {
+    return _ReadEntry(_Path(idx), entry);
+}
+
+// Called before a pair is redone, so a failure doesn't leave the old entry behind
+void Journal::Forget(int idx) const {
+    std::remove(_Path(idx).c_str());
+}
+
+/**
+ * Queue an entry on the shared writer, behind the pair's own files.
+ */
+void Journal::Queue(JournalEntry const &entry) const {
+    std::stringstream ss;
+    ss << "idx " << entry.idx << "\n";
+    ss << "input " << entry.keys.input << "\n";
+    ss << "mask " << entry.keys.mask << "\n";
+    ss << "source " << entry.keys.source << "\n";
+    ss << "aug " << entry.keys.aug << "\n";
+
+    for (std::string const &output : entry.outputs) {
+        ss << "output " << output << "\n";
+    }
+
+    for (std::string const &row : entry.rows) {
+        ss << "row " << row << "\n";
+    }
+
+    for (size_t record : entry.records) {
+        ss << "record " << record << "\n";
+    }
+
+    for (std::string const &row : entry.counts) {
+        ss << "count " << row << "\n";
+    }
+
+    for (std::string const &row : entry.neurons) {
+        ss << "neuron " << row << "\n";
+    }
+
+    std::string text = ss.str();
+    WriteJob job;
+    job.path = _Path(entry.idx);
+    job.bytes = std::make_shared<const std::vector<char>>(text.begin(), text.end());
+    SharedWriter().Write(job);
+}
+
+std::vector<JournalEntry> Journal::All() const {
+    std::vector<JournalEntry> entries;
+
+    for (std::string const &path : libcee::ListFiles(_dir)) {
+        JournalEntry entry;
+
+        if (libcee::StringContains(path, ".txt") && !libcee::StringContains(path, ".tmp") && _ReadEntry(path, entry)) {
+            entries.push_back(entry);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [] (JournalEntry const &a, JournalEntry const &b) { return a.idx < b.idx; });
+    return entries;
+}
+
+/**
+ * Write a CSV from scratch out of the journal, in index order, so
+ * rows from runs that were stopped are never repeated.
+ *
+ * @param csv_path - the CSV to write
+ * @param header - its first line
+ * @param rows - which of each entry's rows go in it - the master CSV's by default
+ */
+void Journal::RewriteCSV(std::string const &csv_path, std::string const &header, std::vector<std::string> JournalEntry::*rows) const {
+    std::string text = header + "\n";
+
+    for (JournalEntry const &entry : All()) {
+        for (std::string const &row : entry.*rows) {
+            text += row + "\n";
+        }
+    }
+
+    WriteFileAtomic(csv_path, std::vector<char>(text.begin(), text.end()));
+}
+
+std::string StageCachePath(std::string const &output_path, StageKeys const &keys) {
+    std::string dir = output_path + "/cache";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/" + keys.source + ".vol";
+}
+
+// The cache file starts with these, then the floats, z then y then x
+typedef struct {
+    char magic[8];
+    uint64_t width;
+    uint64_t height;
+    uint64_t depth;
+    int64_t background;
+} _CacheHeader;
+
+/**
+ * Load a processed source volume from the stage cache.
+ *
+ * @return bool - false if there is no usable cache file
+ */
+bool LoadStageCache(std::string const &path, ImageF32L3D &image, int &background) {
+    std::ifstream file(path, std::ios::binary);
+    _CacheHeader header;
+
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, "WGLCACHE", 8) != 0) {
+        return false;
+    }
+
+    ImageF32L3D loaded(header.width, header.height, header.depth);
+
+    for (size_t z = 0; z < loaded.depth; z++) {
+        for (size_t y = 0; y < loaded.height; y++) {
+            if (!file.read(reinterpret_cast<char*>(loaded.data[z][y].data()), loaded.width * sizeof(float))) {
+                return false;
+            }
+        }
+    }
+
+    image = std::move(loaded);
+    background = static_cast<int>(header.background);
+    return true;
+}
+
+void QueueStageCache(std::string const &path, ImageF32L3D const &image, int background) {
+    _CacheHeader header;
+    std::memcpy(header.magic, "WGLCACHE", 8);
+    header.width = image.width;
+    header.height = image.height;
+    header.depth = image.depth;
+    header.background = background;
+
+    size_t row = image.width * sizeof(float);
+    std::vector<char> bytes(sizeof(header) + row * image.height * image.depth);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    char *out = bytes.data() + sizeof(header);
+
+    for (size_t z = 0; z < image.depth; z++) {
+        for (size_t y = 0; y < image.height; y++) {
+            std::memcpy(out, image.data[z][y].data(), row);
+            out += row;
+        }
+    }
+
+    WriteJob job;
+    job.path = path;
+    job.bytes = std::make_shared<const std::vector<char>>(std::move(bytes));
+    SharedWriter().Write(job);
+}
@@ -0,0 +1,230 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file labelstats.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Per label intensity statistics for the counts.
+ *
+ * Walking the mask's spans visits only the labelled voxels of the
+ * source. Each label keeps a histogram alongside its count, sum and
+ * range, so the top K sum, mode and percentiles need no sorting and
+ * no copies of the voxels. Our sensors are 12 bit, so one bin per
+ * value is exact; anything brighter lands in the last bin, whose
+ * exact sum is kept as well.
+ */
+
+#include "labelstats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+using namespace imagine;
+
+/**
+ * Gather the statistics of each label in one pass.
+ *
+ * @param raw - the source volume
+ * @param mask - the labels, the same size as raw or larger
+ * @param labels - one more than the highest label to measure
+ *
+ * @return the statistics, indexed by label. Label 0 is left empty.
+ */
+
+std::vector<LabelStats> MeasureLabelStats(ImageU16L3D const &raw, SparseLabel3D const &mask, size_t labels) {
+    std::vector<LabelStats> stats(labels);
+
+    for (Span const &s : mask.spans) {
+        if (s.label >= labels || s.z >= raw.depth || s.y >= raw.height) {
+            continue;
+        }
+
+        LabelStats &label = stats[s.label];
+        std::vector<uint16_t> const &row = raw.data[s.z][s.y];
+        size_t x1 = std::min(static_cast<size_t>(s.x1), static_cast<size_t>(raw.width));
+
+        for (size_t x = s.x0; x < x1; x++) {
+            uint16_t value = row[x];
+            size_t bin = std::min(static_cast<size_t>(value), LABEL_STATS_BINS - 1);
+            label.histogram[bin] += 1;
+            label.sum += value;
+            label.min = std::min(label.min, value);
+            label.max = std::max(label.max, value);
+
+            if (bin == LABEL_STATS_BINS - 1) {
+                label.top_sum += value;
+            }
+        }
+
+        label.count += x1 > s.x0 ? x1 - s.x0 : 0;
+    }
+
+    return stats;
+}
+
+/**
+ * The sum of the k brightest values, as neuroshed counts. If k falls
+ * inside the last bin, its share is taken at the bin's mean.
+ */
+uint64_t TopSum(LabelStats const &stats, size_t k) {
+    uint64_t sum = 0;
+    size_t last = LABEL_STATS_BINS - 1;
+    size_t n = std::min(static_cast<size_t>(stats.histogram[last]), k);
+
+    if (n > 0) {
+        sum += n == stats.histogram[last] ? stats.top_sum : stats.top_sum * n / stats.histogram[last];
+        k -= n;
+    }
+
+    for (size_t bin = last; bin-- > 0 && k > 0;) {
+        size_t take = std::min(static_cast<size_t>(stats.histogram[bin]), k);
+        sum += static_cast<uint64_t>(take) * bin;
+        k -= take;
+    }
+
+    return sum;
+}
+
+// The most common value, the lowest if there are several
+uint16_t StatsMode(LabelStats const &stats) {
+    size_t best = 0;
+
+    for (size_t bin = 1; bin < LABEL_STATS_BINS; bin++) {
+        if (stats.histogram[bin] > stats.histogram[best]) {
+            best = bin;
+        }
+    }
+
+    return static_cast<uint16_t>(best);
+}
+
+// The lowest value with at least percent of the voxels at or below it.
+// Anything in the last bin reads as the maximum.
+uint16_t StatsPercentile(LabelStats const &stats, double percent) {
+    if (stats.count == 0) {
+        return 0;
+    }
+
+    double target = std::max(1.0, std::ceil(static_cast<double>(stats.count) * percent / 100.0));
+    uint64_t seen = 0;
+
+    for (size_t bin = 0; bin < LABEL_STATS_BINS; bin++) {
+        seen += stats.histogram[bin];
+
+        if (static_cast<double>(seen) >= target) {
+            return bin == LABEL_STATS_BINS - 1 ? stats.max : static_cast<uint16_t>(bin);
+        }
+    }
+
+    return stats.max;
+}
+
+double StatsMean(LabelStats const &stats) {
+    return stats.count == 0 ? 0.0 : static_cast<double>(stats.sum) / static_cast<double>(stats.count);
+}
+
+/**
+ * The counts in a .dat file, by neuron name. All zero unless it holds
+ * the four neurons.
+ *
+ * @param records - from ParseNeuronDat
+ *
+ * @return BaseCounts
+ */
+
+BaseCounts DatCounts(std::vector<NeuronRecord> const &records) {
+    BaseCounts counts;
+
+    if (records.size() != 4) {
+        return counts;
+    }
+
+    for (NeuronRecord const &r : records) {
+        int64_t c = libcee::FromString<int64_t>(r.fl);
+        int64_t m = libcee::FromString<int64_t>(r.mode_fl);
+        if (r.name == "ASI-1") { counts.asi1 = c; counts.asi1_mode = m; }
+        if (r.name == "ASI-2") { counts.asi2 = c; counts.asi2_mode = m; }
+        if (r.name == "ASJ-1") { counts.asj1 = c; counts.asj1_mode = m; }
+        if (r.name == "ASJ-2") { counts.asj2 = c; counts.asj2_mode = m; }
+    }
+
+    return counts;
+}
+
+/**
+ * Count the fluorescence under each neuron - the sum over the whole
+ * mask, or as neuroshed does, the brightest top_k voxels less the
+ * background mode from the .dat file.
+ *
+ * @param raw - the source stack
+ * @param mask - the neuron labels
+ * @param base - the counts from the .dat file
+ * @param top_k - 0 for the whole mask
+ *
+ * @return Counts
+ */
+
+Counts CountLabels(ImageU16L3D const &raw, SparseLabel3D const &mask, BaseCounts const &base, size_t top_k) {
+    Counts counts;
+    std::vector<LabelStats> stats = MeasureLabelStats(raw, mask, 5);
+
+    if (top_k > 0) {
+        int64_t k = static_cast<int64_t>(top_k);
+        counts.asi1 = static_cast<int64_t>(TopSum(stats[1], top_k)) - k * base.asi1_mode;
+        counts.asi2 = static_cast<int64_t>(TopSum(stats[2], top_k)) - k * base.asi2_mode;
+        counts.asj1 = static_cast<int64_t>(TopSum(stats[3], top_k)) - k * base.asj1_mode;
+        counts.asj2 = static_cast<int64_t>(TopSum(stats[4], top_k)) - k * base.asj2_mode;
+    } else {
+        counts.asi1 = static_cast<int64_t>(stats[1].sum);
+        counts.asi2 = static_cast<int64_t>(stats[2].sum);
+        counts.asj1 = static_cast<int64_t>(stats[3].sum);
+        counts.asj2 = static_cast<int64_t>(stats[4].sum);
+    }
+
+    return counts;
+}
+
+/**
+ * The count CSV row for a pair - fileraw, filemask, the four counts and
+ * the four from the .dat file. Only the part of the source under the
+ * labels is read. The count has always left off the last slice of the stack.
+ *
+ * @param pair - the pair's files
+ * @param mask - the full size mask, all four neurons
+ * @param channels - the number of interleaved channels
+ * @param channel - which channel to count (0 is the top)
+ * @param stacksize - how many slices in the stack
+ * @param top_k - 0 to count the whole mask
+ * @param bytes - the source tiff, if already read
+ *
+ * @return std::string - the row, without a newline
+ */
+
+std::string CountPair(Pair const &pair, SparseLabel3D const &mask, size_t channels, size_t channel, size_t stacksize, size_t top_k,
+        TiffBytes const &bytes) {
+    BaseCounts base = DatCounts(ParseNeuronDat(libcee::ReadFileLines(pair.dat)));
+    LabelBounds bounds = MeasureLabel(mask, 0);
+    size_t depth = std::min(bounds.max_z + 1, stacksize - 1);
+    Counts count;
+
+    if (bounds.count > 0 && bounds.min_z < depth) {
+        StackWindow window;
+        window.x = bounds.min_x;
+        window.y = bounds.min_y;
+        window.z = bounds.min_z;
+        window.width = bounds.max_x - bounds.min_x + 1;
+        window.height = bounds.max_y - bounds.min_y + 1;
+        window.depth = depth - bounds.min_z;
+        ImageU16L3D raw = LoadTiffStack(pair.input, channels, channel, stacksize, window, bytes);
+        SparseLabel3D cropped = CropSparse(mask, window.x, window.y, window.z, raw.width, raw.height, raw.depth);
+        count = CountLabels(raw, cropped, base, top_k);
+    }
+
+    std::stringstream line;
+    line << pair.input << "," << pair.anno << "," << count.asi1 << "," << count.asi2 << "," << count.asj1 << "," << count.asj2 << ","
+        << base.asi1 << "," << base.asi2 << "," << base.asj1 << "," << base.asj2;
+    return line.str();
+}
@@ -21,8 +21,9 @@ using namespace imagine;
 
 ROI RandROI(ROI roi) {
     ROI rroi = roi;
-    roi.x = -10 + rand() % 20;
-    roi.y = -10 + rand() % 20;
+    std::uniform_int_distribution<int> shift(-10, 9);
+    roi.x = shift(RANDROT_GENERATOR);
+    roi.y = shift(RANDROT_GENERATOR);
 
     rroi.x = std::max(int(roi.x),0);
     rroi.y = std::max(int(roi.x),0);
@@ -163,14 +164,35 @@ ImageF32L3D ProcessPipe(ImageU16L3D const &image_in, bool autoback, float noise,
 
 
 
+/**
+ * Queue the JPG preview of an output, or add it to the contact
+ * sheet for its image if we are making montages.
+ */
+
+template<typename T>
+void _Preview(const Options &options, T const &image, std::string const &jpg_path, std::string const &sheet_path, int aug) {
+    if (options.preview_scale == 0) {
+        return;
+    }
+
+    ImageU8L preview = MakePreview(image, options.preview_scale);
+
+    if (options.montage) {
+        SharedPreviewSheets().Add(sheet_path, static_cast<size_t>(aug), static_cast<size_t>(options.num_augs), preview);
+    } else {
+        QueuePreview(jpg_path, preview);
+    }
+}
+
 /**
  * @brief Do not perform augmentation on the final part of processing the tiff
  * 
  * @param processed 
  * @param image_id 
+ * @param record - the shard record, if writing shards
  */
 
-void _NoAugSource(const Options &options, ImageF32L3D processed, std::string image_id) {
+void _NoAugSource(const Options &options, ImageF32L3D processed, std::string image_id, size_t record) {
    
     // Rotate, normalise then sum projection
     std::string output_path = options.output_path + "/" + image_id + "_layered.fits";
@@ -188,12 +210,17 @@ void _NoAugSource(const Options &options, ImageF32L3D processed, std::string ima
             summed = Resize(summed, options.final_width, options.final_height);
         }
 
-        SaveFITS(output_path, summed);
+        if (options.shards) {
+            SharedShards().QueueSource(record, summed, options.writes);
+        } else {
+            QueueFITS(output_path, summed, options.fits, options.precision, options.writes);
+        }
 
         // Write a JPG just in case
-        ImageU8L jpeged = Convert<ImageU8L>(Convert<ImageF32L>(summed));
-        std::string output_path_jpg = options.output_path + "/" +  image_id + "_raw.jpg";
-        SaveJPG(output_path_jpg, jpeged);
+        if (options.preview_scale > 0) {
+            std::string output_path_jpg = options.output_path + "/" +  image_id + "_raw.jpg";
+            QueuePreview(output_path_jpg, MakePreview(summed, options.preview_scale));
+        }
     } else {
         // ImageF32L3D normalised = Normalise(rotated);
         //FlipVerticalI(normalised);
@@ -204,10 +231,13 @@ void _NoAugSource(const Options &options, ImageF32L3D processed, std::string ima
                 processed.data.pop_back();
                 processed.depth -= 1;
             }
-            ImageF32L3D resized = Resize(processed, options.final_width, options.final_height, options.final_depth);
-            SaveFITS(output_path, resized);
+            processed = Resize(processed, options.final_width, options.final_height, options.final_depth);
+        }
+
+        if (options.shards) {
+            SharedShards().QueueSource(record, processed, options.writes);
         } else {
-            SaveFITS(output_path, processed);   
+            QueueFITS(output_path, processed, options.fits, options.precision, options.writes);
         }
     }
 }
@@ -221,124 +251,192 @@ void _NoAugSource(const Options &options, ImageF32L3D processed, std::string ima
 
 void _AugSource(const Options &options, ImageF32L3D &processed, const Transform &master_t, const std::vector<Transform> &trans, std::string image_id) {
     // Now perform some rotations, sum, normalise, contrast then renormalise for the final 2D image
-    // Thread this bit for a bit more speed
-    std::string output_path = options.output_path + "/" + image_id + "_layered.fits";
-    libcee::ThreadPool pool{ static_cast<size_t>( options.num_augs) };
-    std::vector<std::future<int>> futures;
+    // Thread this bit for a bit more speed, on the shared pool so pairs processed together share the cores
+    ParallelFor(static_cast<size_t>(options.num_augs), [&options, &trans, &image_id, &processed] (size_t ai) {
+        int i = static_cast<int>(ai);
+        // Rotate, normalise then sum projection
+        std::string aug_id  = libcee::IntToStringLeadingZeroes(i, 2);
+        std::string output_path = options.output_path + "/" + image_id + "_" + aug_id + "_layered.fits";
+        glm::quat q = trans[i].rot;
+        ImageF32L3D rotated;
 
-    for (int i = 0; i < options.num_augs; i++){
-        futures.push_back(pool.execute( [i, output_path, trans, options, image_id, processed] () {  
-            // Rotate, normalise then sum projection
-            std::string aug_id  = libcee::IntToStringLeadingZeroes(i, 2);
-            std::string output_path = options.output_path + "/" + image_id + "_" + aug_id + "_layered.fits";
-            glm::quat q = trans[i].rot;
-            ImageF32L3D rotated = Augment(processed, q, options.roi_xy, options.depth_scale, options.subpixel, options.interz); 
+        if (options.bricked) {
+            rotated = AugmentBricked(processed, q, options.roi_xy, options.depth_scale, options.subpixel, options.interz, options.brick_dim);
+        } else {
+            rotated = Augment(processed, q, options.roi_xy, options.depth_scale, options.subpixel, options.interz); 
+        }
+        
+        if (options.flatten) {
+            auto ptype = ProjectionType::SUM;
             
-            if (options.flatten) {
-                auto ptype = ProjectionType::SUM;
-                
-                if (options.max_intensity) {
-                    ptype = ProjectionType::MAX_INTENSITY;
-                }
-
-                ImageF32L summed = Project(rotated, ptype);
-                FlipVerticalI(summed);
+            if (options.max_intensity) {
+                ptype = ProjectionType::MAX_INTENSITY;
+            }
 
-                if (options.final_width != summed.width || options.final_height != summed.height) {
-                    summed = Resize(summed, options.final_width, options.final_height);
-                }
+            ImageF32L summed = Project(rotated, ptype);
+            FlipVerticalI(summed);
 
-                SaveFITS(output_path, summed);
+            if (options.final_width != summed.width || options.final_height != summed.height) {
+                summed = Resize(summed, options.final_width, options.final_height);
+            }
 
-                // Write a JPG just in case
-                ImageU8L jpeged = Convert<ImageU8L>(Convert<ImageF32L>(summed));
-                std::string output_path_jpg = options.output_path + "/" +  image_id + "_" + aug_id + "_raw.jpg";
-                SaveJPG(output_path_jpg, jpeged);
+            if (options.shards) {
+                SharedShards().QueueSource(trans[i].record, summed, options.writes);
             } else {
-                FlipVerticalI(rotated);
-
-                if (rotated.depth % options.final_depth == 1) {
-                    rotated.data.pop_back();
-                }
+                QueueFITS(output_path, summed, options.fits, options.precision, options.writes);
+            }
 
-                ResizeMethod method = ResizeMethod::NEAREST;
-                
-                if (options.interz) {
-                    method = ResizeMethod::TRILINEAR;
-                }
+            // Write a JPG just in case
+            std::string output_path_jpg = options.output_path + "/" +  image_id + "_" + aug_id + "_raw.jpg";
+            std::string sheet_path = options.output_path + "/" +  image_id + "_raw_sheet.jpg";
+            _Preview(options, summed, output_path_jpg, sheet_path, i);
+        } else {
+            FlipVerticalI(rotated);
 
-                ImageF32L3D resized = Resize(rotated, options.final_width, options.final_height, options.final_depth, method);
-                SaveFITS(output_path, resized);
+            if (rotated.depth % options.final_depth == 1) {
+                rotated.data.pop_back();
             }
+
+            ResizeMethod method = ResizeMethod::NEAREST;
             
-            return i;
-        }));
+            if (options.interz) {
+                method = ResizeMethod::TRILINEAR;
+            }
+
+            ImageF32L3D resized = Resize(rotated, options.final_width, options.final_height, options.final_depth, method);
+
+            if (options.shards) {
+                SharedShards().QueueSource(trans[i].record, resized, options.writes);
+            } else {
+                QueueFITS(output_path, resized, options.fits, options.precision, options.writes);
+            }
+        }
+    }, options.aug_width);
+}
+
+/**
+ * The name the source outputs of a pair start with - the AutoStack
+ * number, or the image index if renaming.
+ */
+
+std::string SourceID(const Options &options, std::string const &tiff_path, int image_idx) {
+    if (options.rename) {
+        return libcee::IntToStringLeadingZeroes(image_idx, 5);
     }
 
-    for (auto &fut : futures) { fut.get(); }
+    std::vector<std::string> tokens_log = libcee::SplitStringChars(libcee::FilenameFromPath(tiff_path), "_.-");
+    return libcee::StringRemove(tokens_log[3], "0xAutoStack");
 }
 
 /**
- * Given a tiff file return the same file but with one channel and 
- * as a series of layers
- * 
+ * The output index of the first pair. A manifest or resumed run numbers
+ * its pairs from -n, or 0, so they don't depend on what is already in
+ * the output directory - a resumed run must find the journal entries of
+ * the run before. Otherwise they carry on after the files there, unless
+ * -n is given.
+ *
  * @param options - the options struct
- * @param tiff_path - the file path to the tiff
+ * @param offset_given - true if -n was given
  *
- * @return bool if success or not
+ * @return int
+ */
+
+int FirstPairIndex(const Options &options, bool offset_given) {
+    if (offset_given || options.resume || !options.manifest.empty()) {
+        return options.offset_number;
+    }
+
+    return GetOffetNumber(options.output_path);
+}
+
+/**
+ * The FITS files TiffToFits, ProcessMask and CombinedOutputs write
+ * for a pair. Only the full size mask when writing shards.
  */
 
-int TiffToFits(const Options &options, const Transform &master_t, const std::vector<Transform> &trans, std::string &tiff_path, int image_idx) {
-    ImageU16L image = LoadTiff<ImageU16L>(tiff_path); 
-    ImageU16L3D stacked(image.width, (image.height / (options.stacksize * options.channels)), options.stacksize);
-    uint coff = 0;
+std::vector<std::string> PairOutputs(const Options &options, std::string const &tiff_path, int image_idx) {
+    std::vector<std::string> outputs;
 
-    // Convert the TIFF into internal 3D image format
-    if (options.bottom) {
-        coff = stacked.height;
+    if (options.combined) {
+        outputs.push_back(options.output_path + "/" + libcee::IntToStringLeadingZeroes(image_idx, 5) + "_full_mask.fits");
     }
 
-    for (uint32_t d = 0; d < stacked.depth; d++) {
-        for (uint32_t y = 0; y < stacked.height; y++) {
-            for (uint32_t x = 0; x < stacked.width; x++) {
-                uint16_t val = image.data[(d * stacked.height * options.channels) + coff + y][x];
-                stacked.data[d][y][x] = val;
-            }
+    if (options.shards) {
+        return outputs;
+    }
+
+    std::string image_id = SourceID(options, tiff_path, image_idx);
+
+    if (options.num_augs > 1) {
+        for (int i = 0; i < options.num_augs; i++) {
+            outputs.push_back(options.output_path + "/" + image_id + "_" + libcee::IntToStringLeadingZeroes(i, 2) + "_layered.fits");
         }
+    } else {
+        outputs.push_back(options.output_path + "/" + image_id + "_layered.fits");
+    }
+
+    for (int i = 0; i < options.num_augs; i++) {
+        outputs.push_back(options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_" + libcee::IntToStringLeadingZeroes(i, 2) + "_mask.fits");
     }
 
+    return outputs;
+}
+
+/**
+ * Given a tiff file return the same file but with one channel and 
+ * as a series of layers
+ * 
+ * @param options - the options struct
+ * @param tiff_path - the file path to the tiff
+ * @param bytes - the tiff already read into memory, or null to read it from disk
+ * @param cache_path - if set, where the processed volume is cached between runs
+ *
+ * @return bool if success or not
+ */
+
+int TiffToFits(const Options &options, const Transform &master_t, const std::vector<Transform> &trans, std::string &tiff_path, int image_idx, TiffBytes const &bytes, std::string const &cache_path) {
     // Filename for the new image
-    std::vector<std::string> tokens_log = libcee::SplitStringChars(libcee::FilenameFromPath(tiff_path), "_.-");
-    std::string image_id = tokens_log[3];
-    image_id = libcee::StringRemove(image_id, "0xAutoStack");
+    std::string image_id = SourceID(options, tiff_path, image_idx);
 
     if (options.rename == true) {
-        image_id  = libcee::IntToStringLeadingZeroes(image_idx, 5);
         std::string output_path = options.output_path + "/" + image_id + "_layered.fits";
         std::cout << "Renaming " << tiff_path << " to " << output_path << std::endl;
     }
 
     ImageF32L3D converted;
+    int background = options.cutoff;
 
-    // Do we have an ROI? If so, perform the master transform (a crop).
-    // This saves time as we don't have to perform many processes like deconv multiple times
-    if (!options.noroi) {
-        stacked = Crop(stacked, master_t.roi.x, master_t.roi.y, master_t.roi.z, master_t.roi.xy_dim, master_t.roi.xy_dim, master_t.roi.depth);
-    }
+    if (!cache_path.empty() && LoadStageCache(cache_path, converted, background)) {
+        std::cout << "Using processed volume from " << cache_path << std::endl;
+    } else {
+        // Do we have an ROI? If so, perform the master transform (a crop) as we read.
+        // This saves time as we don't have to perform many processes like deconv multiple times
+        StackWindow window;
 
-    int background = options.cutoff;
+        if (!options.noroi) {
+            window = WindowFromROI(master_t.roi);
+        }
 
-    if (!options.noprocess){
-        if (options.otsu){
-            auto thresh = imagine::Otsu(stacked);
-            std::function<uint16_t (uint16_t)> thresh_func = [thresh](uint16_t x) { if(x >= thresh) { return x;} return static_cast<uint16_t>(0); };
-            stacked = ApplyFunc<ImageU16L3D, uint16_t>(stacked, thresh_func);
+        // Convert the TIFF into internal 3D image format, reading only the channel we want
+        size_t channel = options.bottom ? 1 : 0;
+        ImageU16L3D stacked = LoadTiffStack(tiff_path, options.channels, channel, options.stacksize, window, bytes);
+
+        if (!options.noprocess){
+            if (options.otsu){
+                auto thresh = imagine::Otsu(stacked);
+                std::function<uint16_t (uint16_t)> thresh_func = [thresh](uint16_t x) { if(x >= thresh) { return x;} return static_cast<uint16_t>(0); };
+                stacked = ApplyFunc<ImageU16L3D, uint16_t>(stacked, thresh_func);
+                converted = imagine::Convert<ImageF32L3D>(stacked);
+            } else {
+                converted = ProcessPipe(stacked, options.autoback, options.cutoff, options.deconv, options.psf_path, options.deconv_rounds, background, options.contrast);
+            }
+        } else  {
             converted = imagine::Convert<ImageF32L3D>(stacked);
-        } else {
-            converted = ProcessPipe(stacked, options.autoback, options.cutoff, options.deconv, options.psf_path, options.deconv_rounds, background, options.contrast);
         }
-    } else  {
-        converted = imagine::Convert<ImageF32L3D>(stacked);
+
+        if (!cache_path.empty()) {
+            QueueStageCache(cache_path, converted, background);
+        }
     }
 
 
@@ -346,7 +444,7 @@ int TiffToFits(const Options &options, const Transform &master_t, const std::vec
     if (options.num_augs > 1) {
         _AugSource(options, converted, master_t, trans, image_id);
     } else {
-        _NoAugSource(options, converted, image_id);
+        _NoAugSource(options, converted, image_id, trans[0].record);
     }
 
     // TODO - this is not ideal really. We should probably reconsider interfaces
@@ -354,51 +452,37 @@ int TiffToFits(const Options &options, const Transform &master_t, const std::vec
 }
 
 
-bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path, std::string &coord_path, int image_idx, Transform &master_t, std::vector<Transform> &transforms) {
-    ImageU16L image_in = LoadTiff<ImageU16L>(tiff_path);
-    std::vector<std::vector<size_t>> neurons; // 0: None, 1: ASI-1, 2: ASI-2, 3: ASJ-1, 4: ASJ-2
-    size_t idx = 0;
-
+bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path, std::string &coord_path, int image_idx, Transform &master_t, std::vector<Transform> &transforms, TiffBytes const &bytes,
+    SparseLabel3D *full_mask) {
+    ImageU16L image_in = LoadTiffImage(tiff_path, bytes);
     // Read the log file and extract the neuron numbers
     // Making the asssumption that all log files have the neurons in the same order
-    for (int i = 0; i < 5; i++) {
-        neurons.push_back(std::vector<size_t>());
-    }
-
-    std::vector<std::string> lines_log = libcee::ReadFileLines(log_path);
-
-    for (std::string line : lines_log) {
-        std::vector<std::string> tokens = libcee::SplitStringWhitespace(line);
-        if (libcee::ToLower(tokens[0]) == "associate") {
-            idx += 1;
-        } else {
-            neurons[idx].push_back(libcee::FromString<size_t>(tokens[0]));
-        }
-    }
+    std::vector<std::vector<size_t>> neurons = ParseNeuronLog(libcee::ReadFileLines(log_path)); // 0: None, 1: ASI-1, 2: ASI-2, 3: ASJ-1, 4: ASJ-2
 
     // Join all our neurons
     size_t start_height = image_in.height / options.stacksize;
     ImageU8L3D neuron_mask(image_in.width, start_height, options.stacksize);
-    bool n1 = false, n2 = false, n3 = false, n4 = false;
-
-    if(options.threeclass){
-      n1 = SetNeuron(image_in, neuron_mask, neurons, 1, true, true, 1);
-      n2 = SetNeuron(image_in, neuron_mask, neurons, 2, true, true, 1);
-      n3 = SetNeuron(image_in, neuron_mask, neurons, 3, true, true, 2);
-      n4 = SetNeuron(image_in, neuron_mask, neurons, 4, true, true, 2);
-    } else {
-      n1 = SetNeuron(image_in, neuron_mask, neurons, 1, true, true, 1);
-      n2 = SetNeuron(image_in, neuron_mask, neurons, 2, true, true, 2);
-      n3 = SetNeuron(image_in, neuron_mask, neurons, 3, true, true, 3);
-      n4 = SetNeuron(image_in, neuron_mask, neurons, 4, true, true, 4);
-    }
+    std::vector<bool> found = SetNeurons(image_in, neuron_mask, NeuronLUT(neurons), {0, 1, 2, 3, 4}, true, true);
     
-    if (!n1 || !n2 || !n3 || !n4) {
+    if (!found[1] || !found[2] || !found[3] || !found[4]) {
         // Must always have 4 neurons to label
         return false;
     }
 
-    // Find the ROI using the mask - Do this on a smaller version of the image for speed.
+    // From here on the mask is held as spans, as it is almost all zero
+    SparseLabel3D sparse_mask = ToSparse(neuron_mask);
+
+    // The full size mask, with all four neurons, for the caller to count or save
+    if (full_mask != nullptr) {
+        *full_mask = sparse_mask;
+    }
+
+    if (options.threeclass) {
+        RelabelSparse(sparse_mask, {0, 1, 1, 2, 2});
+    }
+
+    // Find the ROI using the mask. Usually the labels all fit in one window and give it directly,
+    // otherwise search, coarse to fine, ending at full resolution.
     // ROI is larger here than final as we need 'rotation' and 'translation' space
     ROI master_roi;
 
@@ -408,15 +492,12 @@ bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path
         int depth = static_cast<int>(ceil(static_cast<float>(d) / options.depth_scale));
 
         // Because we are going to AUG, we make the ROI a bit bigger so we can rotate OR translate around
-        ImageU8L3D smaller = Resize(neuron_mask, neuron_mask.width / 2, neuron_mask.height / 2, neuron_mask.depth / 2);
-        ROI roi_found = FindROI(smaller, d / 2, depth / 2);
-        master_roi.x = roi_found.x * 2;
-        master_roi.y = roi_found.y * 2;
-        master_roi.z = roi_found.z * 2; 
-        master_roi.xy_dim = roi_found.xy_dim * 2;
-        master_roi.depth = roi_found.depth * 2;
+        if (!ROIFromLabels(sparse_mask, d, depth, master_roi)) {
+            master_roi = FindROI(sparse_mask, d, depth);
+        }
+
         std::cout << tiff_path << ",MasterROI," << libcee::ToString(master_roi.x) << "," << libcee::ToString(master_roi.y) << "," << libcee::ToString(master_roi.z) << "," << master_roi.xy_dim << "," << master_roi.depth << std::endl;
-        neuron_mask = Crop(neuron_mask, master_roi.x, master_roi.y, master_roi.z, master_roi.xy_dim, master_roi.xy_dim, master_roi.depth);
+        sparse_mask = CropSparse(sparse_mask, master_roi.x, master_roi.y, master_roi.z, master_roi.xy_dim, master_roi.xy_dim, master_roi.depth);
     } else if (options.num_augs > 1) {
         ASSERT(false, "Must have ROI cropping when using augmentation.");
     }
@@ -469,43 +550,118 @@ bool ProcessMask(Options &options, std::string &tiff_path, std::string &log_path
         transforms.push_back(tt);
     }
 
+    // A pair built before goes back into the same records, so none are left behind in the index
+    if (options.shards) {
+        for (size_t i = 0; i < transforms.size(); i++) {
+            transforms[i].record = i < options.records.size() ? options.records[i] : SharedShards().Allocate();
+        }
+    }
+
+    // Rotation needs a dense volume to sample from, but only of the master ROI
+    ImageU8L3D master_mask;
+
+    if (!options.noroi && !options.safeaug) {
+        master_mask = Densify(sparse_mask);
+    }
+
     for (int i = 0; i < options.num_augs; i++){
         // Save the masks
         std::string aug_id  = libcee::IntToStringLeadingZeroes(i, 2);
         std::string csv_line =  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_" + aug_id + ", ";
         std::string output_path = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_" + aug_id + "_mask.fits";
 
-        ImageU8L3D prefinal = neuron_mask;
+        SparseLabel3D prefinal = sparse_mask;
    
         if (!options.noroi) {
             if (options.safeaug) {
                 Transform trans = transforms[i];
-                prefinal = Crop(neuron_mask, trans.roi.x, trans.roi.y, trans.roi.z, trans.roi.xy_dim, trans.roi.xy_dim, trans.roi.depth);
+                prefinal = CropSparse(sparse_mask, trans.roi.x, trans.roi.y, trans.roi.z, trans.roi.xy_dim, trans.roi.xy_dim, trans.roi.depth);
             } else {
-                prefinal = Augment(neuron_mask, transforms[i].rot, options.roi_xy, options.depth_scale, false, false);
+                prefinal = ToSparse(Augment(master_mask, transforms[i].rot, options.roi_xy, options.depth_scale, false, false));
             }
         } 
         
-        ImageU8L mipped = Project(prefinal, ProjectionType::MAX_INTENSITY);
-        ImageU8L resized = Resize(mipped, options.final_width, options.final_height);
-        FlipVerticalI(resized);
+        // Labels are resized by their most common value, never blended, with the 2D MIP made in the same pass.
+        // Flattened masks are projected first, so only the one slice is resized.
+        ImageU8L resized;
+
+        if (options.flatten) {
+            ResizeLabels(FlattenSparse(prefinal), options.final_width, options.final_height, 1, &resized);
+            FlipVerticalI(resized);
+        }
 
-        if (options.flatten){
-            SaveFITS(output_path, resized);
+        if (options.flatten && options.shards) {
+            SharedShards().QueueMask(transforms[i].record, resized, options.writes);
+        } else if (options.flatten) {
+            QueueFITS(output_path, resized, options.fits, Precision::F32, options.writes);
         } else {
             if (prefinal.depth % 2 == 1) {
-                prefinal.data.pop_back();
+                prefinal = CropSparse(prefinal, 0, 0, 0, prefinal.width, prefinal.height, prefinal.depth - 1);
             }
-            ImageU8L3D resized3d = Resize(prefinal, options.final_width, options.final_height, options.final_depth);
+            ImageU8L3D resized3d = Densify(ResizeLabels(prefinal, options.final_width, options.final_height, options.final_depth, &resized));
+            FlipVerticalI(resized);
             FlipVerticalI(resized3d);
-            SaveFITS(output_path, resized3d);
+
+            if (options.shards) {
+                SharedShards().QueueMask(transforms[i].record, resized3d, options.writes);
+            } else {
+                QueueFITS(output_path, resized3d, options.fits, Precision::F32, options.writes);
+            }
         }
 
         // Write a JPG just in case
-        ImageU8L jpeged = Convert<ImageU8L>(Convert<ImageF32L>(resized));
         std::string output_path_jpg = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_" + aug_id + "_mask.jpg";
-        SaveJPG(output_path_jpg, jpeged);
+        std::string sheet_path = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_mask_sheet.jpg";
+        _Preview(options, resized, output_path_jpg, sheet_path, i);
     }
 
     return true;
 }
+
+/**
+ * The outputs count and db would make for a pair, from the mask ProcessMask
+ * has already built and the source already in memory - the full size mask,
+ * count's row for the pair and the .dat rows for the database. The count
+ * row is built by CountPair, as count builds it, summing under each label.
+ *
+ * @param options - the options struct
+ * @param full_mask - the full size mask, all four neurons, from ProcessMask
+ * @param pair - the pair's files
+ * @param image_idx - the pair's output index
+ * @param bytes - the source tiff, if already read
+ * @param rows - the CSV rows for the pair. No database rows unless the .dat file holds the four neurons.
+ */
+
+void CombinedOutputs(const Options &options, SparseLabel3D const &full_mask, Pair const &pair, int image_idx, TiffBytes const &bytes, CombinedRows &rows) {
+    // The full size mask, labelled as the dataset masks are
+    SparseLabel3D labelled = full_mask;
+
+    if (options.threeclass) {
+        RelabelSparse(labelled, {0, 1, 1, 2, 2});
+    }
+
+    ImageU8L3D dense = Densify(labelled);
+    FlipVerticalI(dense);
+    std::string mask_path = options.output_path + "/" + libcee::IntToStringLeadingZeroes(image_idx, 5) + "_full_mask.fits";
+    QueueFITS(mask_path, dense, options.fits, Precision::F32, options.writes);
+
+    // Not options.bottom - that is always set here, but count only counts the bottom channel when asked
+    size_t channel = static_cast<size_t>(options.count_channel);
+    rows.count = CountPair(pair, full_mask, options.channels, channel, options.stacksize, 0, bytes);
+
+    // As db inserts them, the type being the line in the .dat file
+    std::vector<NeuronRecord> records = ParseNeuronDat(libcee::ReadFileLines(pair.dat));
+    rows.neurons.clear();
+
+    if (records.size() != 4) {
+        return;
+    }
+
+    for (size_t i = 0; i < records.size(); i++) {
+        NeuronRecord const &r = records[i];
+        std::stringstream row;
+        row << pair.anno << "," << pair.log << "," << pair.dat << "," << r.x << "," << r.y << "," << r.z << ","
+            << r.fl << "," << r.mode_fl << "," << r.min_fl << "," << r.bg << "," << r.rsize << "," << i + 1;
+        rows.neurons.push_back(row.str());
+    }
+}
@@ -0,0 +1,127 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file pool.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief One thread pool for the whole process.
+ *
+ * ParallelFor hands out indices one at a time from a shared counter,
+ * so fast workers simply take more of them. The calling thread works
+ * through the indices too and never waits on a queued task, which
+ * means ParallelFor can be called from inside a pool task without
+ * deadlocking, however busy the pool is.
+ */
+
+#include "pool.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <algorithm>
+
+static size_t POOL_SIZE = 0;
+
+/**
+ * Set the number of threads in the shared pool. Only has an effect
+ * before the pool is first used. Zero means one per core.
+ */
+void SetPoolSize(size_t num_threads) {
+    POOL_SIZE = num_threads;
+}
+
+// The pool and the size it was made with, both fixed on first use
+struct _SizedPool {
+    size_t size;
+    libcee::ThreadPool pool;
+
+    explicit _SizedPool(size_t num_threads) : size(num_threads), pool{ num_threads } {}
+};
+
+_SizedPool &_SharedSizedPool() {
+    static _SizedPool shared{ POOL_SIZE == 0 ? std::max(1u, std::thread::hardware_concurrency()) : POOL_SIZE };
+    return shared;
+}
+
+size_t PoolSize() {
+    return _SharedSizedPool().size;
+}
+
+libcee::ThreadPool &SharedPool() {
+    return _SharedSizedPool().pool;
+}
+
+struct _ParallelJob {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    size_t count = 0;
+    std::function<void(size_t)> func;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+};
+
+void _RunParallelJob(std::shared_ptr<_ParallelJob> job) {
+    size_t i;
+
+    while ((i = job->next.fetch_add(1)) < job->count) {
+        try {
+            job->func(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+
+            if (!job->error) {
+                job->error = std::current_exception();
+            }
+        }
+
+        if (job->done.fetch_add(1) + 1 == job->count) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->finished.notify_all();
+        }
+    }
+}
+
+/**
+ * Call func(0) to func(count - 1) across the shared pool, returning
+ * once they have all finished. The first exception thrown is passed
+ * back to the caller.
+ *
+ * @param count - the number of indices
+ * @param func - the function to call with each index
+ * @param width - the most indices to run at once - 0 means the pool size
+ */
+
+void ParallelFor(size_t count, std::function<void(size_t)> func, size_t width) {
+    if (count == 0) {
+        return;
+    }
+
+    std::shared_ptr<_ParallelJob> job = std::make_shared<_ParallelJob>();
+    job->count = count;
+    job->func = func;
+
+    if (width == 0 || width > PoolSize()) {
+        width = PoolSize();
+    }
+
+    size_t helpers = std::min(width, count) - 1;
+
+    for (size_t h = 0; h < helpers; h++) {
+        SharedPool().execute([job] () { _RunParallelJob(job); });
+    }
+
+    _RunParallelJob(job);
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&job] () { return job->done.load() == job->count; });
+
+    if (job->error) {
+        std::rethrow_exception(job->error);
+    }
+}
@@ -0,0 +1,171 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file preview.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief JPG previews and contact sheets.
+ *
+ */
+
+#include "preview.hpp"
+#include "writer.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace imagine;
+
+/**
+ * Box filter down by scale and stretch min..max to 0..255, in one
+ * pass over the image after finding the range.
+ */
+template<typename V>
+ImageU8L _MakePreview(std::vector<std::vector<V>> const &data, size_t width, size_t height, size_t scale) {
+    scale = std::max(static_cast<size_t>(1), scale);
+    size_t pwidth = std::max(static_cast<size_t>(1), width / scale);
+    size_t pheight = std::max(static_cast<size_t>(1), height / scale);
+    ImageU8L preview(pwidth, pheight);
+
+    if (width == 0 || height == 0) {
+        return preview;
+    }
+
+    V lowest = data[0][0];
+    V highest = data[0][0];
+
+    for (size_t y = 0; y < height; y++) {
+        auto range = std::minmax_element(data[y].begin(), data[y].begin() + width);
+        lowest = std::min(lowest, *range.first);
+        highest = std::max(highest, *range.second);
+    }
+
+    double span = static_cast<double>(highest) - static_cast<double>(lowest);
+    double mult = span > 0 ? 255.0 / span : 0;
+
+    for (size_t py = 0; py < pheight; py++) {
+        size_t y1 = std::min(height, (py + 1) * scale);
+
+        for (size_t px = 0; px < pwidth; px++) {
+            size_t x1 = std::min(width, (px + 1) * scale);
+            double total = 0;
+            size_t count = 0;
+
+            for (size_t y = py * scale; y < y1; y++) {
+                for (size_t x = px * scale; x < x1; x++) {
+                    total += static_cast<double>(data[y][x]);
+                    count++;
+                }
+            }
+
+            double value = (total / static_cast<double>(count) - static_cast<double>(lowest)) * mult;
+            preview.data[py][px] = static_cast<uint8_t>(std::min(255.0, std::max(0.0, std::round(value))));
+        }
+    }
+
+    return preview;
+}
+
+ImageU8L MakePreview(ImageF32L const &image, size_t scale) {
+    return _MakePreview(image.data, image.width, image.height, scale);
+}
+
+ImageU8L MakePreview(ImageU8L const &image, size_t scale) {
+    return _MakePreview(image.data, image.width, image.height, scale);
+}
+
+/**
+ * Lay tiles out on a near square grid, in order, row by row.
+ *
+ * @param tiles - the previews. Cells are the size of the largest.
+ *
+ * @return ImageU8L
+ */
+
+ImageU8L MakeMontage(std::vector<ImageU8L> const &tiles) {
+    size_t columns = std::max(static_cast<size_t>(1), static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(tiles.size())))));
+    size_t rows = std::max(static_cast<size_t>(1), (tiles.size() + columns - 1) / columns);
+    size_t cell_width = 1;
+    size_t cell_height = 1;
+
+    for (ImageU8L const &tile : tiles) {
+        cell_width = std::max(cell_width, tile.width);
+        cell_height = std::max(cell_height, tile.height);
+    }
+
+    ImageU8L sheet(cell_width * columns, cell_height * rows);
+
+    for (size_t i = 0; i < tiles.size(); i++) {
+        size_t ox = (i % columns) * cell_width;
+        size_t oy = (i / columns) * cell_height;
+
+        for (size_t y = 0; y < tiles[i].height; y++) {
+            std::copy(tiles[i].data[y].begin(), tiles[i].data[y].begin() + tiles[i].width, sheet.data[oy + y].begin() + ox);
+        }
+    }
+
+    return sheet;
+}
+
+void QueuePreview(std::string const &path, ImageU8L const &preview) {
+    QueueJPG(path, preview, SharedPreviewWriter());
+}
+
+/**
+ * Add a tile to a contact sheet. Once all count tiles are in, the
+ * sheet is queued for writing. Thread safe.
+ *
+ * @param path - the path of the sheet
+ * @param index - where this tile goes
+ * @param count - how many tiles the sheet has
+ * @param tile - the preview
+ */
+
+void PreviewSheets::Add(std::string const &path, size_t index, size_t count, ImageU8L const &tile) {
+    std::vector<ImageU8L> done;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Sheet &sheet = _sheets[path];
+
+        if (sheet.tiles.size() < count) {
+            sheet.tiles.resize(count);
+        }
+
+        sheet.tiles[index] = tile;
+        sheet.added++;
+
+        if (sheet.added < count) {
+            return;
+        }
+
+        done = std::move(sheet.tiles);
+        _sheets.erase(path);
+    }
+
+    QueuePreview(path, MakeMontage(done));
+}
+
+/**
+ * Queue any sheets still missing tiles, say if an augmentation failed.
+ */
+
+void PreviewSheets::Finish() {
+    std::map<std::string, Sheet> sheets;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        sheets.swap(_sheets);
+    }
+
+    for (auto &sheet : sheets) {
+        QueuePreview(sheet.first, MakeMontage(sheet.second.tiles));
+    }
+}
+
+PreviewSheets &SharedPreviewSheets() {
+    static PreviewSheets sheets;
+    return sheets;
+}
@@ -0,0 +1,204 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file quantise.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Lower precision storage for the float source volumes.
+ *
+ * Our sources come from 12 bit sensors, or are contrast scaled to
+ * [0, 4096], so 16 bits is plenty. U16 maps the min to max range of
+ * each volume onto 0 to 65535, with a scale and zero to undo it.
+ * Both quantisers measure the error as they go, in the same pass.
+ */
+
+#include "quantise.hpp"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+/**
+ * Parse f32, f16 or u16.
+ */
+
+bool ParsePrecision(std::string const &text, Precision &precision) {
+    if (text == "f32") {
+        precision = Precision::F32;
+    } else if (text == "f16") {
+        precision = Precision::F16;
+    } else if (text == "u16") {
+        precision = Precision::U16;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+std::string PrecisionName(Precision precision) {
+    switch (precision) {
+        case Precision::F16 :
+            return "f16";
+        case Precision::U16 :
+            return "u16";
+        default:
+            return "f32";
+    }
+}
+
+size_t PrecisionBytes(Precision precision) {
+    return precision == Precision::F32 ? 4 : 2;
+}
+
+/**
+ * IEEE half from a float, rounding to nearest even.
+ */
+
+uint16_t FloatToHalf(float value) {
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t exp = (f >> 23) & 0xff;
+    uint32_t mant = f & 0x7fffff;
+
+    if (exp == 0xff) {
+        // Infinity or NaN
+        return static_cast<uint16_t>(sign | 0x7c00 | (mant != 0 ? 0x200 : 0));
+    }
+
+    int e = static_cast<int>(exp) - 127 + 15;
+
+    if (e >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00);
+    }
+
+    if (e <= 0) {
+        // Subnormal half, or too small and rounds to zero
+        if (e < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+
+        mant |= 0x800000;
+        uint32_t shift = static_cast<uint32_t>(14 - e);
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+
+        if (rem > halfway || (rem == halfway && (half & 1))) {
+            half++;
+        }
+
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(e) << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+
+    // A carry here rolls into the exponent, which is what we want
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+        half++;
+    }
+
+    return static_cast<uint16_t>(half);
+}
+
+float HalfToFloat(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exp = (half >> 10) & 0x1f;
+    uint32_t mant = half & 0x3ff;
+    uint32_t f;
+
+    if (exp == 0) {
+        if (mant == 0) {
+            f = sign;
+        } else {
+            exp = 127 - 14;
+
+            while ((mant & 0x400) == 0) {
+                mant <<= 1;
+                exp--;
+            }
+
+            f = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else if (exp == 31) {
+        f = sign | 0x7f800000 | (mant << 13);
+    } else {
+        f = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+/**
+ * Convert to float16, measuring the error.
+ *
+ * @param in - the float values
+ * @param count - how many
+ * @param out - where the halfs go
+ *
+ * @return QuantError
+ */
+
+QuantError QuantiseF16(const float *in, size_t count, uint16_t *out) {
+    QuantError error;
+    double sum_sq = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        out[i] = FloatToHalf(in[i]);
+        double diff = std::fabs(static_cast<double>(HalfToFloat(out[i])) - static_cast<double>(in[i]));
+        error.max_error = std::max(error.max_error, diff);
+        sum_sq += diff * diff;
+    }
+
+    error.rms_error = count > 0 ? std::sqrt(sum_sq / static_cast<double>(count)) : 0;
+    return error;
+}
+
+/**
+ * Scale the range of the values onto 0 to 65535, measuring the error.
+ *
+ * @param in - the float values
+ * @param count - how many
+ * @param out - where the scaled values go
+ *
+ * @return QuantError - with the scale and zero to get the values back
+ */
+
+QuantError QuantiseU16(const float *in, size_t count, uint16_t *out) {
+    QuantError error;
+
+    if (count == 0) {
+        return error;
+    }
+
+    float min = in[0], max = in[0];
+
+    for (size_t i = 1; i < count; i++) {
+        min = std::min(min, in[i]);
+        max = std::max(max, in[i]);
+    }
+
+    double range = static_cast<double>(max) - static_cast<double>(min);
+    error.zero = static_cast<double>(min);
+    error.scale = range > 0 ? range / 65535.0 : 1.0;
+    double inv = 1.0 / error.scale;
+    double sum_sq = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        double q = std::round((static_cast<double>(in[i]) - error.zero) * inv);
+        q = std::min(std::max(q, 0.0), 65535.0);
+        out[i] = static_cast<uint16_t>(q);
+        double diff = std::fabs(q * error.scale + error.zero - static_cast<double>(in[i]));
+        error.max_error = std::max(error.max_error, diff);
+        sum_sq += diff * diff;
+    }
+
+    error.rms_error = std::sqrt(sum_sq / static_cast<double>(count));
+    return error;
+}
@@ -1,4 +1,5 @@
 #include "roi.hpp"
+#include "pool.hpp"
 
 /**
  * 
@@ -40,79 +41,160 @@ void FindCOM(T &input, int &cx, int &cy, int &cz, int &sum) {
 }
 
 
-ROI FindROI(ImageU16L3D &input, size_t xy, size_t depth) {
-    size_t step_size = 2; // For speed we don't go with 1
-    size_t step_depth = 1; // 1 for depth as it's shorter
-    size_t num_threads = 4; // One for each quadrant
-
-    libcee::ThreadPool pool{ static_cast<size_t>(num_threads) }; // 1 thread per ROI
-    std::vector<std::future<ROI>> futures;
-
-    // Lambda function that we will eventually thread
-    std::vector<ROI> rois;
-
-    unsigned int t_width = int(input.width / 2);
-    unsigned int t_height = int(input.height / 2);
-    unsigned int overlap = xy / 2;
-
-    // Set the start and end quadrants
-    // Top left, top right, bottom left, bottom right
-    std::vector<unsigned int> starts_x = {0, t_width - overlap, 0, t_width - overlap};
-    std::vector<unsigned int> ends_x = {t_width + overlap, input.width, t_width + overlap, input.width};
-    std::vector<unsigned int> starts_y = {0, t_height - overlap, 0, t_height - overlap};
-    std::vector<unsigned int> ends_y = {t_height + overlap, input.height, t_height + overlap, input.height};
-    
-    for (int it = 0; it < num_threads; it++) {
-        int xs = starts_x[it];
-        int ys = starts_y[it];
-        int zs = 0;
-        int xe = ends_x[it];
-        int ye = ends_y[it];
-        int ze = input.depth;
-        int w = xy;
-        int h = xy;
-        int d = depth;
- 
-        futures.push_back(pool.execute(
-
-            [input, xs, ys, zs, xe, ye, ze, w, h, d, step_size, step_depth] () {
-                ROI troi;
-                troi.sum = 0;
-                troi.x = 0;
-                troi.y = 0;
-                troi.z = 0;
-                troi.depth = d;
-                troi.xy_dim = w;
-
-                for (size_t zi = zs; zi + d - 1 < ze; zi += step_depth) {
-                    for (size_t yi = ys; yi + h -1 < ye; yi += step_size) {
-                        for (size_t xi = xs; xi + w -1 < xe; xi += step_size) {
-                            ImageU16L3D cropped = Crop(input, xi, yi, zi, w, h, d);
-                            double sum = 0;
-
-                            for (int i = 0; i < cropped.depth; i++) {
-                                for (int j = 0; j < cropped.height; j++) {
-                                    for (int k = 0; k < cropped.width; k++) {
-                                        sum += static_cast<double>(cropped.data[i][j][k]);
-                                    }
-                                }
-                            }
-
-                            if (sum > troi.sum){
-                                troi.x = xi;
-                                troi.y = yi;
-                                troi.z = zi;
-                                troi.sum = sum;
-                            }
-                        }
-                    }
+/**
+ * The windows to search, split into tiles of a few rows at one depth.
+ * Tiles are handed out to the shared pool one at a time, so the work
+ * balances across however many cores there are. The tiles depend only
+ * on the volume and window sizes, and their winners are combined in
+ * tile order, so ties go the same way whatever the thread count.
+ */
+typedef struct {
+    size_t z;
+    size_t y_start;
+    size_t y_end;
+} _ROITile;
+
+std::vector<_ROITile> _ROITiles(size_t width, size_t height, size_t depth, size_t xy, size_t roi_depth) {
+    size_t tile_rows = 8;
+    std::vector<_ROITile> tiles;
+
+    if (xy > width || xy > height || roi_depth > depth) {
+        return tiles;
+    }
+
+    for (size_t z = 0; z + roi_depth <= depth; z++) {
+        for (size_t y = 0; y + xy <= height; y += tile_rows) {
+            _ROITile tile;
+            tile.z = z;
+            tile.y_start = y;
+            tile.y_end = std::min(y + tile_rows, height - xy + 1);
+            tiles.push_back(tile);
+        }
+    }
+
+    return tiles;
+}
+
+// The labelled voxels of a mask and their first moments, for the count
+// and centre of mass of any window. In a pooled level of the pyramid
+// each voxel counts the labelled voxels beneath it.
+typedef struct {
+    SummedVolume<uint32_t> count;
+    SummedVolume<uint64_t> mx;
+    SummedVolume<uint64_t> my;
+    SummedVolume<uint64_t> mz;
+} _LabelMoments;
+
+/**
+ * How far a centre of mass is from the centre of its window, squared.
+ * The moments are relative to the window's corner. The centre of mass
+ * of an empty window is its corner, as FindCOM gives.
+ */
+double _Distance(uint64_t count, uint64_t mx, uint64_t my, uint64_t mz, size_t w, size_t h, size_t d) {
+    uint64_t cx = 0, cy = 0, cz = 0;
+
+    if (count > 0) {
+        cx = mx / count;
+        cy = my / count;
+        cz = mz / count;
+    }
+
+    double hw = w / 2;
+    double hh = h / 2;
+    double hd = d / 2;
+    double dx = static_cast<double>(cx) - hw;
+    double dy = static_cast<double>(cy) - hh;
+    double dz = static_cast<double>(cz) - hd;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+double _CentreDistance(_LabelMoments const &moments, size_t x, size_t y, size_t z, size_t w, size_t h, size_t d, uint32_t &count) {
+    count = moments.count.Box(x, y, z, w, h, d);
+    return _Distance(count, moments.mx.Box(x, y, z, w, h, d) - x * count, moments.my.Box(x, y, z, w, h, d) - y * count,
+        moments.mz.Box(x, y, z, w, h, d) - z * count, w, h, d);
+}
+
+/**
+ * The same distance, straight from the spans of a sparse mask.
+ */
+double _SpanDistance(SparseLabel3D const &mask, size_t x, size_t y, size_t z, size_t w, size_t h, size_t d, uint32_t &count) {
+    uint64_t n = 0, mx = 0, my = 0, mz = 0;
+    Span first;
+    first.z = static_cast<uint16_t>(z);
+    first.y = 0;
+    first.x0 = 0;
+    auto it = std::lower_bound(mask.spans.begin(), mask.spans.end(), first,
+        [] (Span const &a, Span const &b) { return a.z < b.z; });
+
+    for (; it != mask.spans.end() && it->z < z + d; it++) {
+        if (it->y < y || it->y >= y + h) {
+            continue;
+        }
+
+        size_t x0 = std::max(static_cast<size_t>(it->x0), x);
+        size_t x1 = std::min(static_cast<size_t>(it->x1), x + w);
+
+        if (x1 <= x0) {
+            continue;
+        }
+
+        uint64_t run = x1 - x0;
+        n += run;
+        mx += (x0 - x + x1 - 1 - x) * run / 2;
+        my += (it->y - y) * run;
+        mz += (it->z - z) * run;
+    }
+
+    count = static_cast<uint32_t>(n);
+    return _Distance(n, mx, my, mz, w, h, d);
+}
+
+// A window is better with more labels in it, or as many but more central
+template<typename C>
+bool _Better(C count, double df, C best_count, double best_df) {
+    return count > best_count || (count == best_count && df < best_df);
+}
+
+/**
+ * Search every window for the one holding the most labels, the most
+ * central of those if there are several.
+ */
+ROI _SearchMoments(_LabelMoments const &moments, size_t xy, size_t depth) {
+    size_t width = moments.count.width;
+    std::vector<_ROITile> tiles = _ROITiles(width, moments.count.height, moments.count.depth, xy, depth);
+    std::vector<ROI> rois(tiles.size());
+    std::vector<double> distances(tiles.size());
+    double furthest = xy * xy + xy * xy + depth * depth;
+
+    // The best window in each tile, the first found if there are several
+    ParallelFor(tiles.size(), [&moments, &tiles, &rois, &distances, width, xy, depth, furthest] (size_t t) {
+        _ROITile const &tile = tiles[t];
+        double dd = furthest;
+        uint32_t most = 0;
+        ROI troi;
+        troi.sum = 0;
+        troi.x = 0;
+        troi.y = tile.y_start;
+        troi.z = tile.z;
+
+        for (size_t yi = tile.y_start; yi < tile.y_end; yi++) {
+            for (size_t xi = 0; xi + xy <= width; xi++) {
+                uint32_t count = 0;
+                double df = _CentreDistance(moments, xi, yi, tile.z, xy, xy, depth, count);
+
+                if (_Better(count, df, most, dd)) {
+                    troi.x = xi;
+                    troi.y = yi;
+                    troi.sum = count;
+                    most = count;
+                    dd = df;
                 }
-                return troi;
             }
-        ));
-    }
+        }
 
-    for (auto &fut : futures) { rois.push_back(fut.get()); }
+        rois[t] = troi;
+        distances[t] = dd;
+    });
 
     ROI roi;
     roi.sum = 0;
@@ -122,114 +204,156 @@ ROI FindROI(ImageU16L3D &input, size_t xy, size_t depth) {
     roi.xy_dim = xy;
     roi.depth = depth;
 
-    double hw = xy / 2;
-    double hh = xy / 2;
-    double hd = depth / 2;
-    double dxy = static_cast<double>(xy);
-    double ddp = static_cast<double>(depth);
-    double dd = dxy * dxy + dxy * dxy + ddp * ddp;
-
-    for (int i = 0; i < num_threads; i++) {
-        ROI troi = rois[i];
-
-        if (troi.sum >= roi.sum) {
-            ImageU16L3D cropped = Crop(input, troi.x, troi.y, troi.z, roi.xy_dim, roi.xy_dim, roi.depth);
-            int cx, cy, cz = 0;
-            int sum = 0;
-            FindCOM(cropped, cx, cy, cz, sum);
-
-            double df = (cx - hw) *  (cx - hw) + (cy - hh) * (cy - hh) + (cz - hd) * (cz - hd);
-                
-            if (df < dd) {
-                roi.sum = troi.sum;
-                roi.x = troi.x;
-                roi.y = troi.y;
-                roi.z = troi.z;
-                dd = df;
-            }
+    double dd = furthest;
+
+    for (size_t t = 0; t < rois.size(); t++) {
+        if (_Better(static_cast<uint32_t>(rois[t].sum), distances[t], static_cast<uint32_t>(roi.sum), dd)) {
+            roi.sum = rois[t].sum;
+            roi.x = rois[t].x;
+            roi.y = rois[t].y;
+            roi.z = rois[t].z;
+            dd = distances[t];
         }
     }
 
     return roi;
 }
 
+// Summed volumes of a grid of label counts and their moments
+_LabelMoments _GridMoments(std::vector<uint32_t> const &grid, size_t width, size_t height, size_t depth) {
+    auto at = [&grid, width, height] (size_t x, size_t y, size_t z) { return grid[(z * height + y) * width + x]; };
+    _LabelMoments moments;
+    moments.count = SummedVolume<uint32_t>(width, height, depth, at);
+    moments.mx = SummedVolume<uint64_t>(width, height, depth,
+        [&at] (size_t x, size_t y, size_t z) { return static_cast<uint64_t>(at(x, y, z)) * x; });
+    moments.my = SummedVolume<uint64_t>(width, height, depth,
+        [&at] (size_t x, size_t y, size_t z) { return static_cast<uint64_t>(at(x, y, z)) * y; });
+    moments.mz = SummedVolume<uint64_t>(width, height, depth,
+        [&at] (size_t x, size_t y, size_t z) { return static_cast<uint64_t>(at(x, y, z)) * z; });
+    return moments;
+}
 
-ROI FindROI(ImageU8L3D &input, size_t xy, size_t depth) {
-    size_t step_size = 2;
-    size_t step_depth = 1; 
-    size_t num_threads = 4;
-
-    libcee::ThreadPool pool{ static_cast<size_t>(num_threads) }; // 1 thread per ROI
-    std::vector<std::future<ROI>> futures;
-
-    // Lambda function that we will eventually thread
-    std::vector<ROI> rois;
-
-    unsigned int t_width = int(input.width / 2);
-    unsigned int t_height = int(input.height / 2);
-    unsigned int overlap = xy / 2;
-
-    // Set the start and end quadrants
-    // Top left, top right, bottom left, bottom right
-    std::vector<unsigned int> starts_x = {0, t_width - overlap, 0, t_width - overlap};
-    std::vector<unsigned int> ends_x = {t_width + overlap, input.width, t_width + overlap, input.width};
-    std::vector<unsigned int> starts_y = {0, t_height - overlap, 0, t_height - overlap};
-    std::vector<unsigned int> ends_y = {t_height + overlap, input.height, t_height + overlap, input.height};
-    
-    for (int thread_id = 0; thread_id <num_threads; thread_id++) {
-        int xs = starts_x[thread_id];
-        int ys = starts_y[thread_id];
-        int zs = 0;
-        int xe = ends_x[thread_id];
-        int ye = ends_y[thread_id];
-        int ze = input.depth;
-        int w = xy;
-        int h = xy;
-        int d = depth;
-
-        futures.push_back(pool.execute(
-
-            [input, xs, ys, zs, xe, ye, ze, w, h, d, step_size, step_depth] () {
-                double dd = w * w + h * h + d * d;
-                double hw = w / 2;
-                double hh = h / 2;
-                double hd = d / 2;
-                ROI troi;
-                troi.sum = 0;
-                troi.x = 0;
-                troi.y = 0;
-                troi.z = 0;
-
-                for (size_t zi = zs; zi + d - 1 < ze; zi += step_depth) {
-                    for (size_t yi = ys; yi + h -1 < ye; yi += step_size) {
-                        for (size_t xi = xs; xi + w -1 < xe; xi += step_size) {
-                            ImageU8L3D cropped = Crop(input, xi, yi, zi, w, h, d);
-                            int cx = 0, cy = 0, cz = 0;
-                            int sum = 0;
-                            FindCOM(cropped, cx, cy, cz, sum);
-
-                            if (sum >= troi.sum) {                                
-                                double df = (cx - hw) *  (cx - hw) + (cy - hh) * (cy - hh) + (cz - hd) * (cz - hd);
-
-                                if (df < dd) {
-                                    troi.x = xi;
-                                    troi.y = yi;
-                                    troi.z = zi;
-                                    troi.sum = sum;
-                                    dd = df;
-                                }
-                            }
-                        }
-                    }
+
+/**
+ * The brightest window, the one whose labelled mass is most central
+ * if there are several. Every voxel that isn't zero counts towards
+ * the centre of mass, as FindCOM has it.
+ */
+ROI FindROI(ImageU16L3D &input, size_t xy, size_t depth) {
+    // The sum of any window is then a handful of lookups, as is its centre of mass
+    SummedVolume<uint64_t> sums(input.width, input.height, input.depth,
+        [&input] (size_t x, size_t y, size_t z) { return static_cast<uint64_t>(input.data[z][y][x]); });
+    std::vector<uint32_t> lit(input.width * input.height * input.depth, 0);
+
+    for (size_t z = 0; z < input.depth; z++) {
+        for (size_t y = 0; y < input.height; y++) {
+            for (size_t x = 0; x < input.width; x++) {
+                lit[(z * input.height + y) * input.width + x] = input.data[z][y][x] != 0;
+            }
+        }
+    }
+
+    _LabelMoments moments = _GridMoments(lit, input.width, input.height, input.depth);
+    std::vector<_ROITile> tiles = _ROITiles(input.width, input.height, input.depth, xy, depth);
+    std::vector<ROI> rois(tiles.size());
+    std::vector<double> distances(tiles.size());
+    double furthest = xy * xy + xy * xy + depth * depth;
+
+    // The best window in each tile, the first found if there are several
+    ParallelFor(tiles.size(), [&sums, &moments, &tiles, &rois, &distances, &input, xy, depth, furthest] (size_t t) {
+        _ROITile const &tile = tiles[t];
+        double dd = furthest;
+        uint64_t brightest = 0;
+        ROI troi;
+        troi.sum = 0;
+        troi.x = 0;
+        troi.y = tile.y_start;
+        troi.z = tile.z;
+
+        for (size_t yi = tile.y_start; yi < tile.y_end; yi++) {
+            for (size_t xi = 0; xi + xy <= input.width; xi++) {
+                uint64_t sum = sums.Box(xi, yi, tile.z, xy, xy, depth);
+
+                if (sum == 0 || sum < brightest) {
+                    continue;
+                }
+
+                uint32_t count = 0;
+                double df = _CentreDistance(moments, xi, yi, tile.z, xy, xy, depth, count);
+
+                if (_Better(sum, df, brightest, dd)) {
+                    troi.x = xi;
+                    troi.y = yi;
+                    troi.sum = static_cast<double>(sum);
+                    brightest = sum;
+                    dd = df;
                 }
-      
-                return troi;
             }
-        ));
+        }
+
+        rois[t] = troi;
+        distances[t] = dd;
+    });
+
+    ROI roi;
+    roi.sum = 0;
+    roi.x = 0;
+    roi.y = 0;
+    roi.z = 0;
+    roi.xy_dim = xy;
+    roi.depth = depth;
+
+    uint64_t brightest = 0;
+    double dd = furthest;
+
+    for (size_t t = 0; t < rois.size(); t++) {
+        uint64_t sum = static_cast<uint64_t>(rois[t].sum);
+
+        if (sum > 0 && _Better(sum, distances[t], brightest, dd)) {
+            roi.sum = rois[t].sum;
+            roi.x = rois[t].x;
+            roi.y = rois[t].y;
+            roi.z = rois[t].z;
+            brightest = sum;
+            dd = distances[t];
+        }
+    }
+
+    return roi;
+}
+
+ROI FindROI(ImageU8L3D &input, size_t xy, size_t depth) {
+    // Each window's centre of mass comes from its count and moments
+    std::vector<uint32_t> labelled(input.width * input.height * input.depth, 0);
+
+    for (size_t z = 0; z < input.depth; z++) {
+        for (size_t y = 0; y < input.height; y++) {
+            for (size_t x = 0; x < input.width; x++) {
+                labelled[(z * input.height + y) * input.width + x] = input.data[z][y][x] != 0;
+            }
+        }
     }
 
-    for (auto &fut : futures) { rois.push_back(fut.get()); }
+    return _SearchMoments(_GridMoments(labelled, input.width, input.height, input.depth), xy, depth);
+}
+
+/**
+ * Find the ROI of a sparse mask, coarse to fine - the window holding the
+ * most labels, the most central of those if there are several. The mask is pooled
+ * down to at most an eighth of its size, each coarse voxel counting the
+ * labelled voxels beneath it, so small labels are never lost. Every
+ * window is searched at that level. The best is then refined at full
+ * resolution, straight from the spans, trying two steps either side
+ * along each axis while the step halves down to a single voxel.
+ *
+ * @param mask - the sparse mask
+ * @param xy - ROI width and height
+ * @param depth - ROI depth
+ *
+ * @return an ROI struct
+ */
 
+ROI FindROI(SparseLabel3D const &mask, size_t xy, size_t depth) {
     ROI roi;
     roi.sum = 0;
     roi.x = 0;
@@ -238,32 +362,119 @@ ROI FindROI(ImageU8L3D &input, size_t xy, size_t depth) {
     roi.xy_dim = xy;
     roi.depth = depth;
 
-    double hw = xy / 2;
-    double hh = xy / 2;
-    double hd = depth / 2;
-    double dd = xy * xy + xy * xy+ depth * depth;
-
-
-    for (int i = 0; i < num_threads; i++) {
-        ROI troi = rois[i];
-
-        if (troi.sum >= roi.sum) {
-            ImageU8L3D cropped = Crop(input, troi.x, troi.y, troi.z, roi.xy_dim, roi.xy_dim, roi.depth);
-            int cx, cy, cz = 0;
-            int sum = 0;
-            FindCOM(cropped, cx, cy, cz, sum);
-
-            double df = (cx - hw) *  (cx - hw) + (cy - hh) * (cy - hh) + (cz - hd) * (cz - hd);
-                
-            if (df < dd) {
-                roi.sum = troi.sum;
-                roi.x = troi.x;
-                roi.y = troi.y;
-                roi.z = troi.z;
-                dd = df;
+    if (xy > mask.width || xy > mask.height || depth > mask.depth) {
+        return roi;
+    }
+
+    // The coarsest level still needs a few voxels across the window
+    size_t factor = 8;
+
+    while (factor > 1 && (xy / factor < 4 || depth / factor < 2)) {
+        factor /= 2;
+    }
+
+    size_t cw = (mask.width + factor - 1) / factor;
+    size_t ch = (mask.height + factor - 1) / factor;
+    size_t cd = (mask.depth + factor - 1) / factor;
+    std::vector<uint32_t> pooled(cw * ch * cd, 0);
+
+    for (Span const &s : mask.spans) {
+        size_t row = ((s.z / factor) * ch + s.y / factor) * cw;
+
+        for (size_t cx = s.x0 / factor; cx * factor < s.x1; cx++) {
+            size_t x0 = std::max(static_cast<size_t>(s.x0), cx * factor);
+            size_t x1 = std::min(static_cast<size_t>(s.x1), (cx + 1) * factor);
+            pooled[row + cx] += static_cast<uint32_t>(x1 - x0);
+        }
+    }
+
+    ROI coarse = _SearchMoments(_GridMoments(pooled, cw, ch, cd), xy / factor, depth / factor);
+    size_t max_x = mask.width - xy;
+    size_t max_y = mask.height - xy;
+    size_t max_z = mask.depth - depth;
+    roi.x = std::min(coarse.x * factor, max_x);
+    roi.y = std::min(coarse.y * factor, max_y);
+    roi.z = std::min(coarse.z * factor, max_z);
+
+    uint32_t count = 0;
+    double dd = _SpanDistance(mask, roi.x, roi.y, roi.z, xy, xy, depth, count);
+    roi.sum = count;
+
+    for (size_t step = std::max(factor / 2, static_cast<size_t>(1)); ; step /= 2) {
+        ROI centre = roi;
+
+        // Offsets in a fixed order, and only a strictly better window moves the ROI
+        for (int dz = -2; dz <= 2; dz++) {
+            for (int dy = -2; dy <= 2; dy++) {
+                for (int dx = -2; dx <= 2; dx++) {
+                    long nx = static_cast<long>(centre.x) + dx * static_cast<long>(step);
+                    long ny = static_cast<long>(centre.y) + dy * static_cast<long>(step);
+                    long nz = static_cast<long>(centre.z) + dz * static_cast<long>(step);
+
+                    if (nx < 0 || ny < 0 || nz < 0 || nx > static_cast<long>(max_x) || ny > static_cast<long>(max_y) || nz > static_cast<long>(max_z)) {
+                        continue;
+                    }
+
+                    double df = _SpanDistance(mask, nx, ny, nz, xy, xy, depth, count);
+
+                    if (_Better(count, df, static_cast<uint32_t>(roi.sum), dd)) {
+                        roi.x = nx;
+                        roi.y = ny;
+                        roi.z = nz;
+                        roi.sum = count;
+                        dd = df;
+                    }
+                }
             }
         }
+
+        if (step == 1) {
+            break;
+        }
     }
 
     return roi;
 }
+
+/**
+ * The ROI straight from the labels, when they all fit in one window.
+ * It is then the window the search would find - holding every label,
+ * with their centre of mass at its centre, or as close as the labels
+ * and the volume allow. No search needed.
+ *
+ * @param mask - the sparse mask
+ * @param xy - ROI width and height
+ * @param depth - ROI depth
+ * @param roi - set to the ROI if there is one
+ *
+ * @return bool - false if the labels don't fit in one window, so the caller should search
+ */
+
+bool ROIFromLabels(SparseLabel3D const &mask, size_t xy, size_t depth, ROI &roi) {
+    LabelBounds bounds = MeasureLabel(mask, 0);
+
+    if (bounds.count == 0 || xy > mask.width || xy > mask.height || depth > mask.depth) {
+        return false;
+    }
+
+    if (bounds.max_x - bounds.min_x >= xy || bounds.max_y - bounds.min_y >= xy || bounds.max_z - bounds.min_z >= depth) {
+        return false;
+    }
+
+    // Centre on the centroid, then keep the labels and the window inside the volume
+    auto place = [] (double centre, size_t size, size_t lo, size_t hi, size_t extent) {
+        long start = static_cast<long>(std::floor(centre)) - static_cast<long>(size / 2);
+        start = std::min(start, static_cast<long>(lo));
+        start = std::max(start, static_cast<long>(hi) - static_cast<long>(size) + 1);
+        start = std::max(start, 0l);
+        return static_cast<size_t>(std::min(start, static_cast<long>(extent - size)));
+    };
+
+    roi.x = place(bounds.cx, xy, bounds.min_x, bounds.max_x, mask.width);
+    roi.y = place(bounds.cy, xy, bounds.min_y, bounds.max_y, mask.height);
+    roi.z = place(bounds.cz, depth, bounds.min_z, bounds.max_z, mask.depth);
+    roi.xy_dim = xy;
+    roi.depth = depth;
+    roi.sum = static_cast<double>(bounds.count);
+    return true;
+}
@@ -16,7 +16,7 @@
 
 using namespace imagine;
 
-std::default_random_engine RANDROT_GENERATOR;
+thread_local std::default_random_engine RANDROT_GENERATOR;
 std::uniform_real_distribution<float> RANDROT_DISTRIB(0.0f,1.0f);
 
 glm::quat RandRot() {
@@ -0,0 +1,476 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file shard.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Fixed record dataset shards.
+ *
+ * Records are numbered as they are handed out, and record r lives in
+ * shard r / records_per_shard. As every record is the same size, the
+ * source, mask and metadata for a record can each be written on their
+ * own, in any order, by the background writer. A record only counts
+ * once its metadata is written with valid set, and its line is in
+ * index.csv.
+ *
+ * The source is stored as float32, float16 or uint16 depending on
+ * the precision. For uint16, multiply by scale and add zero from the
+ * scale section to get the floats back.
+ *
+ * From Python:
+ *   rec = np.dtype({'names': ['source', 'scale', 'mask', 'meta'],
+ *                   'formats': [(source_dtype, (d, h, w)), ('<f8', 2), ('u1', (d, h, w)), ('<i4', 16)],
+ *                   'offsets': [source_offset, scale_offset, mask_offset, meta_offset],
+ *                   'itemsize': record_size})
+ *   shard = np.memmap('shard_00000.bin', dtype=rec, mode='r')
+ */
+
+#include "shard.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+using namespace imagine;
+
+static const char *SHARD_INDEX_HEADER = "record,shard,offset,ogsource,ogmask,fitssource,fitsmask,annolog,annodat,newsource,newmask,roix,roiy,roiz,roiwh,roid,back";
+
+size_t _AlignUp(size_t v, size_t a) {
+    return (v + a - 1) / a * a;
+}
+
+/**
+ * Work out the record layout for volumes of a given size.
+ *
+ * @param width, height, depth - the size of the source and mask volumes
+ * @param records_per_shard - how many records in each shard file
+ * @param precision - how the source volume is stored
+ *
+ * @return ShardLayout
+ */
+
+ShardLayout MakeShardLayout(size_t width, size_t height, size_t depth, size_t records_per_shard, Precision precision) {
+    ShardLayout layout;
+    layout.width = width;
+    layout.height = height;
+    layout.depth = depth;
+    layout.records_per_shard = std::max(static_cast<size_t>(1), records_per_shard);
+    layout.precision = precision;
+    size_t voxels = width * height * depth;
+    layout.source_offset = 0;
+    layout.source_bytes = voxels * PrecisionBytes(precision);
+    layout.scale_offset = _AlignUp(layout.source_offset + layout.source_bytes, 64);
+    layout.mask_offset = _AlignUp(layout.scale_offset + 2 * sizeof(double), 64);
+    layout.mask_bytes = voxels * sizeof(uint8_t);
+    layout.meta_offset = _AlignUp(layout.mask_offset + layout.mask_bytes, 64);
+    layout.record_size = _AlignUp(layout.meta_offset + sizeof(ShardMeta), 4096);
+    return layout;
+}
+
+std::string _SourceDtype(Precision precision) {
+    switch (precision) {
+        case Precision::F16: return "<f2";
+        case Precision::U16: return "<u2";
+        default: return "<f4";
+    }
+}
+
+std::string _LayoutJSON(ShardLayout const &layout) {
+    std::stringstream ss;
+    std::string shape = "[" + libcee::ToString(layout.depth) + ", " + libcee::ToString(layout.height) + ", " + libcee::ToString(layout.width) + "]";
+    ss << "{" << std::endl;
+    ss << "  \"width\": " << layout.width << "," << std::endl;
+    ss << "  \"height\": " << layout.height << "," << std::endl;
+    ss << "  \"depth\": " << layout.depth << "," << std::endl;
+    ss << "  \"records_per_shard\": " << layout.records_per_shard << "," << std::endl;
+    ss << "  \"record_size\": " << layout.record_size << "," << std::endl;
+    ss << "  \"source\": {\"offset\": " << layout.source_offset << ", \"dtype\": \"" << _SourceDtype(layout.precision) << "\", \"shape\": " << shape << "}," << std::endl;
+    ss << "  \"scale\": {\"offset\": " << layout.scale_offset << ", \"dtype\": \"<f8\", \"shape\": [2]}," << std::endl;
+    ss << "  \"mask\": {\"offset\": " << layout.mask_offset << ", \"dtype\": \"|u1\", \"shape\": " << shape << "}," << std::endl;
+    ss << "  \"meta\": {\"offset\": " << layout.meta_offset << ", \"dtype\": \"<i4\", \"fields\": "
+        << "[\"valid\", \"image_idx\", \"aug\", \"roix\", \"roiy\", \"roiz\", \"roiwh\", \"roid\", \"back\"]}" << std::endl;
+    ss << "}" << std::endl;
+    return ss.str();
+}
+
+// Find "key": number in our own layout.json
+size_t _JSONValue(std::string const &json, std::string const &key) {
+    size_t pos = json.find("\"" + key + "\":");
+
+    if (pos == std::string::npos) {
+        throw std::runtime_error("No " + key + " in shard layout");
+    }
+
+    return static_cast<size_t>(std::strtoull(json.c_str() + pos + key.size() + 3, NULL, 10));
+}
+
+/**
+ * Read the layout of an existing set of shards.
+ *
+ * @param dir - the directory holding layout.json
+ *
+ * @return ShardLayout
+ */
+
+ShardLayout ReadShardLayout(std::string const &dir) {
+    std::ifstream file(dir + "/layout.json");
+
+    if (!file) {
+        throw std::runtime_error("No layout.json in " + dir);
+    }
+
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string json = ss.str();
+    Precision precision = Precision::F32;
+
+    if (json.find("\"dtype\": \"<f2\"") != std::string::npos) {
+        precision = Precision::F16;
+    } else if (json.find("\"dtype\": \"<u2\"") != std::string::npos) {
+        precision = Precision::U16;
+    }
+
+    ShardLayout layout = MakeShardLayout(_JSONValue(json, "width"), _JSONValue(json, "height"),
+        _JSONValue(json, "depth"), _JSONValue(json, "records_per_shard"), precision);
+
+    if (layout.record_size != _JSONValue(json, "record_size")) {
+        throw std::runtime_error("Shard layout in " + dir + " is from a different version");
+    }
+
+    return layout;
+}
+
+/**
+ * Start writing shards into a directory. If there are shards there
+ * already with the same layout, new records go after the old ones.
+ *
+ * @param dir - the output directory
+ * @param layout - from MakeShardLayout
+ */
+
+void ShardSet::Open(std::string const &dir, ShardLayout const &layout) {
+    _dir = dir;
+    _layout = layout;
+    std::string layout_path = dir + "/layout.json";
+    std::string index_path = dir + "/index.csv";
+    std::ifstream existing(layout_path);
+
+    if (existing) {
+        ShardLayout old = ReadShardLayout(dir);
+
+        if (old.width != layout.width || old.height != layout.height || old.depth != layout.depth ||
+            old.records_per_shard != layout.records_per_shard || old.precision != layout.precision) {
+            auto describe = [] (ShardLayout const &l) {
+                return libcee::ToString(l.width) + "x" + libcee::ToString(l.height) + "x" + libcee::ToString(l.depth) + " " +
+                    PrecisionName(l.precision) + ", " + libcee::ToString(l.records_per_shard) + " per shard";
+            };
+
+            throw std::runtime_error("Shards in " + dir + " have a different layout - " + describe(old) + ", not " + describe(layout));
+        }
+    } else {
+        std::vector<char> json;
+        std::string text = _LayoutJSON(layout);
+        json.assign(text.begin(), text.end());
+        WriteFileAtomic(layout_path, json);
+    }
+
+    // Carry on after the highest record in the index
+    size_t next = 0;
+    bool header = false;
+    std::ifstream index_in(index_path);
+    std::string line;
+
+    while (std::getline(index_in, line)) {
+        if (!header) {
+            header = true;
+            continue;
+        }
+
+        if (!line.empty()) {
+            next = std::max(next, static_cast<size_t>(std::strtoull(line.c_str(), NULL, 10)) + 1);
+        }
+    }
+
+    index_in.close();
+    _next = next;
+    _index.open(index_path, std::ios::app);
+
+    if (!header) {
+        _index << SHARD_INDEX_HEADER << std::endl;
+    }
+
+    _open = true;
+}
+
+/**
+ * Hand out the next record number. Thread safe.
+ */
+
+size_t ShardSet::Allocate() {
+    return _next.fetch_add(1);
+}
+
+std::string ShardSet::ShardPath(size_t record) const {
+    return _dir + "/shard_" + libcee::IntToStringLeadingZeroes(static_cast<int>(record / _layout.records_per_shard), 5) + ".bin";
+}
+
+void ShardSet::_QueueBytes(size_t record, size_t offset, std::vector<char> bytes, std::shared_ptr<WriteGroup> const &group) {
+    WriteJob job;
+    TrackWrite(job, group);
+    job.path = ShardPath(record);
+    job.offset = static_cast<long long>((record % _layout.records_per_shard) * _layout.record_size + offset);
+    job.bytes = std::make_shared<const std::vector<char>>(std::move(bytes));
+    SharedWriter().Write(job);
+}
+
+template<typename V>
+std::vector<char> _FlattenVolume(std::vector<std::vector<std::vector<V>>> const &data, size_t width, size_t height, size_t depth, size_t expected) {
+    if (width * height * depth * sizeof(V) != expected) {
+        throw std::runtime_error("Volume is not the size of a shard record");
+    }
+
+    std::vector<char> bytes(expected);
+    char *out = bytes.data();
+
+    for (size_t z = 0; z < depth; z++) {
+        for (size_t y = 0; y < height; y++) {
+            std::memcpy(out, data[z][y].data(), width * sizeof(V));
+            out += width * sizeof(V);
+        }
+    }
+
+    return bytes;
+}
+
+template<typename V>
+std::vector<char> _FlattenImage(std::vector<std::vector<V>> const &data, size_t width, size_t height, size_t expected) {
+    std::vector<std::vector<std::vector<V>>> volume = {data};
+    return _FlattenVolume(volume, width, height, 1, expected);
+}
+
+std::vector<float> _FloatVolume(std::vector<std::vector<std::vector<float>>> const &data, size_t width, size_t height, size_t depth, size_t expected) {
+    if (width * height * depth != expected) {
+        throw std::runtime_error("Volume is not the size of a shard record");
+    }
+
+    std::vector<float> flat(expected);
+
+    for (size_t z = 0; z < depth; z++) {
+        for (size_t y = 0; y < height; y++) {
+            std::memcpy(flat.data() + (z * height + y) * width, data[z][y].data(), width * sizeof(float));
+        }
+    }
+
+    return flat;
+}
+
+/**
+ * Store a flattened source at the layout's precision, along with its
+ * scale, as one write. Lower precisions report their error.
+ */
+
+void ShardSet::_QueueSource(size_t record, std::string const &name, std::vector<float> const &flat, std::shared_ptr<WriteGroup> const &group) {
+    std::vector<char> bytes(_layout.mask_offset - _layout.source_offset, 0);
+    QuantError error;
+
+    if (_layout.precision == Precision::F16) {
+        error = QuantiseF16(flat.data(), flat.size(), reinterpret_cast<uint16_t*>(bytes.data()));
+    } else if (_layout.precision == Precision::U16) {
+        error = QuantiseU16(flat.data(), flat.size(), reinterpret_cast<uint16_t*>(bytes.data()));
+    } else {
+        std::memcpy(bytes.data(), flat.data(), flat.size() * sizeof(float));
+    }
+
+    double scale[2] = {error.scale, error.zero};
+    std::memcpy(bytes.data() + _layout.scale_offset - _layout.source_offset, scale, sizeof(scale));
+
+    if (_layout.precision != Precision::F32) {
+        std::cout << "Quantised " << name << " to " << PrecisionName(_layout.precision) << ", max error "
+            << error.max_error << ", rms " << error.rms_error << std::endl;
+    }
+
+    _QueueBytes(record, _layout.source_offset, std::move(bytes), group);
+}
+
+/**
+ * Queue the source volume of a record for writing. It must be the
+ * size given in the layout.
+ */
+
+void ShardSet::QueueSource(size_t record, ImageF32L3D const &image, std::shared_ptr<WriteGroup> const &group) {
+    size_t expected = _layout.width * _layout.height * _layout.depth;
+    _QueueSource(record, "record " + libcee::ToString(record), _FloatVolume(image.data, image.width, image.height, image.depth, expected), group);
+}
+
+void ShardSet::QueueSource(size_t record, ImageF32L const &image, std::shared_ptr<WriteGroup> const &group) {
+    size_t expected = _layout.width * _layout.height * _layout.depth;
+    std::vector<std::vector<std::vector<float>>> volume = {image.data};
+    _QueueSource(record, "record " + libcee::ToString(record), _FloatVolume(volume, image.width, image.height, 1, expected), group);
+}
+
+void ShardSet::QueueMask(size_t record, ImageU8L3D const &image, std::shared_ptr<WriteGroup> const &group) {
+    _QueueBytes(record, _layout.mask_offset, _FlattenVolume(image.data, image.width, image.height, image.depth, _layout.mask_bytes), group);
+}
+
+void ShardSet::QueueMask(size_t record, ImageU8L const &image, std::shared_ptr<WriteGroup> const &group) {
+    _QueueBytes(record, _layout.mask_offset, _FlattenImage(image.data, image.width, image.height, _layout.mask_bytes), group);
+}
+
+std::string ShardSet::_IndexLine(size_t record, std::string const &csv_line) const {
+    std::stringstream line;
+    line << record << "," << libcee::FilenameFromPath(ShardPath(record)) << ","
+        << (record % _layout.records_per_shard) * _layout.record_size << "," << csv_line;
+    return line.str();
+}
+
+/**
+ * Write index.csv from scratch, with one line per record given. Used
+ * when resuming, as pairs done again write their lines a second time.
+ *
+ * @param records - each record and its master_dataset.csv columns
+ */
+
+void ShardSet::RewriteIndex(std::vector<std::pair<size_t, std::string>> const &records) {
+    std::string text = std::string(SHARD_INDEX_HEADER) + "\n";
+
+    for (auto const &record : records) {
+        text += _IndexLine(record.first, record.second) + "\n";
+    }
+
+    std::lock_guard<std::mutex> lock(_index_mutex);
+    _index.close();
+    std::string index_path = _dir + "/index.csv";
+    WriteFileAtomic(index_path, std::vector<char>(text.begin(), text.end()));
+    _index.open(index_path, std::ios::app);
+}
+
+/**
+ * Finish a record - queue its metadata, then add it to the index once
+ * the metadata is on disk. The index line is left out if it isn't.
+ *
+ * @param record - the record number
+ * @param meta - the metadata block
+ * @param csv_line - the master_dataset.csv columns for this record
+ */
+
+void ShardSet::QueueMeta(size_t record, ShardMeta const &meta, std::string const &csv_line) {
+    ShardMeta m = meta;
+    m.valid = 1;
+    // Pad out to the end of the record, so a shard is always a whole number of records long
+    std::vector<char> bytes(_layout.record_size - _layout.meta_offset, 0);
+    std::memcpy(bytes.data(), &m, sizeof(ShardMeta));
+
+    size_t offset = (record % _layout.records_per_shard) * _layout.record_size;
+    WriteJob job;
+    job.path = ShardPath(record);
+    job.offset = static_cast<long long>(offset + _layout.meta_offset);
+    job.bytes = std::make_shared<const std::vector<char>>(std::move(bytes));
+    job.done = [this, index_line = _IndexLine(record, csv_line)] (bool ok) {
+        if (ok) {
+            std::lock_guard<std::mutex> lock(_index_mutex);
+            _index << index_line << std::endl;
+        }
+    };
+
+    SharedWriter().Write(job);
+}
+
+ShardSet &SharedShards() {
+    static ShardSet shards;
+    return shards;
+}
+
+/**
+ * Map a shard file for reading.
+ *
+ * @param path - the shard file
+ * @param layout - from ReadShardLayout
+ */
+
+ShardFile::ShardFile(std::string const &path, ShardLayout const &layout) : _layout(layout) {
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path);
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    _size = static_cast<size_t>(st.st_size);
+
+    if (_size > 0) {
+        void *addr = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map " + path);
+        }
+
+        _data = static_cast<const char*>(addr);
+    }
+
+    close(fd);
+}
+
+ShardFile::~ShardFile() {
+    if (_data != nullptr) {
+        munmap(const_cast<char*>(_data), _size);
+    }
+}
+
+/**
+ * The start of record r. Throws if the shard doesn't hold it all, as
+ * when it was only partly written.
+ */
+
+const char *ShardFile::_Record(size_t r) const {
+    if (r >= NumRecords()) {
+        throw std::runtime_error("Record " + libcee::ToString(r) + " is past the end of a shard of " + libcee::ToString(NumRecords()));
+    }
+
+    return _data + r * _layout.record_size;
+}
+
+/**
+ * Read back the source of record r as floats, whatever the precision.
+ */
+
+std::vector<float> ShardFile::Source(size_t r) const {
+    const char *base = _Record(r);
+    size_t voxels = _layout.width * _layout.height * _layout.depth;
+    std::vector<float> values(voxels);
+
+    if (_layout.precision == Precision::F32) {
+        std::memcpy(values.data(), base + _layout.source_offset, voxels * sizeof(float));
+        return values;
+    }
+
+    double scale[2];
+    std::memcpy(scale, base + _layout.scale_offset, sizeof(scale));
+    const uint16_t *stored = reinterpret_cast<const uint16_t*>(base + _layout.source_offset);
+
+    for (size_t i = 0; i < voxels; i++) {
+        if (_layout.precision == Precision::F16) {
+            values[i] = HalfToFloat(stored[i]);
+        } else {
+            values[i] = static_cast<float>(static_cast<double>(stored[i]) * scale[0] + scale[1]);
+        }
+    }
+
+    return values;
+}
+
+const uint8_t *ShardFile::Mask(size_t r) const {
+    return reinterpret_cast<const uint8_t*>(_Record(r) + _layout.mask_offset);
+}
+
+const ShardMeta *ShardFile::Meta(size_t r) const {
+    return reinterpret_cast<const ShardMeta*>(_Record(r) + _layout.meta_offset);
+}
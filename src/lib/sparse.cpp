@@ -0,0 +1,600 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file sparse.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Run-length sparse label volumes.
+ *
+ * The neuron masks are almost entirely zero, so we hold them as
+ * runs along x. Everything here costs time in proportion to the
+ * number of runs, not the size of the volume.
+ *
+ */
+
+#include "sparse.hpp"
+#include <fstream>
+#include <cstring>
+
+using namespace imagine;
+
+/**
+ * Add a span to the end of a list, joining it to the last span
+ * if they touch and share a label.
+ */
+void _PushSpan(std::vector<Span> &spans, Span const &s) {
+    if (!spans.empty()) {
+        Span &last = spans.back();
+
+        if (last.z == s.z && last.y == s.y && last.label == s.label && last.x1 == s.x0) {
+            last.x1 = s.x1;
+            return;
+        }
+    }
+
+    spans.push_back(s);
+}
+
+/**
+ * The index of the first span in each row, plus one past the end.
+ * Row r is z * height + y.
+ */
+std::vector<size_t> _RowStarts(SparseLabel3D const &mask) {
+    std::vector<size_t> starts(mask.depth * mask.height + 1, 0);
+
+    for (Span const &s : mask.spans) {
+        starts[s.z * mask.height + s.y + 1] += 1;
+    }
+
+    for (size_t i = 1; i < starts.size(); i++) {
+        starts[i] += starts[i - 1];
+    }
+
+    return starts;
+}
+
+/**
+ * Convert a dense mask to spans. The only function here that
+ * looks at every voxel.
+ *
+ * @param image - the dense mask
+ *
+ * @return SparseLabel3D
+ */
+
+SparseLabel3D ToSparse(ImageU8L3D const &image) {
+    SparseLabel3D mask;
+    mask.width = image.width;
+    mask.height = image.height;
+    mask.depth = image.depth;
+
+    for (size_t z = 0; z < image.depth; z++) {
+        for (size_t y = 0; y < image.height; y++) {
+            const std::vector<uint8_t> &row = image.data[z][y];
+            size_t x = 0;
+
+            while (x < image.width) {
+                uint8_t label = row[x];
+
+                if (label == 0) {
+                    x++;
+                    continue;
+                }
+
+                size_t start = x;
+
+                while (x < image.width && row[x] == label) {
+                    x++;
+                }
+
+                Span s;
+                s.z = static_cast<uint16_t>(z);
+                s.y = static_cast<uint16_t>(y);
+                s.x0 = static_cast<uint16_t>(start);
+                s.x1 = static_cast<uint16_t>(x);
+                s.label = label;
+                mask.spans.push_back(s);
+            }
+        }
+    }
+
+    return mask;
+}
+
+/**
+ * Convert spans back to a dense mask.
+ *
+ * @param mask - the sparse mask
+ *
+ * @return ImageU8L3D
+ */
+
+ImageU8L3D Densify(SparseLabel3D const &mask) {
+    ImageU8L3D image(mask.width, mask.height, mask.depth);
+
+    for (Span const &s : mask.spans) {
+        std::vector<uint8_t> &row = image.data[s.z][s.y];
+        std::fill(row.begin() + s.x0, row.begin() + s.x1, s.label);
+    }
+
+    return image;
+}
+
+/**
+ * A maximum intensity projection along Z.
+ *
+ * @param mask - the sparse mask
+ *
+ * @return ImageU8L
+ */
+
+ImageU8L ProjectSparse(SparseLabel3D const &mask) {
+    ImageU8L projected(mask.width, mask.height);
+
+    for (Span const &s : mask.spans) {
+        std::vector<uint8_t> &row = projected.data[s.y];
+
+        for (size_t x = s.x0; x < s.x1; x++) {
+            row[x] = std::max(row[x], s.label);
+        }
+    }
+
+    return projected;
+}
+
+/**
+ * The maximum projection along Z, as a mask one slice deep, so it can
+ * be resized as labels in 2D.
+ *
+ * @param mask - the sparse mask
+ *
+ * @return SparseLabel3D
+ */
+
+SparseLabel3D FlattenSparse(SparseLabel3D const &mask) {
+    ImageU8L projected = ProjectSparse(mask);
+    ImageU8L3D slice(projected.width, projected.height, 1);
+    slice.data[0] = std::move(projected.data);
+    return ToSparse(slice);
+}
+
+/**
+ * Crop a sparse mask. Same arguments as imagine's Crop.
+ *
+ * @param mask - the sparse mask
+ * @param x, y, z - the corner of the crop
+ * @param width, height, depth - the size of the crop
+ *
+ * @return SparseLabel3D
+ */
+
+SparseLabel3D CropSparse(SparseLabel3D const &mask, size_t x, size_t y, size_t z, size_t width, size_t height, size_t depth) {
+    SparseLabel3D cropped;
+    cropped.width = width;
+    cropped.height = height;
+    cropped.depth = depth;
+
+    for (Span const &s : mask.spans) {
+        if (s.z < z || s.z >= z + depth || s.y < y || s.y >= y + height) {
+            continue;
+        }
+
+        size_t x0 = std::max(static_cast<size_t>(s.x0), x);
+        size_t x1 = std::min(static_cast<size_t>(s.x1), x + width);
+
+        if (x1 > x0) {
+            Span c;
+            c.z = static_cast<uint16_t>(s.z - z);
+            c.y = static_cast<uint16_t>(s.y - y);
+            c.x0 = static_cast<uint16_t>(x0 - x);
+            c.x1 = static_cast<uint16_t>(x1 - x);
+            c.label = s.label;
+            cropped.spans.push_back(c);
+        }
+    }
+
+    return cropped;
+}
+
+/**
+ * Nearest neighbour resize. Output voxel i samples input voxel
+ * floor(i * in / out) along each axis.
+ *
+ * @param mask - the sparse mask
+ * @param width, height, depth - the new size
+ *
+ * @return SparseLabel3D
+ */
+
+SparseLabel3D ResizeSparse(SparseLabel3D const &mask, size_t width, size_t height, size_t depth) {
+    SparseLabel3D resized;
+    resized.width = width;
+    resized.height = height;
+    resized.depth = depth;
+
+    if (mask.spans.empty() || mask.width == 0) {
+        return resized;
+    }
+
+    std::vector<size_t> starts = _RowStarts(mask);
+
+    for (size_t z = 0; z < depth; z++) {
+        size_t sz = z * mask.depth / depth;
+
+        for (size_t y = 0; y < height; y++) {
+            size_t sy = y * mask.height / height;
+            size_t row = sz * mask.height + sy;
+
+            for (size_t i = starts[row]; i < starts[row + 1]; i++) {
+                Span const &s = mask.spans[i];
+                // The output voxels whose source lies inside this span
+                size_t x0 = (s.x0 * width + mask.width - 1) / mask.width;
+                size_t x1 = (s.x1 * width + mask.width - 1) / mask.width;
+
+                if (x1 > x0) {
+                    Span r;
+                    r.z = static_cast<uint16_t>(z);
+                    r.y = static_cast<uint16_t>(y);
+                    r.x0 = static_cast<uint16_t>(x0);
+                    r.x1 = static_cast<uint16_t>(x1);
+                    r.label = s.label;
+                    _PushSpan(resized.spans, r);
+                }
+            }
+        }
+    }
+
+    return resized;
+}
+
+/**
+ * The source voxels behind each output voxel along one axis. For a
+ * whole number shrink that is the block of source voxels, otherwise
+ * the one nearest the output voxel's centre.
+ */
+void _Footprints(size_t from, size_t to, std::vector<size_t> &starts, std::vector<size_t> &lengths) {
+    starts.assign(to, 0);
+    lengths.assign(to, 1);
+
+    if (to == 0) {
+        return;
+    }
+
+    if (from >= to && from % to == 0) {
+        size_t k = from / to;
+
+        for (size_t i = 0; i < to; i++) {
+            starts[i] = i * k;
+            lengths[i] = k;
+        }
+    } else {
+        for (size_t i = 0; i < to; i++) {
+            starts[i] = std::min((2 * i + 1) * from / (2 * to), from - 1);
+        }
+    }
+}
+
+/**
+ * Resize a label volume without inventing labels. Along each axis the
+ * size either shrinks by a whole number, where each output voxel takes
+ * the most common label in its block (a neuron wins a tie with the
+ * background, and the lower label a tie between neurons), or changes
+ * by some other factor, where it takes the nearest voxel. Only the
+ * labelled spans are visited.
+ *
+ * @param mask - the sparse mask
+ * @param width, height, depth - the new size
+ * @param mip - if not null, set to the maximum label along z of the result
+ *
+ * @return SparseLabel3D
+ */
+
+SparseLabel3D ResizeLabels(SparseLabel3D const &mask, size_t width, size_t height, size_t depth, ImageU8L *mip) {
+    SparseLabel3D resized;
+    resized.width = width;
+    resized.height = height;
+    resized.depth = depth;
+
+    if (mip != nullptr) {
+        *mip = ImageU8L(width, height);
+    }
+
+    if (mask.spans.empty() || mask.width == 0 || width == 0 || height == 0 || depth == 0) {
+        return resized;
+    }
+
+    std::vector<size_t> xs, xl, ys, yl, zs, zl;
+    _Footprints(mask.width, width, xs, xl);
+    _Footprints(mask.height, height, ys, yl);
+    _Footprints(mask.depth, depth, zs, zl);
+
+    // The output columns each source column feeds - none, one, or a run of them when growing
+    std::vector<size_t> first(mask.width, 0), last(mask.width, 0);
+
+    for (size_t x = 0; x < width; x++) {
+        for (size_t sx = xs[x]; sx < xs[x] + xl[x]; sx++) {
+            if (first[sx] == last[sx]) {
+                first[sx] = x;
+            }
+
+            last[sx] = x + 1;
+        }
+    }
+
+    uint8_t max_label = 0;
+
+    for (Span const &s : mask.spans) {
+        max_label = std::max(max_label, s.label);
+    }
+
+    size_t labels = static_cast<size_t>(max_label) + 1;
+    std::vector<size_t> starts = _RowStarts(mask);
+    std::vector<uint32_t> counts(width * labels, 0);
+    std::vector<size_t> touched;
+
+    for (size_t z = 0; z < depth; z++) {
+        for (size_t y = 0; y < height; y++) {
+            // Count the labels in each output voxel's block
+            for (size_t sz = zs[z]; sz < zs[z] + zl[z]; sz++) {
+                for (size_t sy = ys[y]; sy < ys[y] + yl[y]; sy++) {
+                    size_t row = sz * mask.height + sy;
+
+                    for (size_t i = starts[row]; i < starts[row + 1]; i++) {
+                        Span const &s = mask.spans[i];
+
+                        for (size_t sx = s.x0; sx < s.x1; sx++) {
+                            for (size_t x = first[sx]; x < last[sx]; x++) {
+                                uint32_t &count = counts[x * labels + s.label];
+
+                                if (count == 0) {
+                                    touched.push_back(x);
+                                }
+
+                                count += 1;
+                            }
+                        }
+                    }
+                }
+            }
+
+            std::sort(touched.begin(), touched.end());
+            touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+            for (size_t x : touched) {
+                uint32_t *voxel = &counts[x * labels];
+                uint32_t block = static_cast<uint32_t>(xl[x] * yl[y] * zl[z]);
+                uint32_t labelled = 0, best = 0;
+                uint8_t label = 0;
+
+                for (size_t l = 1; l < labels; l++) {
+                    labelled += voxel[l];
+
+                    if (voxel[l] > best) {
+                        best = voxel[l];
+                        label = static_cast<uint8_t>(l);
+                    }
+
+                    voxel[l] = 0;
+                }
+
+                if (label != 0 && best >= block - labelled) {
+                    Span r;
+                    r.z = static_cast<uint16_t>(z);
+                    r.y = static_cast<uint16_t>(y);
+                    r.x0 = static_cast<uint16_t>(x);
+                    r.x1 = static_cast<uint16_t>(x + 1);
+                    r.label = label;
+                    _PushSpan(resized.spans, r);
+
+                    if (mip != nullptr) {
+                        mip->data[y][x] = std::max(mip->data[y][x], label);
+                    }
+                }
+            }
+
+            touched.clear();
+        }
+    }
+
+    return resized;
+}
+
+/**
+ * Bounding box, voxel count and centroid of one label.
+ *
+ * @param mask - the sparse mask
+ * @param label - the label to measure, or 0 for all labels
+ *
+ * @return LabelBounds - count is zero if the label is absent
+ */
+
+LabelBounds MeasureLabel(SparseLabel3D const &mask, uint8_t label) {
+    LabelBounds bounds;
+    double sx = 0, sy = 0, sz = 0;
+    bounds.min_x = mask.width;
+    bounds.min_y = mask.height;
+    bounds.min_z = mask.depth;
+
+    for (Span const &s : mask.spans) {
+        if (label != 0 && s.label != label) {
+            continue;
+        }
+
+        size_t len = s.x1 - s.x0;
+        bounds.count += len;
+        bounds.min_x = std::min(bounds.min_x, static_cast<size_t>(s.x0));
+        bounds.min_y = std::min(bounds.min_y, static_cast<size_t>(s.y));
+        bounds.min_z = std::min(bounds.min_z, static_cast<size_t>(s.z));
+        bounds.max_x = std::max(bounds.max_x, static_cast<size_t>(s.x1 - 1));
+        bounds.max_y = std::max(bounds.max_y, static_cast<size_t>(s.y));
+        bounds.max_z = std::max(bounds.max_z, static_cast<size_t>(s.z));
+
+        sx += static_cast<double>(s.x0 + s.x1 - 1) * static_cast<double>(len) / 2.0;
+        sy += static_cast<double>(s.y) * static_cast<double>(len);
+        sz += static_cast<double>(s.z) * static_cast<double>(len);
+    }
+
+    if (bounds.count == 0) {
+        bounds.min_x = 0;
+        bounds.min_y = 0;
+        bounds.min_z = 0;
+        return bounds;
+    }
+
+    bounds.cx = sx / static_cast<double>(bounds.count);
+    bounds.cy = sy / static_cast<double>(bounds.count);
+    bounds.cz = sz / static_cast<double>(bounds.count);
+    return bounds;
+}
+
+/**
+ * Map every label through a table, in place. Spans mapped to zero are
+ * dropped. Neighbouring spans that end up with the same label are left
+ * as they are, which every function here accepts.
+ *
+ * @param mask - the mask to relabel
+ * @param labels - the new label for each old one
+ */
+
+void RelabelSparse(SparseLabel3D &mask, std::vector<uint8_t> const &labels) {
+    std::vector<Span> spans;
+    spans.reserve(mask.spans.size());
+
+    for (Span s : mask.spans) {
+        s.label = s.label < labels.size() ? labels[s.label] : 0;
+
+        if (s.label != 0) {
+            spans.push_back(s);
+        }
+    }
+
+    mask.spans.swap(spans);
+}
+
+/**
+ * The number of labelled voxels.
+ */
+
+size_t CountLabelled(SparseLabel3D const &mask) {
+    size_t count = 0;
+
+    for (Span const &s : mask.spans) {
+        count += s.x1 - s.x0;
+    }
+
+    return count;
+}
+
+/**
+ * Return false if all elements are zero
+ *
+ * @param mask - SparseLabel3D
+ *
+ * @return bool
+ */
+
+bool non_zero(SparseLabel3D const &mask) {
+    return !mask.spans.empty();
+}
+
+// Saved masks start with these, then each span as z, y, x0, x1 (16 bit) and label
+typedef struct {
+    char magic[8];
+    uint64_t width;
+    uint64_t height;
+    uint64_t depth;
+    uint64_t spans;
+} _SparseHeader;
+
+const size_t _SPAN_BYTES = 9;
+
+/**
+ * A sparse mask as bytes, for saving and reloading with LoadSparse.
+ */
+std::vector<char> EncodeSparse(SparseLabel3D const &mask) {
+    _SparseHeader header;
+    std::memcpy(header.magic, "WGLSPANS", 8);
+    header.width = mask.width;
+    header.height = mask.height;
+    header.depth = mask.depth;
+    header.spans = mask.spans.size();
+
+    std::vector<char> bytes(sizeof(header) + mask.spans.size() * _SPAN_BYTES);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    char *out = bytes.data() + sizeof(header);
+
+    for (Span const &s : mask.spans) {
+        std::memcpy(out, &s.z, 2);
+        std::memcpy(out + 2, &s.y, 2);
+        std::memcpy(out + 4, &s.x0, 2);
+        std::memcpy(out + 6, &s.x1, 2);
+        out[8] = static_cast<char>(s.label);
+        out += _SPAN_BYTES;
+    }
+
+    return bytes;
+}
+
+/**
+ * Load a sparse mask saved from EncodeSparse. Nothing in the file is
+ * trusted - the span count must match its size, and every span must
+ * lie in the volume - so a cut short or corrupt file is turned down
+ * and the caller builds the mask again.
+ *
+ * @return bool - false if there is no usable file
+ */
+bool LoadSparse(std::string const &path, SparseLabel3D &mask) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+    if (!file) {
+        return false;
+    }
+
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    file.seekg(0, std::ios::beg);
+    _SparseHeader header;
+
+    if (size < sizeof(header) || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, "WGLSPANS", 8) != 0) {
+        return false;
+    }
+
+    // Spans hold 16 bit coordinates, and the file must be exactly the header and its spans
+    const uint64_t limit = 65536;
+
+    if (header.width > limit || header.height > limit || header.depth > limit ||
+        header.spans != (size - sizeof(header)) / _SPAN_BYTES || (size - sizeof(header)) % _SPAN_BYTES != 0) {
+        return false;
+    }
+
+    std::vector<char> bytes(header.spans * _SPAN_BYTES);
+
+    if (!file.read(bytes.data(), static_cast<std::streamsize>(bytes.size()))) {
+        return false;
+    }
+
+    SparseLabel3D loaded;
+    loaded.width = header.width;
+    loaded.height = header.height;
+    loaded.depth = header.depth;
+    loaded.spans.resize(header.spans);
+    const char *in = bytes.data();
+
+    for (Span &s : loaded.spans) {
+        std::memcpy(&s.z, in, 2);
+        std::memcpy(&s.y, in + 2, 2);
+        std::memcpy(&s.x0, in + 4, 2);
+        std::memcpy(&s.x1, in + 6, 2);
+        s.label = static_cast<uint8_t>(in[8]);
+        in += _SPAN_BYTES;
+
+        if (s.z >= loaded.depth || s.y >= loaded.height || s.x0 >= s.x1 || s.x1 > loaded.width || s.label == 0) {
+            return false;
+        }
+    }
+
+    mask = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,523 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file tiffstack.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief Channel and window selective AutoStack tiff reading.
+ *
+ * The AutoStack tiffs are one tall 2D image. Each slice of the
+ * stack is 'channels' images high, one per channel, so the row
+ * for slice d, channel c and row y is:
+ *
+ *   d * height * channels + c * height + y
+ *
+ * We only decode the strips that hold rows we want, and copy
+ * the x range we want straight into the stack, one memcpy per row.
+ * Any set of channels can be taken in the same pass. Strips are decoded
+ * in parallel on the shared pool, each thread with its own handle.
+ *
+ * The file can also be read into memory first (ReadTiffBytes), on
+ * another thread, and decoded from there later.
+ */
+
+#include "tiffstack.hpp"
+
+using namespace imagine;
+
+/**
+ * Turn a master ROI into a stack window.
+ *
+ * @param roi - the ROI
+ *
+ * @return StackWindow
+ */
+
+StackWindow WindowFromROI(ROI const &roi) {
+    StackWindow window;
+    window.x = roi.x;
+    window.y = roi.y;
+    window.z = roi.z;
+    window.width = roi.xy_dim;
+    window.height = roi.xy_dim;
+    window.depth = roi.depth;
+    return window;
+}
+
+/**
+ * Clamp a window to the stack, filling in any zero sizes.
+ */
+void _ResolveWindow(StackWindow &window, size_t width, size_t height, size_t depth) {
+    window.x = std::min(window.x, width);
+    window.y = std::min(window.y, height);
+    window.z = std::min(window.z, depth);
+
+    if (window.width == 0 || window.x + window.width > width) {
+        window.width = width - window.x;
+    }
+
+    if (window.height == 0 || window.y + window.height > height) {
+        window.height = height - window.y;
+    }
+
+    if (window.depth == 0 || window.z + window.depth > depth) {
+        window.depth = depth - window.z;
+    }
+}
+
+// Where each wanted source row goes, sorted by source row. Shared by the
+// in-memory and strip decoders, so the AutoStack layout lives in one place.
+typedef struct {
+    std::vector<uint32_t> rows;
+    std::vector<uint16_t*> dests;
+} _RowPlan;
+
+/**
+ * Size one output volume per wanted channel to the window, and plan
+ * the row copies that fill them.
+ *
+ * @param height - the height of one channel of one slice
+ * @param win - the window, already resolved
+ * @param wanted - the channels to extract, in output order
+ * @param stacks - set to one volume per wanted channel
+ */
+_RowPlan _PlanRows(size_t height, size_t channels, std::vector<size_t> const &wanted, StackWindow const &win, std::vector<ImageU16L3D> &stacks) {
+    _RowPlan plan;
+    std::vector<std::pair<uint32_t, uint16_t*>> pairs;
+    stacks.clear();
+
+    for (size_t c : wanted) {
+        if (c >= channels) {
+            throw std::runtime_error("Channel " + libcee::ToString(c) + " not in a stack of " + libcee::ToString(channels));
+        }
+    }
+
+    for (size_t i = 0; i < wanted.size(); i++) {
+        stacks.push_back(ImageU16L3D(win.width, win.height, win.depth));
+    }
+
+    for (size_t i = 0; i < wanted.size(); i++) {
+        for (size_t d = 0; d < win.depth; d++) {
+            for (size_t y = 0; y < win.height; y++) {
+                size_t row = (win.z + d) * height * channels + wanted[i] * height + win.y + y;
+                pairs.push_back(std::make_pair(static_cast<uint32_t>(row), stacks[i].data[d][y].data()));
+            }
+        }
+    }
+
+    // The strip decoder needs increasing rows, whatever order the channels were asked for in
+    std::sort(pairs.begin(), pairs.end(), [] (auto const &a, auto const &b) { return a.first < b.first; });
+
+    for (auto const &p : pairs) {
+        plan.rows.push_back(p.first);
+        plan.dests.push_back(p.second);
+    }
+
+    return plan;
+}
+
+/**
+ * Split some channels of an AutoStack image, already in memory, into
+ * a stack per channel, cropped to the window. Each row of the window
+ * is one bulk copy.
+ *
+ * @param image - the tall 2D AutoStack image
+ * @param channels - the number of interleaved channels
+ * @param wanted - which channels to extract (0 is the top), in output order
+ * @param stacksize - how many slices in the stack
+ * @param window - the part of the stack to extract
+ *
+ * @return std::vector<ImageU16L3D> - one per wanted channel, the size of the window
+ */
+
+std::vector<ImageU16L3D> DeinterleaveStack(ImageU16L const &image, size_t channels, std::vector<size_t> const &wanted, size_t stacksize, StackWindow const &window) {
+    size_t height = image.height / (stacksize * channels);
+    StackWindow win = window;
+    _ResolveWindow(win, image.width, height, stacksize);
+    std::vector<ImageU16L3D> stacks;
+    _RowPlan plan = _PlanRows(height, channels, wanted, win, stacks);
+
+    for (size_t i = 0; i < plan.rows.size(); i++) {
+        std::memcpy(plan.dests[i], image.data[plan.rows[i]].data() + win.x, win.width * sizeof(uint16_t));
+    }
+
+    return stacks;
+}
+
+/**
+ * Read a whole file into memory, so it can be decoded later
+ * without touching the disk.
+ *
+ * @param tiff_path - the file path to the tiff
+ *
+ * @return TiffBytes
+ */
+
+TiffBytes ReadTiffBytes(std::string const &tiff_path) {
+    std::ifstream file(tiff_path, std::ios::binary | std::ios::ate);
+
+    if (!file) {
+        throw std::runtime_error("Failed to open " + tiff_path);
+    }
+
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    std::shared_ptr<std::vector<char>> bytes = std::make_shared<std::vector<char>>(static_cast<size_t>(size));
+
+    if (!file.read(bytes->data(), size)) {
+        throw std::runtime_error("Failed to read " + tiff_path);
+    }
+
+    return bytes;
+}
+
+// A read position in an in-memory tiff, for TIFFClientOpen
+typedef struct {
+    const std::vector<char> *bytes;
+    toff_t pos;
+} _MemTiff;
+
+tmsize_t _MemTiffRead(thandle_t handle, void *buf, tmsize_t size) {
+    _MemTiff *mem = static_cast<_MemTiff*>(handle);
+    toff_t end = static_cast<toff_t>(mem->bytes->size());
+    tmsize_t n = static_cast<tmsize_t>(std::min(static_cast<toff_t>(size), end - std::min(mem->pos, end)));
+    std::memcpy(buf, mem->bytes->data() + mem->pos, static_cast<size_t>(n));
+    mem->pos += n;
+    return n;
+}
+
+tmsize_t _MemTiffWrite(thandle_t, void*, tmsize_t) {
+    return 0;
+}
+
+toff_t _MemTiffSeek(thandle_t handle, toff_t off, int whence) {
+    _MemTiff *mem = static_cast<_MemTiff*>(handle);
+
+    if (whence == SEEK_CUR) {
+        mem->pos += off;
+    } else if (whence == SEEK_END) {
+        mem->pos = static_cast<toff_t>(mem->bytes->size()) + off;
+    } else {
+        mem->pos = off;
+    }
+
+    return mem->pos;
+}
+
+int _MemTiffClose(thandle_t handle) {
+    delete static_cast<_MemTiff*>(handle);
+    return 0;
+}
+
+toff_t _MemTiffSize(thandle_t handle) {
+    return static_cast<toff_t>(static_cast<_MemTiff*>(handle)->bytes->size());
+}
+
+int _MemTiffMap(thandle_t handle, void **base, toff_t *size) {
+    _MemTiff *mem = static_cast<_MemTiff*>(handle);
+    *base = const_cast<char*>(mem->bytes->data());
+    *size = static_cast<toff_t>(mem->bytes->size());
+    return 1;
+}
+
+void _MemTiffUnmap(thandle_t, void*, toff_t) {}
+
+/**
+ * Open a tiff for reading, from memory if we have the bytes,
+ * otherwise from disk. Throws if it can't be opened.
+ */
+TIFF* _OpenTiff(std::string const &tiff_path, TiffBytes const &bytes) {
+    TIFF *tif = NULL;
+
+    if (bytes) {
+        _MemTiff *mem = new _MemTiff{bytes.get(), 0};
+        // libtiff calls the close proc, freeing mem, even if the open fails
+        tif = TIFFClientOpen(tiff_path.c_str(), "rm", static_cast<thandle_t>(mem), _MemTiffRead, _MemTiffWrite,
+            _MemTiffSeek, _MemTiffClose, _MemTiffSize, _MemTiffMap, _MemTiffUnmap);
+    } else {
+        tif = TIFFOpen(tiff_path.c_str(), "r");
+    }
+
+    if (tif == NULL) {
+        throw std::runtime_error("Failed to open " + tiff_path);
+    }
+
+    return tif;
+}
+
+// What we need to know to decode a tiff strip by strip
+typedef struct {
+    uint32_t width = 0;
+    uint32_t length = 0;
+    uint32_t rows_per_strip = 0;
+    uint32_t pages = 1;
+    std::vector<toff_t> directories;    // Where each page's directory starts
+    bool stripped = false;      // 16 bit, one sample, in strips - we can decode it ourselves
+} _TiffInfo;
+
+_TiffInfo _ReadTiffInfo(std::string const &tiff_path, TiffBytes const &bytes) {
+    TIFF *tif = _OpenTiff(tiff_path, bytes);
+
+    _TiffInfo info;
+    uint16_t bits = 0, samples = 1;
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &info.width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &info.length);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &info.rows_per_strip);
+    info.stripped = !TIFFIsTiled(tif) && bits == 16 && samples == 1;
+
+    // One walk along the directory chain, so any page can be found directly later
+    do {
+        info.directories.push_back(TIFFCurrentDirOffset(tif));
+    } while (TIFFReadDirectory(tif));
+
+    info.pages = static_cast<uint32_t>(info.directories.size());
+
+    if (info.rows_per_strip == 0 || info.rows_per_strip > info.length) {
+        info.rows_per_strip = info.length;
+    }
+
+    TIFFClose(tif);
+    return info;
+}
+
+/**
+ * The width and height of a tiff's first page, without decoding it.
+ *
+ * @param tiff_path - the file path to the tiff
+ * @param bytes - the file already in memory, or null to read from disk
+ * @param width, height - set to the size of the image
+ *
+ * @return bool - false if the tiff can't be opened
+ */
+
+bool TiffSize(std::string const &tiff_path, TiffBytes const &bytes, size_t &width, size_t &height) {
+    try {
+        _TiffInfo info = _ReadTiffInfo(tiff_path, bytes);
+        width = info.width;
+        height = info.length;
+    } catch (const std::exception &e) {
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Copy the rows we want from the current directory of an open handle.
+ * Throws if a strip can't be decoded, leaving the handle open.
+ *
+ * @param rows - the source rows we want, in increasing order
+ * @param dests - where each row goes
+ * @param first, last - the part of rows this call deals with
+ */
+void _CopyRows(TIFF *tif, std::string const &tiff_path, _TiffInfo const &info, std::vector<uint32_t> const &rows,
+        std::vector<uint16_t*> const &dests, size_t first, size_t last, size_t x, size_t width) {
+    std::vector<uint16_t> strip(TIFFStripSize(tif) / sizeof(uint16_t));
+    tstrip_t loaded = static_cast<tstrip_t>(-1);
+
+    // Rows only ever increase, so each strip is decoded at most once
+    for (size_t i = first; i < last; i++) {
+        uint32_t row = rows[i];
+        tstrip_t s = row / info.rows_per_strip;
+
+        if (s != loaded) {
+            if (TIFFReadEncodedStrip(tif, s, strip.data(), -1) < 0) {
+                throw std::runtime_error("Failed to decode " + tiff_path);
+            }
+            loaded = s;
+        }
+
+        size_t offset = static_cast<size_t>(row - s * info.rows_per_strip) * info.width + x;
+        std::memcpy(dests[i], &strip[offset], width * sizeof(uint16_t));
+    }
+}
+
+/**
+ * Decode a run of strips from the first directory, copying the rows
+ * we want. Each call opens its own handle as libtiff handles can't be
+ * shared between threads.
+ */
+void _DecodeRows(std::string const &tiff_path, TiffBytes const &bytes, _TiffInfo const &info, std::vector<uint32_t> const &rows,
+        std::vector<uint16_t*> const &dests, size_t first, size_t last, size_t x, size_t width) {
+    TIFF *tif = _OpenTiff(tiff_path, bytes);
+
+    try {
+        _CopyRows(tif, tiff_path, info, rows, dests, first, last, x, width);
+    } catch (...) {
+        TIFFClose(tif);
+        throw;
+    }
+
+    TIFFClose(tif);
+}
+
+/**
+ * Split the rows into chunks that never share a strip, and decode
+ * the chunks in parallel on the shared pool.
+ */
+void _DecodeRowsParallel(std::string const &tiff_path, TiffBytes const &bytes, _TiffInfo const &info, std::vector<uint32_t> const &rows,
+        std::vector<uint16_t*> const &dests, size_t x, size_t width) {
+    // A few chunks per thread so the faster threads can take up the slack
+    size_t strips = (info.length + info.rows_per_strip - 1) / info.rows_per_strip;
+    size_t num_chunks = std::max(static_cast<size_t>(1), std::min(PoolSize() * 4, strips));
+    size_t strips_per_chunk = (strips + num_chunks - 1) / num_chunks;
+    std::vector<size_t> bounds = {0};
+
+    for (size_t i = 1; i < rows.size(); i++) {
+        size_t chunk = (rows[i] / info.rows_per_strip) / strips_per_chunk;
+        size_t prev = (rows[i - 1] / info.rows_per_strip) / strips_per_chunk;
+
+        if (chunk != prev) {
+            bounds.push_back(i);
+        }
+    }
+
+    bounds.push_back(rows.size());
+
+    ParallelFor(bounds.size() - 1, [&] (size_t c) {
+        _DecodeRows(tiff_path, bytes, info, rows, dests, bounds[c], bounds[c + 1], x, width);
+    });
+}
+
+/**
+ * Load some channels of an AutoStack tiff as 3D stacks, decoding
+ * each strip once however many channels it holds rows for.
+ *
+ * @param tiff_path - the file path to the tiff
+ * @param channels - the number of interleaved channels
+ * @param wanted - which channels to read (0 is the top), in output order
+ * @param stacksize - how many slices in the stack
+ * @param window - the part of the stack to read
+ * @param bytes - the file already in memory, or null to read from disk
+ *
+ * @return std::vector<ImageU16L3D> - one per wanted channel, the size of the window
+ */
+
+std::vector<ImageU16L3D> LoadTiffChannels(std::string const &tiff_path, size_t channels, std::vector<size_t> const &wanted, size_t stacksize,
+        StackWindow const &window, TiffBytes const &bytes) {
+    _TiffInfo info = _ReadTiffInfo(tiff_path, bytes);
+
+    // Tiled, or not 16 bit greyscale - load the lot with imagine instead
+    if (!info.stripped) {
+        return DeinterleaveStack(LoadTiffImage(tiff_path, bytes), channels, wanted, stacksize, window);
+    }
+
+    size_t height = info.length / (stacksize * channels);
+    StackWindow win = window;
+    _ResolveWindow(win, info.width, height, stacksize);
+    std::vector<ImageU16L3D> stacks;
+    _RowPlan plan = _PlanRows(height, channels, wanted, win, stacks);
+    _DecodeRowsParallel(tiff_path, bytes, info, plan.rows, plan.dests, win.x, win.width);
+    return stacks;
+}
+
+/**
+ * Load one channel of an AutoStack tiff as a 3D stack.
+ *
+ * @param tiff_path - the file path to the tiff
+ * @param channels - the number of interleaved channels
+ * @param channel - which channel to read (0 is the top)
+ * @param stacksize - how many slices in the stack
+ * @param window - the part of the stack to read
+ * @param bytes - the file already in memory, or null to read from disk
+ *
+ * @return ImageU16L3D - the size of the window
+ */
+
+ImageU16L3D LoadTiffStack(std::string const &tiff_path, size_t channels, size_t channel, size_t stacksize, StackWindow const &window, TiffBytes const &bytes) {
+    return LoadTiffChannels(tiff_path, channels, {channel}, stacksize, window, bytes)[0];
+}
+
+/**
+ * Load a 16 bit 2D tiff, such as the watershed annotations,
+ * decoding the strips in parallel.
+ *
+ * @param tiff_path - the file path to the tiff
+ * @param bytes - the file already in memory, or null to read from disk
+ *
+ * @return ImageU16L
+ */
+
+ImageU16L LoadTiffImage(std::string const &tiff_path, TiffBytes const &bytes) {
+    _TiffInfo info = _ReadTiffInfo(tiff_path, bytes);
+
+    if (!info.stripped) {
+        return LoadTiff<ImageU16L>(tiff_path);
+    }
+
+    ImageU16L image(info.width, info.length);
+    std::vector<uint32_t> rows;
+    std::vector<uint16_t*> dests;
+
+    for (uint32_t y = 0; y < info.length; y++) {
+        rows.push_back(y);
+        dests.push_back(image.data[y].data());
+    }
+
+    _DecodeRowsParallel(tiff_path, bytes, info, rows, dests, 0, info.width);
+    return image;
+}
+
+/**
+ * Load a 16 bit multi-page tiff as a volume, one slice per page,
+ * decoding the pages in parallel.
+ *
+ * @param tiff_path - the file path to the tiff
+ *
+ * @return ImageU16L3D
+ */
+
+ImageU16L3D LoadTiffVolume(std::string const &tiff_path) {
+    _TiffInfo info = _ReadTiffInfo(tiff_path, nullptr);
+
+    if (!info.stripped) {
+        return LoadTiff<ImageU16L3D>(tiff_path);
+    }
+
+    ImageU16L3D volume(info.width, info.length, info.pages);
+    std::vector<uint32_t> rows;
+
+    for (uint32_t y = 0; y < info.length; y++) {
+        rows.push_back(y);
+    }
+
+    // Each thread takes a run of pages, jumping to the first by its offset
+    // and stepping along the chain from there
+    size_t runs = std::max(static_cast<size_t>(1), std::min(static_cast<size_t>(info.pages), PoolSize()));
+
+    ParallelFor(runs, [&] (size_t r) {
+        size_t first = r * info.pages / runs;
+        size_t last = (r + 1) * info.pages / runs;
+        TIFF *tif = _OpenTiff(tiff_path, nullptr);
+
+        try {
+            for (size_t page = first; page < last; page++) {
+                bool found = page == first ? (page == 0 || TIFFSetSubDirectory(tif, info.directories[page])) : TIFFReadDirectory(tif);
+
+                if (!found) {
+                    throw std::runtime_error("Failed to find page " + libcee::ToString(page) + " in " + tiff_path);
+                }
+
+                std::vector<uint16_t*> dests;
+
+                for (uint32_t y = 0; y < info.length; y++) {
+                    dests.push_back(volume.data[page][y].data());
+                }
+
+                _CopyRows(tif, tiff_path, info, rows, dests, 0, rows.size(), 0, info.width);
+            }
+        } catch (...) {
+            TIFFClose(tif);
+            throw;
+        }
+
+        TIFFClose(tif);
+    });
+
+    return volume;
+}
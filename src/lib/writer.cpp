@@ -0,0 +1,265 @@
+/**
+ * ▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄▄
+ * █░███░██▄██░▄▄▄█░▄▄▄█░██░▄▄
+ * █▄▀░▀▄██░▄█░█▄▀█░█▄▀█░██░▄▄
+ * ██▄█▄██▄▄▄█▄▄▄▄█▄▄▄▄█▄▄█▄▄▄
+ * ▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀▀
+ * @file writer.cpp
+ * @author Benjamin Blundell - k1803390@kcl.ac.uk
+ * @date 19/10/2026
+ * @brief A single writer thread fed by a bounded queue.
+ *
+ * Every file is written to a temporary name and renamed into place
+ * once complete. The queue only blocks the compute threads if the
+ * disk can't keep up at all.
+ */
+
+#include "writer.hpp"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+using namespace imagine;
+
+static size_t WRITER_DEPTH = 8;
+
+/**
+ * Write bytes into a file at an offset, creating it if needs be.
+ * Used for the fixed records in shard files.
+ */
+void _WriteAt(std::string const &path, long long offset, std::vector<char> const &bytes) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open " + path + ": " + std::strerror(errno));
+    }
+
+    size_t written = 0;
+
+    while (written < bytes.size()) {
+        ssize_t n = pwrite(fd, bytes.data() + written, bytes.size() - written, static_cast<off_t>(offset + written));
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            std::string err = std::strerror(errno);
+            close(fd);
+            throw std::runtime_error("Failed to write " + path + ": " + err);
+        }
+
+        written += static_cast<size_t>(n);
+    }
+
+    close(fd);
+}
+
+/**
+ * Report a job's failure to a group, if it has one.
+ */
+
+void TrackWrite(WriteJob &job, std::shared_ptr<WriteGroup> const &group) {
+    if (group) {
+        job.done = [group] (bool ok) {
+            if (!ok) {
+                group->failed += 1;
+            }
+        };
+    }
+}
+
+/**
+ * Queue a file for writing, starting the writer thread if needs be.
+ *
+ * @param job - the file to write
+ */
+
+void Writer::Write(WriteJob job) {
+    bool own_thread = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        own_thread = std::this_thread::get_id() == _thread_id;
+
+        if (!own_thread && !_thread.joinable()) {
+            _thread = std::thread(&Writer::_Run, this);
+        }
+    }
+
+    // A done callback may queue more, and the writer can't wait on its own queue
+    if (own_thread) {
+        _WriteOne(job);
+        return;
+    }
+
+    // Only fails if we are part way through a Finish, so just write it here
+    if (!_queue.Push(job)) {
+        _WriteOne(job);
+        return;
+    }
+
+    size_t queued = _queue.Size();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stats.max_queued = std::max(_stats.max_queued, queued);
+}
+
+void Writer::_Run() {
+    WriteJob job;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _thread_id = std::this_thread::get_id();
+    }
+
+#ifdef __linux__
+    // On Linux, nice applies to just this thread
+    if (_background) {
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+    }
+#endif
+
+    while (_queue.Pop(job)) {
+        _WriteOne(job);
+    }
+}
+
+void Writer::_WriteOne(WriteJob const &job) {
+    if (!job.bytes && !job.save) {
+        if (job.done) {
+            job.done(true);
+        }
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t written = 0;
+    bool ok = true;
+
+    try {
+        if (job.bytes && job.offset >= 0) {
+            _WriteAt(job.path, job.offset, *job.bytes);
+            written = job.bytes->size();
+        } else if (job.bytes) {
+            WriteFileAtomic(job.path, *job.bytes);
+            written = job.bytes->size();
+        } else {
+            std::string tmp_path = job.path + ".tmp";
+            job.save(tmp_path);
+            struct stat st;
+
+            if (stat(tmp_path.c_str(), &st) == 0) {
+                written = static_cast<size_t>(st.st_size);
+            }
+
+            if (std::rename(tmp_path.c_str(), job.path.c_str()) != 0) {
+                std::remove(tmp_path.c_str());
+                throw std::runtime_error("Failed to move " + tmp_path + " to " + job.path);
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Failed to write " << job.path << ": " << e.what() << std::endl;
+        ok = false;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.seconds += elapsed.count();
+
+        if (ok) {
+            _stats.files += 1;
+            _stats.bytes += written;
+        } else {
+            _stats.failed += 1;
+        }
+    }
+
+    if (job.done) {
+        job.done(ok);
+    }
+}
+
+/**
+ * Wait for everything queued to be written, then report. The writer
+ * starts again if more is queued afterwards.
+ */
+
+void Writer::Finish() {
+    std::thread thread;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_thread.joinable()) {
+            return;
+        }
+
+        thread = std::move(_thread);
+    }
+
+    _queue.Close();
+    thread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _thread_id = std::thread::id();
+    }
+
+    _queue.Reopen();
+    Report();
+}
+
+WriterStats Writer::Stats() {
+    size_t queued = _queue.Size();
+    std::lock_guard<std::mutex> lock(_mutex);
+    WriterStats stats = _stats;
+    stats.queued = queued;
+    stats.capacity = _queue.Capacity();
+    return stats;
+}
+
+void Writer::Report() {
+    WriterStats stats = Stats();
+    double mb = static_cast<double>(stats.bytes) / (1024.0 * 1024.0);
+    double rate = stats.seconds > 0 ? mb / stats.seconds : 0;
+    std::cout << "Writer: " << stats.files << " files, " << mb << " MB, " << rate << " MB/s, queue "
+        << stats.queued << "/" << stats.capacity << " (max " << stats.max_queued << ")";
+
+    if (stats.failed > 0) {
+        std::cout << ", " << stats.failed << " failed";
+    }
+
+    std::cout << std::endl;
+}
+
+/**
+ * Set how many files can wait in the shared writer's queue. Only
+ * has an effect before the writer is first used.
+ */
+void SetWriterDepth(size_t depth) {
+    WRITER_DEPTH = depth;
+}
+
+Writer &SharedWriter() {
+    static Writer writer{ WRITER_DEPTH };
+    return writer;
+}
+
+/**
+ * The writer for previews. Low priority, with a deeper queue so
+ * the compute threads rarely wait on it.
+ */
+Writer &SharedPreviewWriter() {
+    static Writer writer{ WRITER_DEPTH * 4, true };
+    return writer;
+}
@@ -31,6 +31,7 @@
 #include "rots.hpp"
 #include "pipe.hpp"
 #include "options.hpp"
+#include "sparse.hpp"
 
 using namespace imagine;
 
@@ -41,45 +42,23 @@ bool folder_exists(std::string foldername)  {
 }
 
 bool StackMask(Options &options, std::string &tiff_path, std::string &log_path, std::string &coord_path) {
-    ImageU16L image_in = LoadTiff<ImageU16L>(tiff_path);
-    std::vector<std::vector<size_t>> neurons; // 0: None, 1: ASI-1, 2: ASI-2, 3: ASJ-1, 4: ASJ-2
-    size_t idx = 0;
-
+    ImageU16L image_in = LoadTiffImage(tiff_path);
     // Read the log file and extract the neuron numbers
     // Making the asssumption that all log files have the neurons in the same order
-    for (int i = 0; i < 5; i++) {
-        neurons.push_back(std::vector<size_t>());
-    }
-
-    std::vector<std::string> lines_log = libcee::ReadFileLines(log_path);
-
-    for (std::string line : lines_log) {
-        std::vector<std::string> tokens = libcee::SplitStringWhitespace(line);
-        if (libcee::ToLower(tokens[0]) == "associate") {
-            idx += 1;
-        } else {
-            neurons[idx].push_back(libcee::FromString<size_t>(tokens[0]));
-        }
-    }
+    std::vector<std::vector<size_t>> neurons = ParseNeuronLog(libcee::ReadFileLines(log_path)); // 0: None, 1: ASI-1, 2: ASI-2, 3: ASJ-1, 4: ASJ-2
 
     // Join all our neurons
     ImageU8L3D neuron_mask(image_in.width, image_in.height / options.stacksize, options.stacksize);
 
-    bool n1 = false, n2 = false, n3 = false, n4 = false;
+    std::vector<uint8_t> ids_to_write = {0, 1, 2, 3, 4};
 
-    if(options.threeclass){
-      n1 = SetNeuron(image_in, neuron_mask, neurons, 1, true, true, 1);
-      n2 = SetNeuron(image_in, neuron_mask, neurons, 2, true, true, 1);
-      n3 = SetNeuron(image_in, neuron_mask, neurons, 3, true, true, 2);
-      n4 = SetNeuron(image_in, neuron_mask, neurons, 4, true, true, 2);
-    } else {
-      n1 = SetNeuron(image_in, neuron_mask, neurons, 1, true, true, 1);
-      n2 = SetNeuron(image_in, neuron_mask, neurons, 2, true, true, 2);
-      n3 = SetNeuron(image_in, neuron_mask, neurons, 3, true, true, 3);
-      n4 = SetNeuron(image_in, neuron_mask, neurons, 4, true, true, 4);
+    if (options.threeclass) {
+        ids_to_write = {0, 1, 1, 2, 2};
     }
+
+    std::vector<bool> found = SetNeurons(image_in, neuron_mask, NeuronLUT(neurons), ids_to_write, true, true);
     
-    if (!n1 || !n2 || !n3 || !n4) {
+    if (!found[1] || !found[2] || !found[3] || !found[4]) {
         return false;
     }
 
@@ -98,19 +77,22 @@ bool StackMask(Options &options, std::string &tiff_path, std::string &log_path,
     std::cout << "Saving new mask to " << output_path << std::endl;
     
     if (options.final_width != neuron_mask.width || options.final_height != neuron_mask.height || options.final_depth != neuron_mask.depth) {
-        if (neuron_mask.depth % 2 == 1) {
-            neuron_mask.data.pop_back();
+        SparseLabel3D sparse_mask = ToSparse(neuron_mask);
+
+        if (sparse_mask.depth % 2 == 1) {
+            sparse_mask = CropSparse(sparse_mask, 0, 0, 0, sparse_mask.width, sparse_mask.height, sparse_mask.depth - 1);
         }
-        ImageU8L3D resized = Resize(neuron_mask, options.final_width, options.final_height, options.final_depth);
+
+        ImageU8L3D resized = Densify(ResizeLabels(sparse_mask, options.final_width, options.final_height, options.final_depth));
         try {
-            SaveFITS(output_path, resized);
+            WriteFileAtomic(output_path, EncodeFITS(resized, options.fits));
         } catch (std::exception& exc) {
             std::cout << "Failed to save " << output_path << std::endl;
         }
 
     } else {
         try {
-            SaveFITS(output_path, neuron_mask);   
+            WriteFileAtomic(output_path, EncodeFITS(neuron_mask, options.fits));   
         } catch (std::exception& exc) {
             std::cout << "Failed to save " << output_path << std::endl;
         }
@@ -127,6 +109,9 @@ int main (int argc, char ** argv) {
     static struct option long_options[] = {
         {"no-interz", no_argument, NULL, 1},
         {"no-subpixel", no_argument, NULL, 2},
+        {"compress", no_argument, NULL, 9},
+        {"quantize", required_argument, NULL, 10},
+        {"tile", required_argument, NULL, 11},
         {NULL, 0, NULL, 0}
     };
 
@@ -152,6 +137,18 @@ int main (int argc, char ** argv) {
             case 'l' :
                 options.base_path = std::string(optarg);
                 break;
+            case 9 :
+                options.fits.compress = true;
+                break;
+            case 10 :
+                options.fits.quantize = libcee::FromString<float>(optarg);
+                break;
+            case 11 :
+                if (!ParseTile(std::string(optarg), options.fits)) {
+                    std::cout << "Tile size should be of the form 64x64x1." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
         }
     }
 
@@ -162,42 +159,20 @@ int main (int argc, char ** argv) {
 
     std::cout << "Loading annotation images from " << options.annotation_path << std::endl;
  
-    // First, find and sort the annotation files
-    std::vector<std::string> tiff_anno_files = FindAnnotations(options.annotation_path);
-
-    // Next, find the annotation dat files
-    std::vector<std::string> dat_files = FindDatFiles(options.annotation_path);
+    // Find the annotations, logs and dats in one scan of the directory
+    DataIndex index = IndexData(options.annotation_path, "");
 
-    // Next, find the annotation log files
-    std::vector<std::string> log_files = FindLogFiles(options.annotation_path);
+    // Pair up the tiffs with their log and dat files and process them.
+    std::vector<std::string> unpaired, unused;
+    std::vector<Pair> pairs = PairData(index, false, unpaired, unused);
+    ReportUnmatched(unpaired, unused);
 
- 
-
-    // Pair up the tiffs with their log file and then the input and process them.
-    for (std::string tiff_anno : tiff_anno_files) {
-        std::vector<std::string> tokens = libcee::SplitStringChars(libcee::FilenameFromPath(tiff_anno), "_.-");
-        std::string id = tokens[0];
-
-        for (std::string log : log_files) {
-            std::vector<std::string> tokens_log = libcee::SplitStringChars(libcee::FilenameFromPath(log), "_.-");
-            if (tokens_log[0] == id) {
-
-                for (std::string dat : dat_files) {
-                    std::vector<std::string> tokens_dat = libcee::SplitStringChars(libcee::FilenameFromPath(dat), "_.-");
-                    
-                    if (tokens_dat[0] == id) {
-                        
-                        try {
-                            std::cout << "Masking: " << dat << std::endl;
-                            StackMask(options, tiff_anno, log, dat);
-                        
-                        } catch (const std::exception &e) {
-                            std::cout << "An exception occured with" << tiff_anno << std::endl;
-                        }
-                    }
-                    
-                }
-            }
+    for (Pair pair : pairs) {
+        try {
+            std::cout << "Masking: " << pair.dat << std::endl;
+            StackMask(options, pair.anno, pair.log, pair.dat);
+        } catch (const std::exception &e) {
+            std::cout << "An exception occured with" << pair.anno << std::endl;
         }
     }
 
@@ -37,6 +37,15 @@ int main (int argc, char ** argv) {
         {"no-subpixel", no_argument, NULL, 2},
         {"no-roi", no_argument, NULL, 3},
         {"no-process", no_argument, NULL, 4},
+        {"brick", required_argument, NULL, 5},
+        {"threads", required_argument, NULL, 6},
+        {"write-queue", required_argument, NULL, 8},
+        {"compress", no_argument, NULL, 9},
+        {"quantize", required_argument, NULL, 10},
+        {"tile", required_argument, NULL, 11},
+        {"precision", required_argument, NULL, 13},
+        {"preview-scale", required_argument, NULL, 14},
+        {"montage", no_argument, NULL, 15},
         {NULL, 0, NULL, 0}
     };
 
@@ -128,6 +137,47 @@ int main (int argc, char ** argv) {
             case 4 :
                 options.noprocess = true;
                 break;
+            case 5 :
+                options.bricked = true;
+                options.brick_dim = libcee::FromString<size_t>(optarg);
+
+                if (options.brick_dim != 4 && options.brick_dim != 8) {
+                    std::cout << "Brick size must be 4 or 8. Using 8." << std::endl;
+                    options.brick_dim = 8;
+                }
+                break;
+            case 6 :
+                options.threads = std::max(0, libcee::FromString<int>(optarg));
+                SetPoolSize(static_cast<size_t>(options.threads));
+                break;
+            case 8 :
+                options.write_queue = std::max(1, libcee::FromString<int>(optarg));
+                SetWriterDepth(options.write_queue);
+                break;
+            case 9 :
+                options.fits.compress = true;
+                break;
+            case 10 :
+                options.fits.quantize = libcee::FromString<float>(optarg);
+                break;
+            case 11 :
+                if (!ParseTile(std::string(optarg), options.fits)) {
+                    std::cout << "Tile size should be of the form 64x64x1." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 13 :
+                if (!ParsePrecision(std::string(optarg), options.precision)) {
+                    std::cout << "Precision should be one of f32, f16 or u16." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 14 :
+                options.preview_scale = libcee::FromString<size_t>(optarg);
+                break;
+            case 15 :
+                options.montage = true;
+                break;
         }
     }
 
@@ -138,6 +188,13 @@ int main (int argc, char ** argv) {
     
     ProcessMask(options, watershed_path, annotation_path, coord_path, 0, master_t, trans);
     TiffToFits(options, master_t, trans, image_path, 0);
+    SharedWriter().Finish();
+    SharedPreviewSheets().Finish();
+    SharedPreviewWriter().Finish();
+
+    if (SharedWriter().Stats().failed > 0) {
+        return EXIT_FAILURE;
+    }
  
     return EXIT_SUCCESS;
 
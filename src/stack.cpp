@@ -23,6 +23,8 @@
 #include "image.hpp"
 #include "data.hpp"
 #include "rots.hpp"
+#include "tiffstack.hpp"
+#include "fits.hpp"
 
 // Our command line options, held in a struct.
 typedef struct {
@@ -41,6 +43,7 @@ typedef struct {
     int final_depth = 51;             // number of z-slices - TODO - should be set automatically along with width and height
     int final_width = 640;            // The input dimensions of each slice
     int final_height = 300;
+    FitsCompression fits;       // Tile compression for the FITS outputs
 
 } Options;
 
@@ -64,22 +67,8 @@ bool folder_exists(std::string foldername)  {
  */
 
 bool StackTiff(Options &options, std::string &tiff_path) {
-    ImageU16L image = LoadTiff<ImageU16L>(tiff_path); 
-    ImageU16L3D stacked(image.width, (image.height / (options.stacksize * options.channels)), options.stacksize);
-    uint coff = 0;
-
-    if (options.bottom) {
-        coff = stacked.height;
-    }
-
-    for (uint32_t d = 0; d < stacked.depth; d++) {
-        for (uint32_t y = 0; y < stacked.height; y++) {
-            for (uint32_t x = 0; x < stacked.width; x++) {
-                uint16_t val = image.data[(d * stacked.height * options.channels) + coff + y][x];
-                stacked.data[d][y][x] = val;
-            }
-        }
-    }
+    size_t channel = options.bottom ? 1 : 0;
+    ImageU16L3D stacked = LoadTiffStack(tiff_path, options.channels, channel, options.stacksize, StackWindow());
 
     std::vector<std::string> end = libcee::SplitStringString(tiff_path, options.output_path);
     std::string new_path =   tiff_path.replace(0, options.base_path.length(), options.output_path);
@@ -100,14 +89,14 @@ bool StackTiff(Options &options, std::string &tiff_path) {
         }
         ImageU16L3D resized = Resize(stacked, options.final_width, options.final_height, options.final_depth);
         try {
-            SaveFITS(output_path, resized);
+            WriteFileAtomic(output_path, EncodeFITS(resized, options.fits));
         } catch (std::exception& exc) {
             std::cout << "Failed to save " << output_path << std::endl;
         }
 
     } else {
         try {
-            SaveFITS(output_path, stacked);   
+            WriteFileAtomic(output_path, EncodeFITS(stacked, options.fits));   
         } catch (std::exception& exc) {
             std::cout << "Failed to save " << output_path << std::endl;
         }
@@ -126,6 +115,9 @@ int main (int argc, char ** argv) {
         {"image-path", 1, 0, 0},
         {"output-path", 1, 0, 0},
         {"prefix", 1, 0, 0},
+        {"compress", no_argument, NULL, 9},
+        {"quantize", required_argument, NULL, 10},
+        {"tile", required_argument, NULL, 11},
         {NULL, 0, NULL, 0}
     };
 
@@ -163,6 +155,18 @@ int main (int argc, char ** argv) {
             case 's':
                 options.stacksize = libcee::FromString<int>(optarg);
                 break;
+            case 9 :
+                options.fits.compress = true;
+                break;
+            case 10 :
+                options.fits.quantize = libcee::FromString<float>(optarg);
+                break;
+            case 11 :
+                if (!ParseTile(std::string(optarg), options.fits)) {
+                    std::cout << "Tile size should be of the form 64x64x1." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
         }
     }
 
@@ -0,0 +1,50 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "rots.hpp"
+
+using namespace imagine;
+
+TEST_CASE("Testing bricked layout") {
+    // Odd sizes so the last bricks are only partly filled
+    ImageU16L3D image(37, 21, 11);
+
+    for (size_t z = 0; z < image.depth; z++) {
+        for (size_t y = 0; y < image.height; y++) {
+            for (size_t x = 0; x < image.width; x++) {
+                image.data[z][y][x] = static_cast<uint16_t>(x + y * 37 + z * 37 * 21);
+            }
+        }
+    }
+
+    for (size_t brick_dim : {4, 8}) {
+        BrickedVolume<uint16_t> bricked = ToBricked(image, brick_dim);
+        CHECK(bricked.data.size() % (brick_dim * brick_dim * brick_dim) == 0);
+        CHECK(bricked.Get(36, 20, 10) == image.data[10][20][36]);
+        CHECK(bricked.Get(5, 3, 2) == image.data[2][3][5]);
+
+        ImageU16L3D back = FromBricked<ImageU16L3D>(bricked);
+        CHECK(back.data == image.data);
+    }
+}
+
+TEST_CASE("Testing bricked Augment matches row-major") {
+    ImageF32L3D image(48, 48, 10);
+
+    for (size_t z = 0; z < image.depth; z++) {
+        for (size_t y = 0; y < image.height; y++) {
+            for (size_t x = 0; x < image.width; x++) {
+                image.data[z][y][x] = static_cast<float>((x * 7 + y * 3 + z * 11) % 17);
+            }
+        }
+    }
+
+    glm::quat q(1.0, 0, 0, 0);
+    q = glm::rotate(q, 0.6f, glm::vec3(0.0, 1.0, 0.0));
+    q = glm::rotate(q, 0.3f, glm::vec3(1.0, 0.0, 0.0));
+
+    for (bool subpixel : {true, false}) {
+        ImageF32L3D rows = Augment(image, q, 32, 6.2f, subpixel, true);
+        ImageF32L3D bricks = AugmentBricked(image, q, 32, 6.2f, subpixel, true, 4);
+        CHECK(rows.data == bricks.data);
+    }
+}
@@ -0,0 +1,151 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "budget.hpp"
+#include "pool.hpp"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+TEST_CASE("Testing memory estimates") {
+    Options options;
+    options.num_augs = 4;
+    PairMemory small = EstimatePairMemory(options, 640, 300);
+    PairMemory large = EstimatePairMemory(options, 2048, 2048);
+    CHECK(small.base > 0);
+    CHECK(small.per_aug > 0);
+    CHECK(large.base > small.base);
+
+    options.deconv = true;
+    CHECK(EstimatePairMemory(options, 640, 300).base > small.base);
+
+    options.deconv = false;
+    options.noroi = true;
+    CHECK(EstimatePairMemory(options, 2048, 2048).per_aug > large.per_aug);
+}
+
+TEST_CASE("Testing byte sizes") {
+    size_t bytes = 0;
+    CHECK(ParseBytes("4096", bytes));
+    CHECK(bytes == 4096);
+    CHECK(ParseBytes("512M", bytes));
+    CHECK(bytes == 512ul * 1024 * 1024);
+    CHECK(ParseBytes("2G", bytes));
+    CHECK(bytes == 2ul * 1024 * 1024 * 1024);
+    CHECK(!ParseBytes("lots", bytes));
+    CHECK(!ParseBytes("12Q", bytes));
+}
+
+TEST_CASE("Testing admission") {
+    PairMemory pair;
+    pair.base = 100;
+    pair.per_aug = 10;
+
+    // No budget - everything at full width
+    MemoryBudget unlimited;
+    CHECK(unlimited.Admit(pair, 8).augs == 8);
+
+    MemoryBudget budget;
+    budget.SetBudget(1ul << 40);
+    BudgetGrant grant = budget.Admit(pair, 8);
+    CHECK(grant.augs == 8);
+    CHECK(grant.charged == 180);
+    budget.Release(grant);
+    CHECK(budget.InUse() == 0);
+
+    // Fewer augmentations at once before refusing
+    MemoryBudget tight;
+    tight.SetBudget(350);
+    BudgetGrant first = tight.Admit(pair, 8);
+    BudgetGrant second = tight.Admit(pair, 8);
+    CHECK(first.augs == 8);
+    CHECK(second.augs == 7);
+    tight.Release(first);
+    tight.Release(second);
+    CHECK(tight.InUse() == 0);
+
+    // Too big on its own, but runs when nothing else is
+    MemoryBudget small;
+    small.SetBudget(50);
+    BudgetGrant alone = small.Admit(pair, 4);
+    CHECK(alone.augs == 1);
+    small.Release(alone);
+
+    // Waiting pairs go once the others release
+    MemoryBudget shared;
+    shared.SetBudget(150);
+    std::atomic<size_t> running{0}, most{0};
+
+    ParallelFor(8, [&] (size_t) {
+        BudgetGrant granted = shared.Admit(pair, 2);
+        size_t now = running.fetch_add(1) + 1;
+        size_t seen = most.load();
+
+        while (now > seen && !most.compare_exchange_weak(seen, now)) {}
+
+        running.fetch_sub(1);
+        shared.Release(granted);
+    });
+
+    CHECK(most.load() == 1);
+    CHECK(CurrentRSS() > 0);
+    CHECK(PeakRSS() >= CurrentRSS() / 2);
+}
+
+TEST_CASE("Testing files read ahead are charged") {
+    PairMemory pair;
+    pair.base = 100;
+    pair.per_aug = 10;
+
+    MemoryBudget budget;
+    budget.SetBudget(250);
+    BudgetGrant files = budget.Reserve(60);
+    CHECK(files.charged == 60);
+    CHECK(budget.InUse() == 60);
+
+    // The pair's charge takes the place of its files
+    BudgetGrant grant = budget.Admit(pair, 8, files);
+    CHECK(grant.augs == 8);
+    CHECK(budget.InUse() == 180);
+
+    // Files for the next pair wait until there is room
+    std::atomic<bool> reserved{false};
+    std::thread loader([&] () {
+        BudgetGrant next = budget.Reserve(100);
+        reserved = true;
+        BudgetGrant next_pair = budget.Admit(pair, 1, next);
+        budget.Release(next_pair);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(!reserved);
+    budget.Release(grant);
+    loader.join();
+    CHECK(reserved);
+    CHECK(budget.InUse() == 0);
+    CHECK(FileBytes("./no_such_file") == 0);
+}
+
+TEST_CASE("Testing release after the scale goes up") {
+    PairMemory pair;
+    pair.base = 100;
+    pair.per_aug = 0;
+
+    MemoryBudget budget;
+    budget.SetBudget(1000);
+    BudgetGrant before = budget.Admit(pair, 1);
+    CHECK(before.charged == 100);
+
+    // Far more resident than estimated, so the next pair is charged more
+    std::vector<char> held(256ul << 20, 1);
+    BudgetGrant after = budget.Admit(pair, 1);
+    CHECK(after.charged > before.charged);
+    CHECK(budget.InUse() == before.charged + after.charged);
+
+    // Each release gives back what that pair was charged, no more
+    budget.Release(before);
+    CHECK(budget.InUse() == after.charged);
+    budget.Release(after);
+    CHECK(budget.InUse() == 0);
+    CHECK(held.back() == 1);
+}
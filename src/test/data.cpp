@@ -0,0 +1,109 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "data.hpp"
+#include <sys/stat.h>
+#include <fstream>
+
+void Touch(std::string const &path) {
+    std::ofstream file(path);
+}
+
+TEST_CASE("Testing pairing by ID") {
+    std::string anno("./test_data_anno");
+    std::string input("./test_data_input");
+    mkdir(anno.c_str(), 0755);
+    mkdir(input.c_str(), 0755);
+
+    std::vector<std::string> files = {
+        anno + "/ID12_WS_layers.tif", anno + "/ID12_2.log", anno + "/ID12_2.dat",
+        anno + "/ID3_WS_layers.tif", anno + "/ID3_2.log", anno + "/ID3_2.dat",
+        anno + "/ID7_WS_layers.tif", anno + "/ID7_2.log",
+        anno + "/ID9_2.dat",
+        input + "/mCherry_0xAutoStack12.tif", input + "/mCherry_0xAutoStack3.tif", input + "/mCherry_0xAutoStack44.tif"
+    };
+
+    for (std::string const &f : files) {
+        Touch(f);
+    }
+
+    DataIndex index = IndexData(anno, input);
+    CHECK(index.annotations.size() == 3);
+
+    std::vector<std::string> unpaired, unused;
+    std::vector<Pair> pairs = PairData(index, true, unpaired, unused);
+
+    // Sorted by ID number, not by name
+    REQUIRE(pairs.size() == 2);
+    CHECK(pairs[0].anno == anno + "/ID3_WS_layers.tif");
+    CHECK(pairs[0].log == anno + "/ID3_2.log");
+    CHECK(pairs[0].input == input + "/mCherry_0xAutoStack3.tif");
+    CHECK(pairs[1].dat == anno + "/ID12_2.dat");
+    CHECK(pairs[1].input == input + "/mCherry_0xAutoStack12.tif");
+
+    // ID7 has no dat, and ID9 and stack 44 have no annotation
+    CHECK(unpaired == std::vector<std::string>({anno + "/ID7_WS_layers.tif"}));
+    CHECK(unused == std::vector<std::string>({anno + "/ID7_2.log", anno + "/ID9_2.dat", input + "/mCherry_0xAutoStack44.tif"}));
+
+    // Without inputs, only the annotation directory counts
+    unpaired.clear();
+    unused.clear();
+    pairs = PairData(IndexData(anno, ""), false, unpaired, unused);
+    CHECK(pairs.size() == 2);
+    CHECK(pairs[0].input.empty());
+
+    for (std::string const &f : files) {
+        std::remove(f.c_str());
+    }
+}
+
+TEST_CASE("Testing manifests") {
+    std::string path("./test_manifest.txt");
+
+    {
+        std::ofstream file(path);
+        file << "# image, annotation" << std::endl;
+        file << "/data/mcherry_1, /data/anno_1" << std::endl;
+        file << std::endl;
+        file << "mcherry_2\tanno_2" << std::endl;
+    }
+
+    std::vector<Acquisition> acquisitions = ReadManifest(path);
+    REQUIRE(acquisitions.size() == 2);
+    CHECK(acquisitions[0].image_path == "/data/mcherry_1");
+    CHECK(acquisitions[0].annotation_path == "/data/anno_1");
+    CHECK(acquisitions[1].image_path == "./mcherry_2");
+    CHECK(acquisitions[1].annotation_path == "./anno_2");
+
+    {
+        std::ofstream file(path);
+        file << "just_one_dir" << std::endl;
+    }
+
+    CHECK_THROWS(ReadManifest(path));
+    CHECK_THROWS(ReadManifest("./no_such_manifest.txt"));
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Testing .dat parsing") {
+    std::vector<std::string> lines = {
+        "ASI-1, 51234, 310, [127, 402, 22], 1204, 280, 96",
+        "ASI-2, 48710, 305, [131, 388, 24], 1150, 276, 88",
+        "",
+        "ASJ-1, 60012, 298, [140, 420, 19], 1302, 270, 104",
+        "ASJ-2, 57001, 301, [142, 415, 21], 1288, 272, 99"
+    };
+
+    std::vector<NeuronRecord> records = ParseNeuronDat(lines);
+    REQUIRE(records.size() == 4);
+    CHECK(records[0].name == "ASI-1");
+    CHECK(records[0].fl == "51234");
+    CHECK(records[0].bg == "310");
+    CHECK(records[0].y == "127");
+    CHECK(records[0].x == "402");
+    CHECK(records[0].z == "22");
+    CHECK(records[0].mode_fl == "1204");
+    CHECK(records[0].min_fl == "280");
+    CHECK(records[0].rsize == "96");
+    CHECK(records[2].name == "ASJ-1");
+    CHECK(records[3].rsize == "99");
+}
@@ -0,0 +1,163 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "fits.hpp"
+#include "writer.hpp"
+#include <fstream>
+
+using namespace imagine;
+
+// Read back the image with cfitsio, x fastest
+template<typename V>
+std::vector<V> ReadBack(std::string const &path, int datatype, std::vector<long> &naxes) {
+    fitsfile *fptr = NULL;
+    int status = 0, bitpix = 0, naxis = 0, anynul = 0;
+    long dims[3] = {1, 1, 1};
+    fits_open_image(&fptr, path.c_str(), READONLY, &status);
+    fits_get_img_param(fptr, 3, &bitpix, &naxis, dims, &status);
+    naxes.assign(dims, dims + naxis);
+    std::vector<V> pixels(dims[0] * dims[1] * dims[2]);
+    long fpix[3] = {1, 1, 1};
+    fits_read_pix(fptr, datatype, fpix, static_cast<LONGLONG>(pixels.size()), NULL, pixels.data(), &anynul, &status);
+    fits_close_file(fptr, &status);
+    CHECK(status == 0);
+    return pixels;
+}
+
+TEST_CASE("Testing FITS encoding and atomic writes") {
+    ImageF32L3D image(7, 5, 3);
+
+    for (size_t z = 0; z < image.depth; z++) {
+        for (size_t y = 0; y < image.height; y++) {
+            for (size_t x = 0; x < image.width; x++) {
+                image.data[z][y][x] = static_cast<float>(x) + static_cast<float>(y) * 10.0f + static_cast<float>(z) * 100.0f;
+            }
+        }
+    }
+
+    std::string path("./test_fits.fits");
+    std::vector<char> bytes = EncodeFITS(image);
+    CHECK(bytes.size() % 2880 == 0);
+    WriteFileAtomic(path, bytes);
+
+    std::vector<long> naxes;
+    std::vector<float> pixels = ReadBack<float>(path, TFLOAT, naxes);
+    CHECK(naxes == std::vector<long>({7, 5, 3}));
+    CHECK(pixels[0] == 0.0f);
+    CHECK(pixels[1] == 1.0f);
+    CHECK(pixels[7] == 10.0f);
+    CHECK(pixels[7 * 5 * 2 + 7 * 4 + 6] == 246.0f);
+
+    // No temporary file left behind
+    std::ifstream tmp(path + ".tmp");
+    CHECK(!tmp.good());
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Testing the background writer") {
+    ImageU8L mask(9, 4);
+    mask.data[2][3] = 4;
+    std::string path("./test_writer.fits");
+    QueueFITS(path, mask);
+    SharedWriter().Finish();
+
+    WriterStats stats = SharedWriter().Stats();
+    CHECK(stats.files == 1);
+    CHECK(stats.failed == 0);
+
+    std::vector<long> naxes;
+    std::vector<uint8_t> pixels = ReadBack<uint8_t>(path, TBYTE, naxes);
+    CHECK(naxes == std::vector<long>({9, 4}));
+    CHECK(pixels[2 * 9 + 3] == 4);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Testing writer failures are reported") {
+    WriterStats before = SharedWriter().Stats();
+    std::shared_ptr<WriteGroup> group = std::make_shared<WriteGroup>();
+    QueueFITS("./no_such_dir/test_writer.fits", ImageU8L(4, 4), FitsCompression(), Precision::F32, group);
+    QueueFITS("./test_writer_ok.fits", ImageU8L(4, 4), FitsCompression(), Precision::F32, group);
+
+    // A job with nothing to write waits for those before it
+    size_t failed_before = 99;
+    WriteJob after;
+    after.done = [&] (bool ok) { failed_before = ok ? group->failed.load() : 99; };
+    SharedWriter().Write(after);
+    SharedWriter().Finish();
+
+    WriterStats stats = SharedWriter().Stats();
+    CHECK(failed_before == 1);
+    CHECK(stats.failed == before.failed + 1);
+    CHECK(stats.files == before.files + 1);
+    std::remove("./test_writer_ok.fits");
+}
+
+TEST_CASE("Testing tile compressed FITS") {
+    FitsCompression comp;
+    CHECK(ParseTile("16x8x1", comp));
+    CHECK(comp.tile_x == 16);
+    CHECK(comp.tile_y == 8);
+    CHECK(comp.tile_z == 1);
+    CHECK(!ParseTile("16xbig", comp));
+    comp.compress = true;
+
+    ImageU8L3D mask(64, 32, 4);
+    mask.data[2][10][20] = 3;
+    mask.data[3][31][63] = 1;
+    std::string path("./test_fits_rice.fits");
+    std::vector<char> plain = EncodeFITS(mask);
+    std::vector<char> packed = EncodeFITS(mask, comp);
+    CHECK(packed.size() < plain.size());
+    WriteFileAtomic(path, packed);
+
+    std::vector<long> naxes;
+    std::vector<uint8_t> pixels = ReadBack<uint8_t>(path, TBYTE, naxes);
+    CHECK(naxes == std::vector<long>({64, 32, 4}));
+    CHECK(pixels[2 * 64 * 32 + 10 * 64 + 20] == 3);
+    CHECK(pixels[3 * 64 * 32 + 31 * 64 + 63] == 1);
+    CHECK(pixels[0] == 0);
+
+    // Floats are lossless unless we ask for quantisation
+    ImageF32L image(33, 17);
+    image.data[5][7] = 1.2345678f;
+    WriteFileAtomic(path, EncodeFITS(image, comp));
+    std::vector<float> floats = ReadBack<float>(path, TFLOAT, naxes);
+    CHECK(floats[5 * 33 + 7] == 1.2345678f);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Testing scaled u16 FITS") {
+    ImageF32L image(20, 10);
+
+    for (size_t y = 0; y < image.height; y++) {
+        for (size_t x = 0; x < image.width; x++) {
+            image.data[y][x] = static_cast<float>(x * y) * 0.37f - 5.0f;
+        }
+    }
+
+    QuantError error;
+    std::string path("./test_fits_u16.fits");
+    WriteFileAtomic(path, EncodeFITS(image, FitsCompression(), Precision::U16, &error));
+    CHECK(error.max_error <= error.scale * 0.5 + 1e-4);
+
+    // Quantised from the rows as they are, the same as from a flat copy
+    std::vector<float> flat;
+
+    for (size_t y = 0; y < image.height; y++) {
+        flat.insert(flat.end(), image.data[y].begin(), image.data[y].end());
+    }
+
+    std::vector<uint16_t> stored(flat.size());
+    QuantError expected = QuantiseU16(flat.data(), flat.size(), stored.data());
+    CHECK(error.scale == expected.scale);
+    CHECK(error.zero == expected.zero);
+    CHECK(error.max_error == expected.max_error);
+    CHECK(error.rms_error == doctest::Approx(expected.rms_error));
+
+    // cfitsio applies BSCALE and BZERO as it reads
+    std::vector<long> naxes;
+    std::vector<float> floats = ReadBack<float>(path, TFLOAT, naxes);
+    CHECK(naxes == std::vector<long>({20, 10}));
+    CHECK(floats[0] == doctest::Approx(-5.0f).epsilon(1e-4));
+    CHECK(floats[9 * 20 + 19] == doctest::Approx(image.data[9][19]).epsilon(1e-4));
+    std::remove(path.c_str());
+}
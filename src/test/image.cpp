@@ -0,0 +1,56 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "image.hpp"
+
+using namespace imagine;
+
+TEST_CASE("Testing neuron log parsing") {
+    std::vector<std::string> lines = {"7", "associate ASI-1", "12", "13", "", "associate ASI-2", "20", "associate ASJ-1", "30", "associate ASJ-2", "40", "12"};
+    std::vector<std::vector<size_t>> neurons = ParseNeuronLog(lines);
+    REQUIRE(neurons.size() == 5);
+    CHECK(neurons[0] == std::vector<size_t>{7});
+    CHECK(neurons[1] == std::vector<size_t>{12, 13});
+    CHECK(neurons[4] == std::vector<size_t>{40, 12});
+
+    // The last class an ID is listed under wins
+    std::vector<uint8_t> lut = NeuronLUT(neurons);
+    CHECK(lut[7] == 0);
+    CHECK(lut[13] == 1);
+    CHECK(lut[12] == 4);
+    CHECK(lut[20] == 2);
+    CHECK(lut[30] == 3);
+}
+
+TEST_CASE("Testing neuron labelling") {
+    // Three slices of 4x3, one after another
+    size_t width = 4, height = 3, depth = 3;
+    ImageU16L watershed(width, height * depth);
+    watershed.data[0][0] = 20;                  // Slice 0, y 0, x 0 - ASI-2
+    watershed.data[height + 1][2] = 30;         // Slice 1, y 1, x 2 - ASJ-1
+    watershed.data[2 * height + 2][3] = 99;     // Slice 2 - not a neuron
+    watershed.data[2 * height][1] = 13;         // Slice 2, y 0, x 1 - ASI-1
+
+    std::vector<std::vector<size_t>> neurons = {{}, {13}, {20}, {30}, {40}};
+    std::vector<uint8_t> lut = NeuronLUT(neurons);
+
+    ImageU8L3D mask(width, height, depth);
+    std::vector<bool> found = SetNeurons(watershed, mask, lut, {0, 1, 2, 3, 4}, true, true);
+    REQUIRE(found.size() == 5);
+    CHECK(found[1]);
+    CHECK(found[2]);
+    CHECK(found[3]);
+    CHECK(!found[4]);
+
+    // Flipped in depth and height as it is written
+    CHECK(mask.data[2][2][0] == 2);
+    CHECK(mask.data[1][1][2] == 3);
+    CHECK(mask.data[0][2][1] == 1);
+    CHECK(mask.data[0][0][3] == 0);
+
+    // Three classes, unflipped
+    ImageU8L3D three(width, height, depth);
+    SetNeurons(watershed, three, lut, {0, 1, 1, 2, 2}, false, false);
+    CHECK(three.data[0][0][0] == 1);
+    CHECK(three.data[1][1][2] == 2);
+    CHECK(three.data[2][0][1] == 1);
+}
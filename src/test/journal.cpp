@@ -0,0 +1,169 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "journal.hpp"
+#include "writer.hpp"
+#include "pipe.hpp"
+#include <sys/stat.h>
+#include <fstream>
+
+using namespace imagine;
+
+TEST_CASE("Testing stage keys") {
+    Options options;
+    Pair pair;
+    pair.anno = "./no_anno.tif";
+    pair.input = "./no_input.tif";
+
+    StageKeys base = MakeStageKeys(options, pair, 7);
+    CHECK(SameKeys(base, MakeStageKeys(options, pair, 7)));
+
+    // Augmentation changes leave the earlier stages alone
+    StageKeys reseeded = MakeStageKeys(options, pair, 8);
+    CHECK(reseeded.source == base.source);
+    CHECK(reseeded.aug != base.aug);
+
+    options.num_augs = 20;
+    CHECK(MakeStageKeys(options, pair, 7).source == base.source);
+
+    // Processing changes reach the later stages too
+    options.num_augs = 1;
+    options.deconv = true;
+    StageKeys deconv = MakeStageKeys(options, pair, 7);
+    CHECK(deconv.mask == base.mask);
+    CHECK(deconv.source != base.source);
+    CHECK(deconv.aug != base.aug);
+}
+
+TEST_CASE("Testing the journal") {
+    std::string dir("./test_journal");
+    mkdir(dir.c_str(), 0755);
+
+    Journal journal;
+    journal.Open(dir);
+    journal.Forget(3);
+    journal.Forget(12);
+
+    JournalEntry entry;
+    entry.idx = 12;
+    entry.keys.input = "a";
+    entry.keys.mask = "b";
+    entry.keys.source = "c";
+    entry.keys.aug = "d";
+    entry.outputs.push_back(dir + "/00012_00_mask.fits");
+    entry.rows.push_back("x,y,12");
+    entry.records.push_back(40);
+    entry.counts.push_back("c,12");
+    entry.neurons = {"n,12,1", "n,12,2"};
+    journal.Queue(entry);
+
+    entry.idx = 3;
+    entry.rows[0] = "x,y,3";
+    entry.counts[0] = "c,3";
+    entry.neurons = {"n,3,1"};
+    journal.Queue(entry);
+    SharedWriter().Finish();
+
+    JournalEntry found;
+    REQUIRE(journal.Find(12, found));
+    CHECK(SameKeys(found.keys, entry.keys));
+    CHECK(found.rows == std::vector<std::string>({"x,y,12"}));
+    CHECK(found.records == std::vector<size_t>({40}));
+    CHECK(found.counts == std::vector<std::string>({"c,12"}));
+    CHECK(found.neurons == std::vector<std::string>({"n,12,1", "n,12,2"}));
+    CHECK(!journal.Find(4, found));
+
+    // The output hasn't been written, then is cut short, then is whole
+    CHECK(!OutputsValid(found.outputs));
+    std::ofstream(found.outputs[0]) << std::string(100, ' ');
+    CHECK(!OutputsValid(found.outputs));
+    std::ofstream(found.outputs[0]) << std::string(2880, ' ');
+    CHECK(OutputsValid(found.outputs));
+
+    // Rows come out in index order
+    std::string csv = dir + "/master_dataset.csv";
+    journal.RewriteCSV(csv, "a,b,c");
+    std::ifstream in(csv);
+    std::string line;
+    std::vector<std::string> lines;
+
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+
+    CHECK(lines == std::vector<std::string>({"a,b,c", "x,y,3", "x,y,12"}));
+
+    // The combined run's CSVs, from their own rows
+    std::string neurons = dir + "/neurons.csv";
+    journal.RewriteCSV(neurons, "n", &JournalEntry::neurons);
+    std::ifstream neurons_in(neurons);
+    lines.clear();
+
+    while (std::getline(neurons_in, line)) {
+        lines.push_back(line);
+    }
+
+    CHECK(lines == std::vector<std::string>({"n", "n,3,1", "n,12,1", "n,12,2"}));
+    std::remove(neurons.c_str());
+    std::remove(found.outputs[0].c_str());
+}
+
+TEST_CASE("Testing a resumed run finds the run before") {
+    std::string dir("./test_resume");
+    mkdir(dir.c_str(), 0755);
+
+    // The first run built pair 0, then stopped
+    Journal journal;
+    journal.Open(dir);
+    JournalEntry entry;
+    entry.idx = 0;
+    entry.keys.input = "a";
+    entry.outputs.push_back(dir + "/00000_layered.fits");
+    entry.rows.push_back("x,y,0");
+    std::ofstream(entry.outputs[0]) << std::string(2880, ' ');
+    journal.Queue(entry);
+    SharedWriter().Finish();
+
+    // A fresh run carries on after the outputs already there
+    Options options;
+    options.output_path = dir;
+    CHECK(FirstPairIndex(options, false) == 1);
+
+    // A resumed run starts where the first run did, so finds its work
+    options.resume = true;
+    Journal restarted;
+    restarted.Open(dir);
+    JournalEntry found;
+    REQUIRE(restarted.Find(FirstPairIndex(options, false), found));
+    CHECK(found.rows == entry.rows);
+    CHECK(OutputsValid(found.outputs));
+
+    options.offset_number = 4;
+    CHECK(FirstPairIndex(options, true) == 4);
+
+    // As does a manifest run
+    options.resume = false;
+    options.offset_number = 0;
+    options.manifest = "./manifest.txt";
+    CHECK(FirstPairIndex(options, false) == 0);
+
+    std::remove(entry.outputs[0].c_str());
+    std::remove((dir + "/journal/00000.txt").c_str());
+}
+
+TEST_CASE("Testing the stage cache") {
+    std::string path("./test_stage.vol");
+    ImageF32L3D image(5, 4, 3);
+    image.data[2][3][4] = 6.5f;
+    QueueStageCache(path, image, 281);
+    SharedWriter().Finish();
+
+    ImageF32L3D loaded;
+    int background = 0;
+    REQUIRE(LoadStageCache(path, loaded, background));
+    CHECK(background == 281);
+    CHECK(loaded.width == 5);
+    CHECK(loaded.depth == 3);
+    CHECK(loaded.data[2][3][4] == 6.5f);
+    CHECK(!LoadStageCache("./no_such.vol", loaded, background));
+    std::remove(path.c_str());
+}
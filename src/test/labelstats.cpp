@@ -0,0 +1,186 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "labelstats.hpp"
+#include "pipe.hpp"
+#include <tiffio.h>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+
+using namespace imagine;
+
+TEST_CASE("Testing label statistics") {
+    ImageU16L3D raw(32, 16, 6);
+    ImageU8L3D mask(32, 16, 8);
+    std::vector<std::vector<uint16_t>> values(3);
+
+    for (size_t z = 0; z < 8; z++) {
+        for (size_t y = 0; y < 16; y++) {
+            for (size_t x = 0; x < 32; x++) {
+                uint8_t label = 0;
+
+                if (x >= 4 && x < 12 && y >= 2 && y < 9) {
+                    label = 1;
+                } else if (x >= 20 && y >= 10) {
+                    label = 2;
+                }
+
+                mask.data[z][y][x] = label;
+
+                // The mask is deeper than the source, as in count
+                if (z < raw.depth) {
+                    uint16_t value = static_cast<uint16_t>((x * 131 + y * 37 + z * 1013) % 5000);
+                    raw.data[z][y][x] = value;
+
+                    if (label != 0) {
+                        values[label].push_back(value);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<LabelStats> stats = MeasureLabelStats(raw, ToSparse(mask), 3);
+    REQUIRE(stats.size() == 3);
+    CHECK(stats[0].count == 0);
+
+    for (size_t l = 1; l < 3; l++) {
+        std::vector<uint16_t> &v = values[l];
+        std::sort(v.begin(), v.end(), std::greater<uint16_t>());
+        uint64_t sum = 0;
+
+        for (uint16_t value : v) {
+            sum += value;
+        }
+
+        CHECK(stats[l].count == v.size());
+        CHECK(stats[l].sum == sum);
+        CHECK(stats[l].max == v.front());
+        CHECK(stats[l].min == v.back());
+        CHECK(StatsMean(stats[l]) == doctest::Approx(static_cast<double>(sum) / v.size()));
+
+        // Top K sums match sorting the voxels, as neuroshed does
+        for (size_t k : {1ul, 10ul, 50ul, v.size(), v.size() + 100}) {
+            uint64_t top = 0;
+
+            for (size_t i = 0; i < std::min(k, v.size()); i++) {
+                top += v[i];
+            }
+
+            // Exact unless k splits the values above the last bin
+            size_t above = static_cast<size_t>(std::count_if(v.begin(), v.end(), [] (uint16_t value) { return value >= LABEL_STATS_BINS - 1; }));
+
+            if (k >= above) {
+                CHECK(TopSum(stats[l], k) == top);
+            }
+        }
+
+        CHECK(StatsPercentile(stats[l], 0) == v.back());
+        CHECK(StatsPercentile(stats[l], 100) == v.front());
+    }
+}
+
+TEST_CASE("Testing label statistics mode and percentiles") {
+    ImageU16L3D raw(10, 1, 1);
+    ImageU8L3D mask(10, 1, 1);
+    std::vector<uint16_t> values = {5, 7, 7, 7, 9, 9, 100, 200, 300, 400};
+
+    for (size_t x = 0; x < 10; x++) {
+        raw.data[0][0][x] = values[x];
+        mask.data[0][0][x] = 1;
+    }
+
+    std::vector<LabelStats> stats = MeasureLabelStats(raw, ToSparse(mask), 2);
+    CHECK(StatsMode(stats[1]) == 7);
+    CHECK(StatsPercentile(stats[1], 50) == 9);
+    CHECK(StatsPercentile(stats[1], 10) == 5);
+    CHECK(StatsPercentile(stats[1], 90) == 300);
+    CHECK(TopSum(stats[1], 3) == 900);
+}
+
+TEST_CASE("Testing the count row is the same from count and a combined run") {
+    // An AutoStack tiff of 2 channels and 4 slices, 10 by 8, the bottom channel at 100 + x
+    size_t width = 10, height = 8, channels = 2, stacksize = 4;
+    std::string tiff_path("./test_count.tif");
+    TIFF *tif = TIFFOpen(tiff_path.c_str(), "w");
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>(width));
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, static_cast<uint32_t>(height * channels * stacksize));
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 16);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, 3);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    std::vector<uint16_t> row(width);
+
+    for (uint32_t y = 0; y < height * channels * stacksize; y++) {
+        bool bottom = (y / height) % channels == 1;
+
+        for (size_t x = 0; x < width; x++) {
+            row[x] = bottom ? static_cast<uint16_t>(100 + x) : 7;
+        }
+
+        TIFFWriteScanline(tif, row.data(), y, 0);
+    }
+
+    TIFFClose(tif);
+
+    std::string dat_path("./test_count.dat");
+    std::ofstream(dat_path) << "ASI-1, 500, 30, [1, 2, 0], 110, 90, 12\n"
+        << "ASI-2, 600, 31, [1, 6, 0], 111, 91, 13\n"
+        << "ASJ-1, 700, 32, [5, 2, 1], 112, 92, 14\n"
+        << "ASJ-2, 800, 33, [5, 6, 1], 113, 93, 15\n";
+
+    // One voxel per neuron, and ASJ-2 also in the last slice, which the count leaves off
+    ImageU8L3D dense(width, height, stacksize);
+    dense.data[0][1][2] = 1;
+    dense.data[0][1][6] = 2;
+    dense.data[1][5][2] = 3;
+    dense.data[1][5][6] = 4;
+    dense.data[3][5][6] = 4;
+    SparseLabel3D mask = ToSparse(dense);
+
+    Pair pair;
+    pair.anno = "./test_count_anno.tif";
+    pair.log = "./test_count.log";
+    pair.dat = dat_path;
+    pair.input = tiff_path;
+    // count leaves bottom off by default, so counts channel 0. wiggle always has bottom
+    // set, but a combined run still counts channel 0 unless told otherwise.
+    std::string counted = CountPair(pair, mask, channels, 0, stacksize, 0);
+    CHECK(counted == pair.input + "," + pair.anno + ",7,7,7,7,500,600,700,800");
+
+    Options options;
+    options.output_path = ".";
+    options.channels = static_cast<int>(channels);
+    options.stacksize = static_cast<int>(stacksize);
+    CHECK(options.bottom);
+    CombinedRows rows;
+    CombinedOutputs(options, mask, pair, 0, nullptr, rows);
+    SharedWriter().Finish();
+    CHECK(rows.count == counted);
+
+    // count with bottom set, and a combined run with --count-channel 1
+    counted = CountPair(pair, mask, channels, 1, stacksize, 0);
+    CHECK(counted == pair.input + "," + pair.anno + ",102,106,102,106,500,600,700,800");
+    options.count_channel = 1;
+    CombinedOutputs(options, mask, pair, 0, nullptr, rows);
+    SharedWriter().Finish();
+    CHECK(rows.count == counted);
+    REQUIRE(rows.neurons.size() == 4);
+    CHECK(rows.neurons[3] == pair.anno + "," + pair.log + "," + dat_path + ",6,5,1,800,113,93,33,15,4");
+
+    // Without the four neurons, both give zero base counts and the combined run no database rows
+    std::ofstream(dat_path) << "ASI-1, 500, 30, [1, 2, 0], 110, 90, 12\n";
+    counted = CountPair(pair, mask, channels, 1, stacksize, 0);
+    CHECK(counted == pair.input + "," + pair.anno + ",102,106,102,106,0,0,0,0");
+    CombinedOutputs(options, mask, pair, 0, nullptr, rows);
+    SharedWriter().Finish();
+    CHECK(rows.count == counted);
+    CHECK(rows.neurons.empty());
+
+    std::remove(tiff_path.c_str());
+    std::remove(dat_path.c_str());
+    std::remove("./00000_full_mask.fits");
+}
@@ -0,0 +1,50 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "preview.hpp"
+
+using namespace imagine;
+
+TEST_CASE("Testing previews") {
+    ImageF32L image(8, 6);
+
+    for (size_t y = 0; y < image.height; y++) {
+        for (size_t x = 0; x < image.width; x++) {
+            image.data[y][x] = 100.0f + static_cast<float>(x);
+        }
+    }
+
+    // Full size is just stretched to 0..255
+    ImageU8L full = MakePreview(image, 1);
+    CHECK(full.width == 8);
+    CHECK(full.data[0][0] == 0);
+    CHECK(full.data[5][7] == 255);
+
+    // Down by 2 averages each 2x2 block
+    ImageU8L half = MakePreview(image, 2);
+    CHECK(half.width == 4);
+    CHECK(half.height == 3);
+    CHECK(half.data[0][0] == 18);
+    CHECK(half.data[2][3] == 237);
+
+    // Masks with one label still show up
+    ImageU8L mask(4, 4);
+    mask.data[1][1] = 2;
+    CHECK(MakePreview(mask, 1).data[1][1] == 255);
+}
+
+TEST_CASE("Testing montages") {
+    std::vector<ImageU8L> tiles;
+
+    for (int i = 0; i < 5; i++) {
+        ImageU8L tile(4, 3);
+        tile.data[0][0] = static_cast<uint8_t>(i + 1);
+        tiles.push_back(tile);
+    }
+
+    ImageU8L sheet = MakeMontage(tiles);
+    CHECK(sheet.width == 12);
+    CHECK(sheet.height == 6);
+    CHECK(sheet.data[0][4] == 2);
+    CHECK(sheet.data[3][4] == 5);
+    CHECK(sheet.data[3][8] == 0);
+}
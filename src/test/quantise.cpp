@@ -0,0 +1,54 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "quantise.hpp"
+#include <cmath>
+
+TEST_CASE("Testing precision names") {
+    Precision precision = Precision::F32;
+    CHECK(ParsePrecision("u16", precision));
+    CHECK(precision == Precision::U16);
+    CHECK(ParsePrecision("f16", precision));
+    CHECK(precision == Precision::F16);
+    CHECK(!ParsePrecision("f64", precision));
+    CHECK(PrecisionName(Precision::F32) == "f32");
+    CHECK(PrecisionBytes(Precision::F16) == 2);
+}
+
+TEST_CASE("Testing half floats") {
+    CHECK(HalfToFloat(FloatToHalf(0.0f)) == 0.0f);
+    CHECK(HalfToFloat(FloatToHalf(1.0f)) == 1.0f);
+    CHECK(HalfToFloat(FloatToHalf(-2.5f)) == -2.5f);
+    CHECK(HalfToFloat(FloatToHalf(65504.0f)) == 65504.0f);
+    CHECK(std::isinf(HalfToFloat(FloatToHalf(1.0e6f))));
+    // Halfway between 1 and the next half rounds to even
+    CHECK(HalfToFloat(FloatToHalf(1.0f + 1.0f / 2048.0f)) == 1.0f);
+
+    std::vector<float> values = {0.1f, 270.0f, 1234.5f, -3.0f};
+    std::vector<uint16_t> stored(values.size());
+    QuantError error = QuantiseF16(values.data(), values.size(), stored.data());
+    CHECK(error.max_error < 1.0);
+    CHECK(HalfToFloat(stored[1]) == 270.0f);
+}
+
+TEST_CASE("Testing scaled u16") {
+    std::vector<float> values(1000);
+
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = 100.0f + static_cast<float>(i) * 3.7f;
+    }
+
+    std::vector<uint16_t> stored(values.size());
+    QuantError error = QuantiseU16(values.data(), values.size(), stored.data());
+    CHECK(stored.front() == 0);
+    CHECK(stored.back() == 65535);
+    CHECK(error.zero == doctest::Approx(100.0));
+    // Never more than half a step out
+    CHECK(error.max_error <= error.scale * 0.5 + 1e-4);
+    CHECK(error.rms_error <= error.max_error);
+
+    // A flat volume survives exactly
+    std::vector<float> flat(16, 42.0f);
+    error = QuantiseU16(flat.data(), flat.size(), stored.data());
+    CHECK(error.max_error == 0.0);
+    CHECK(static_cast<float>(stored[3] * error.scale + error.zero) == 42.0f);
+}
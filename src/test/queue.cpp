@@ -0,0 +1,58 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "queue.hpp"
+#include "pool.hpp"
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+TEST_CASE("Testing in order commits") {
+    std::vector<size_t> order;
+
+    {
+        InOrder committer;
+        ParallelFor(64, [&committer, &order] (size_t i) {
+            // Finish in roughly reverse order
+            std::this_thread::sleep_for(std::chrono::microseconds((64 - i) * 50));
+            committer.Commit(i, [&order, i] () { order.push_back(i); });
+        });
+        committer.Finish();
+    }
+
+    REQUIRE(order.size() == 64);
+
+    for (size_t i = 0; i < order.size(); i++) {
+        CHECK(order[i] == i);
+    }
+
+    // A missing slot only holds things up until Finish
+    std::vector<size_t> gappy;
+    InOrder committer;
+    committer.Commit(0, [&gappy] () { gappy.push_back(0); });
+    committer.Commit(2, [&gappy] () { gappy.push_back(2); });
+    committer.Finish();
+    CHECK(gappy == std::vector<size_t>({0, 2}));
+}
+
+TEST_CASE("Testing the bounded queue with several consumers") {
+    BoundedQueue<int> queue(2);
+    std::atomic<int> total{0};
+    std::thread producer([&queue] () {
+        for (int i = 1; i <= 100; i++) {
+            queue.Push(i);
+        }
+
+        queue.Close();
+    });
+
+    ParallelFor(4, [&queue, &total] (size_t) {
+        int item;
+
+        while (queue.Pop(item)) {
+            total += item;
+        }
+    });
+
+    producer.join();
+    CHECK(total == 5050);
+}
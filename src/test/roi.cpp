@@ -28,4 +28,4 @@ TEST_CASE("Testing ROI crop") {
     std::string path2("./images/worm3d_cropped_1.tif");
     SaveTiff(path2, test_image1_cropped);
 
-}
\ No newline at end of file
+}
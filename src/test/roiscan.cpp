@@ -0,0 +1,202 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "roi.hpp"
+
+using namespace imagine;
+
+TEST_CASE("Testing summed volumes") {
+    ImageU16L3D image(23, 17, 9);
+
+    for (size_t z = 0; z < image.depth; z++) {
+        for (size_t y = 0; y < image.height; y++) {
+            for (size_t x = 0; x < image.width; x++) {
+                image.data[z][y][x] = static_cast<uint16_t>((x * 31 + y * 17 + z * 7) % 1000);
+            }
+        }
+    }
+
+    SummedVolume<uint64_t> sums(image.width, image.height, image.depth,
+        [&image] (size_t x, size_t y, size_t z) { return static_cast<uint64_t>(image.data[z][y][x]); });
+
+    std::vector<std::vector<size_t>> boxes = { {0, 0, 0, 23, 17, 9}, {3, 5, 2, 7, 4, 3}, {22, 16, 8, 1, 1, 1}, {10, 0, 4, 13, 17, 5} };
+
+    for (auto const &b : boxes) {
+        uint64_t sum = 0;
+
+        for (size_t z = b[2]; z < b[2] + b[5]; z++) {
+            for (size_t y = b[1]; y < b[1] + b[4]; y++) {
+                for (size_t x = b[0]; x < b[0] + b[3]; x++) {
+                    sum += image.data[z][y][x];
+                }
+            }
+        }
+
+        CHECK(sums.Box(b[0], b[1], b[2], b[3], b[4], b[5]) == sum);
+    }
+}
+
+TEST_CASE("Testing ROI on a mask") {
+    // One blob of labels - the ROI should sit centred on it
+    ImageU8L3D mask(120, 90, 20);
+
+    for (size_t z = 8; z < 12; z++) {
+        for (size_t y = 50; y < 56; y++) {
+            for (size_t x = 70; x < 76; x++) {
+                mask.data[z][y][x] = 1;
+            }
+        }
+    }
+
+    ROI roi = FindROI(mask, 40, 10);
+    CHECK(roi.xy_dim == 40);
+    CHECK(roi.depth == 10);
+    CHECK(roi.sum == 6 * 6 * 4);
+    CHECK(roi.x + 20 >= 72);
+    CHECK(roi.x + 20 <= 73);
+    CHECK(roi.y + 20 >= 52);
+    CHECK(roi.y + 20 <= 53);
+    CHECK(roi.z + 5 >= 9);
+    CHECK(roi.z + 5 <= 10);
+
+    // The brightest window of a plain image
+    ImageU16L3D image(120, 90, 20);
+
+    for (size_t z = 2; z < 6; z++) {
+        for (size_t y = 10; y < 20; y++) {
+            for (size_t x = 15; x < 25; x++) {
+                image.data[z][y][x] = 100;
+            }
+        }
+    }
+
+    ROI bright = FindROI(image, 30, 8);
+    CHECK(bright.sum == 100.0 * 10 * 10 * 4);
+    CHECK(bright.x <= 15);
+    CHECK(bright.x + 30 >= 25);
+}
+
+TEST_CASE("Testing ties between the brightest windows") {
+    // A flat block, smaller than the window, so many windows are as bright
+    ImageU16L3D image(26, 21, 9);
+
+    for (size_t z = 3; z < 5; z++) {
+        for (size_t y = 7; y < 10; y++) {
+            for (size_t x = 11; x < 16; x++) {
+                image.data[z][y][x] = 50;
+            }
+        }
+    }
+
+    image.data[8][0][0] = 1;
+    size_t xy = 9, depth = 4;
+
+    // Every window, cropped, in the order the search sees them
+    uint64_t best_sum = 0;
+    double best_df = xy * xy + xy * xy + depth * depth;
+    size_t bx = 0, by = 0, bz = 0;
+
+    for (size_t z = 0; z + depth <= image.depth; z++) {
+        for (size_t y = 0; y + xy <= image.height; y++) {
+            for (size_t x = 0; x + xy <= image.width; x++) {
+                uint64_t sum = 0, n = 0, mx = 0, my = 0, mz = 0;
+
+                for (size_t k = 0; k < depth; k++) {
+                    for (size_t j = 0; j < xy; j++) {
+                        for (size_t i = 0; i < xy; i++) {
+                            uint16_t v = image.data[z + k][y + j][x + i];
+                            sum += v;
+
+                            if (v != 0) {
+                                n++;
+                                mx += i;
+                                my += j;
+                                mz += k;
+                            }
+                        }
+                    }
+                }
+
+                double cx = n > 0 ? static_cast<double>(mx / n) : 0;
+                double cy = n > 0 ? static_cast<double>(my / n) : 0;
+                double cz = n > 0 ? static_cast<double>(mz / n) : 0;
+                double half = static_cast<double>(xy / 2), hd = static_cast<double>(depth / 2);
+                double df = (cx - half) * (cx - half) + (cy - half) * (cy - half) + (cz - hd) * (cz - hd);
+
+                if (sum > best_sum || (sum == best_sum && sum > 0 && df < best_df)) {
+                    best_sum = sum;
+                    best_df = df;
+                    bx = x;
+                    by = y;
+                    bz = z;
+                }
+            }
+        }
+    }
+
+    ROI roi = FindROI(image, xy, depth);
+    CHECK(roi.sum == static_cast<double>(best_sum));
+    CHECK(roi.x == bx);
+    CHECK(roi.y == by);
+    CHECK(roi.z == bz);
+
+    // Nothing lit at all gives the corner
+    ImageU16L3D dark(26, 21, 9);
+    ROI none = FindROI(dark, xy, depth);
+    CHECK(none.sum == 0);
+    CHECK(none.x == 0);
+    CHECK(none.y == 0);
+    CHECK(none.z == 0);
+}
+
+TEST_CASE("Testing coarse to fine ROI") {
+    // Two blobs of labels, a little apart, in a mask the size of our stacks
+    ImageU8L3D mask(320, 150, 51);
+
+    for (size_t z = 20; z < 29; z++) {
+        for (size_t y = 61; y < 70; y++) {
+            for (size_t x = 101; x < 113; x++) {
+                mask.data[z][y][x] = 1;
+            }
+
+            for (size_t x = 151; x < 157; x++) {
+                mask.data[z][y + 9][x] = 3;
+            }
+        }
+    }
+
+    SparseLabel3D sparse = ToSparse(mask);
+    ROI fine = FindROI(sparse, 96, 40);
+    ROI full = FindROI(mask, 96, 40);
+    CHECK(fine.xy_dim == 96);
+    CHECK(fine.depth == 40);
+    CHECK(fine.sum == 9 * 9 * 12 + 9 * 9 * 6);
+
+    // The same window as the exhaustive search
+    CHECK(fine.sum == full.sum);
+    CHECK(fine.x == full.x);
+    CHECK(fine.y == full.y);
+    CHECK(fine.z == full.z);
+
+    // The labels fit in one window, so it comes straight from them
+    ROI direct;
+    CHECK(ROIFromLabels(sparse, 96, 40, direct));
+    CHECK(direct.sum == full.sum);
+    CHECK(direct.x == full.x);
+    CHECK(direct.y == full.y);
+    CHECK(direct.z == full.z);
+
+    // Near an edge the window is pushed back inside the volume
+    ROI edge;
+    SparseLabel3D cornered = CropSparse(sparse, 90, 50, 0, 96, 96, 51);
+    CHECK(ROIFromLabels(cornered, 80, 40, edge));
+    CHECK(edge.x + 80 <= cornered.width);
+    CHECK(edge.y + 80 <= cornered.height);
+
+    // Labels spread wider than the window need the search
+    CHECK(!ROIFromLabels(sparse, 40, 40, direct));
+
+    // Too big a window gives the corner
+    ROI big = FindROI(sparse, 400, 40);
+    CHECK(big.x == 0);
+    CHECK(big.y == 0);
+}
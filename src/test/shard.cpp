@@ -0,0 +1,137 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "shard.hpp"
+#include "writer.hpp"
+#include <sys/stat.h>
+#include <fstream>
+
+using namespace imagine;
+
+TEST_CASE("Testing shard layout") {
+    ShardLayout layout = MakeShardLayout(200, 200, 51, 16);
+    CHECK(layout.source_bytes == 200 * 200 * 51 * 4);
+    CHECK(layout.mask_offset % 64 == 0);
+    CHECK(layout.meta_offset % 64 == 0);
+    CHECK(layout.meta_offset >= layout.mask_offset + layout.mask_bytes);
+    CHECK(layout.record_size % 4096 == 0);
+    CHECK(sizeof(ShardMeta) == 64);
+
+    ShardLayout half = MakeShardLayout(200, 200, 51, 16, Precision::F16);
+    CHECK(half.source_bytes == 200 * 200 * 51 * 2);
+    CHECK(half.record_size < layout.record_size);
+}
+
+TEST_CASE("Testing shard writing and mapping") {
+    std::string dir("./test_shards");
+    mkdir(dir.c_str(), 0755);
+    std::remove((dir + "/index.csv").c_str());
+    std::remove((dir + "/layout.json").c_str());
+    std::remove((dir + "/shard_00000.bin").c_str());
+    std::remove((dir + "/shard_00001.bin").c_str());
+
+    ShardSet shards;
+    shards.Open(dir, MakeShardLayout(6, 5, 3, 2));
+    std::vector<size_t> records;
+
+    for (int i = 0; i < 3; i++) {
+        size_t record = shards.Allocate();
+        records.push_back(record);
+        ImageF32L3D source(6, 5, 3);
+        ImageU8L3D mask(6, 5, 3);
+        source.data[1][2][3] = 10.0f + static_cast<float>(i);
+        mask.data[2][4][5] = static_cast<uint8_t>(i + 1);
+
+        // Order shouldn't matter, so write the mask first
+        shards.QueueMask(record, mask);
+        shards.QueueSource(record, source);
+        ShardMeta meta;
+        meta.image_idx = 7;
+        meta.aug = static_cast<uint32_t>(i);
+        meta.background = 270;
+        shards.QueueMeta(record, meta, "a,b,c");
+    }
+
+    SharedWriter().Finish();
+    CHECK(records == std::vector<size_t>({0, 1, 2}));
+    CHECK(shards.ShardPath(2) == dir + "/shard_00001.bin");
+
+    ShardLayout layout = ReadShardLayout(dir);
+    CHECK(layout.record_size == shards.Layout().record_size);
+
+    ShardFile first(dir + "/shard_00000.bin", layout);
+    ShardFile second(dir + "/shard_00001.bin", layout);
+    CHECK(first.NumRecords() == 2);
+    CHECK(second.NumRecords() == 1);
+    CHECK(first.Source(1)[1 * 30 + 2 * 6 + 3] == 11.0f);
+    CHECK(first.Mask(0)[2 * 30 + 4 * 6 + 5] == 1);
+    CHECK(second.Mask(0)[2 * 30 + 4 * 6 + 5] == 3);
+    CHECK(second.Meta(0)->valid == 1);
+    CHECK(second.Meta(0)->aug == 2);
+    CHECK(second.Meta(0)->background == 270);
+
+    // Each record is in the index once its metadata is written
+    std::ifstream index_in(dir + "/index.csv");
+    std::vector<std::string> lines;
+    std::string line;
+
+    while (std::getline(index_in, line)) {
+        lines.push_back(line);
+    }
+
+    REQUIRE(lines.size() == 4);
+    CHECK(lines[3] == "2,shard_00001.bin,0,a,b,c");
+
+    // A resumed run writes the index again from its journal
+    shards.RewriteIndex({std::make_pair(static_cast<size_t>(1), std::string("d,e,f")), std::make_pair(static_cast<size_t>(2), std::string("a,b,c"))});
+    index_in.close();
+    index_in.open(dir + "/index.csv");
+    lines.clear();
+
+    while (std::getline(index_in, line)) {
+        lines.push_back(line);
+    }
+
+    REQUIRE(lines.size() == 3);
+    CHECK(lines[1] == "1,shard_00000.bin," + std::to_string(shards.Layout().record_size) + ",d,e,f");
+
+    // Records past the end of a shard are never read
+    CHECK_THROWS(second.Source(1));
+    CHECK_THROWS(second.Mask(1));
+    CHECK_THROWS(second.Meta(1));
+
+    // Opening again carries on after the last record
+    ShardSet again;
+    again.Open(dir, MakeShardLayout(6, 5, 3, 2));
+    CHECK(again.Allocate() == 3);
+    CHECK_THROWS(again.Open(dir, MakeShardLayout(7, 5, 3, 2)));
+}
+
+TEST_CASE("Testing u16 shards") {
+    std::string dir("./test_shards_u16");
+    mkdir(dir.c_str(), 0755);
+    std::remove((dir + "/index.csv").c_str());
+    std::remove((dir + "/layout.json").c_str());
+    std::remove((dir + "/shard_00000.bin").c_str());
+
+    ShardSet shards;
+    shards.Open(dir, MakeShardLayout(4, 4, 1, 8, Precision::U16));
+    size_t record = shards.Allocate();
+    ImageF32L source(4, 4);
+    source.data[1][2] = 300.0f;
+    source.data[3][3] = -12.5f;
+    shards.QueueSource(record, source);
+    shards.QueueMask(record, ImageU8L(4, 4));
+    shards.QueueMeta(record, ShardMeta(), "a,b,c");
+    SharedWriter().Finish();
+
+    ShardLayout layout = ReadShardLayout(dir);
+    CHECK(layout.precision == Precision::U16);
+    ShardFile file(dir + "/shard_00000.bin", layout);
+    std::vector<float> values = file.Source(0);
+    CHECK(values[1 * 4 + 2] == doctest::Approx(300.0f).epsilon(1e-4));
+    CHECK(values[3 * 4 + 3] == doctest::Approx(-12.5f).epsilon(1e-4));
+
+    // A different precision is a different layout
+    ShardSet again;
+    CHECK_THROWS(again.Open(dir, MakeShardLayout(4, 4, 1, 8, Precision::F32)));
+}
@@ -0,0 +1,246 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "sparse.hpp"
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+using namespace imagine;
+
+ImageU8L3D TestMask() {
+    ImageU8L3D mask(64, 40, 12);
+
+    // Two blobs with different labels, one touching the edge
+    for (size_t z = 3; z < 7; z++) {
+        for (size_t y = 10; y < 18; y++) {
+            for (size_t x = 20; x < 31; x++) {
+                mask.data[z][y][x] = 1;
+            }
+            mask.data[z][y][31] = 3;
+        }
+    }
+
+    for (size_t z = 8; z < 12; z++) {
+        for (size_t y = 30; y < 40; y++) {
+            for (size_t x = 55; x < 64; x++) {
+                mask.data[z][y][x] = 4;
+            }
+        }
+    }
+
+    return mask;
+}
+
+TEST_CASE("Testing sparse round trip") {
+    ImageU8L3D mask = TestMask();
+    SparseLabel3D sparse = ToSparse(mask);
+    CHECK(non_zero(sparse));
+    CHECK(Densify(sparse).data == mask.data);
+    CHECK(CountLabelled(sparse) == 4 * 8 * 12 + 4 * 10 * 9);
+}
+
+TEST_CASE("Testing flatten") {
+    SparseLabel3D sparse = ToSparse(TestMask());
+    SparseLabel3D flat = FlattenSparse(sparse);
+    CHECK(flat.depth == 1);
+    CHECK(flat.width == sparse.width);
+    CHECK(Densify(flat).data[0] == ProjectSparse(sparse).data);
+
+    // Resized in 2D, a flattened mask keeps its labels
+    ImageU8L mip;
+    SparseLabel3D small = ResizeLabels(flat, 32, 20, 1, &mip);
+    CHECK(small.depth == 1);
+    CHECK(mip.data[6][12] == 1);
+    CHECK(mip.data[17][29] == 4);
+}
+
+TEST_CASE("Testing relabel") {
+    ImageU8L3D mask = TestMask();
+    SparseLabel3D sparse = ToSparse(mask);
+    RelabelSparse(sparse, {0, 1, 1, 0, 2});
+    ImageU8L3D dense = Densify(sparse);
+    CHECK(dense.data[4][12][25] == 1);
+    CHECK(dense.data[4][12][31] == 0);
+    CHECK(dense.data[9][35][60] == 2);
+    CHECK(CountLabelled(sparse) == 4 * 8 * 11 + 4 * 10 * 9);
+}
+
+TEST_CASE("Testing sparse crop and projection") {
+    ImageU8L3D mask = TestMask();
+    SparseLabel3D sparse = ToSparse(mask);
+    SparseLabel3D cropped = CropSparse(sparse, 25, 12, 4, 35, 25, 6);
+    ImageU8L3D dense = Densify(cropped);
+
+    for (size_t z = 0; z < 6; z++) {
+        for (size_t y = 0; y < 25; y++) {
+            for (size_t x = 0; x < 35; x++) {
+                CHECK(dense.data[z][y][x] == mask.data[z + 4][y + 12][x + 25]);
+            }
+        }
+    }
+
+    ImageU8L projected = ProjectSparse(sparse);
+    CHECK(projected.data[12][25] == 1);
+    CHECK(projected.data[12][31] == 3);
+    CHECK(projected.data[35][60] == 4);
+    CHECK(projected.data[0][0] == 0);
+}
+
+TEST_CASE("Testing sparse resize and measure") {
+    ImageU8L3D mask = TestMask();
+    SparseLabel3D sparse = ToSparse(mask);
+
+    for (auto dims : std::vector<std::vector<size_t>>{{32, 20, 6}, {100, 77, 25}, {64, 40, 12}}) {
+        ImageU8L3D resized = Densify(ResizeSparse(sparse, dims[0], dims[1], dims[2]));
+
+        for (size_t z = 0; z < dims[2]; z++) {
+            for (size_t y = 0; y < dims[1]; y++) {
+                for (size_t x = 0; x < dims[0]; x++) {
+                    size_t sx = x * mask.width / dims[0];
+                    size_t sy = y * mask.height / dims[1];
+                    size_t sz = z * mask.depth / dims[2];
+                    CHECK(resized.data[z][y][x] == mask.data[sz][sy][sx]);
+                }
+            }
+        }
+    }
+
+    LabelBounds bounds = MeasureLabel(sparse, 4);
+    CHECK(bounds.count == 4 * 10 * 9);
+    CHECK(bounds.min_x == 55);
+    CHECK(bounds.max_x == 63);
+    CHECK(bounds.min_z == 8);
+    CHECK(bounds.cx == doctest::Approx(59.0));
+    CHECK(bounds.cy == doctest::Approx(34.5));
+
+    LabelBounds all = MeasureLabel(sparse, 0);
+    CHECK(all.min_y == 10);
+    CHECK(all.max_y == 39);
+    CHECK(MeasureLabel(sparse, 2).count == 0);
+}
+
+// The label a dense block of a mask should pool to
+uint8_t _BlockMode(ImageU8L3D const &mask, size_t x0, size_t y0, size_t z0, size_t kx, size_t ky, size_t kz) {
+    std::vector<size_t> counts(256, 0);
+
+    for (size_t z = z0; z < z0 + kz; z++) {
+        for (size_t y = y0; y < y0 + ky; y++) {
+            for (size_t x = x0; x < x0 + kx; x++) {
+                counts[mask.data[z][y][x]] += 1;
+            }
+        }
+    }
+
+    size_t best = 0;
+    uint8_t label = 0;
+
+    for (size_t l = 1; l < counts.size(); l++) {
+        if (counts[l] > best) {
+            best = counts[l];
+            label = static_cast<uint8_t>(l);
+        }
+    }
+
+    return best >= counts[0] && best > 0 ? label : 0;
+}
+
+TEST_CASE("Testing label resize") {
+    ImageU8L3D mask = TestMask();
+    SparseLabel3D sparse = ToSparse(mask);
+
+    // Whole number shrinks pool to the most common label
+    for (auto dims : std::vector<std::vector<size_t>>{{32, 20, 6}, {16, 10, 12}, {64, 20, 3}}) {
+        ImageU8L mip;
+        SparseLabel3D small = ResizeLabels(sparse, dims[0], dims[1], dims[2], &mip);
+        ImageU8L3D resized = Densify(small);
+        size_t kx = mask.width / dims[0], ky = mask.height / dims[1], kz = mask.depth / dims[2];
+
+        for (size_t z = 0; z < dims[2]; z++) {
+            for (size_t y = 0; y < dims[1]; y++) {
+                for (size_t x = 0; x < dims[0]; x++) {
+                    CHECK(resized.data[z][y][x] == _BlockMode(mask, x * kx, y * ky, z * kz, kx, ky, kz));
+                }
+            }
+        }
+
+        // The MIP is the projection of the result
+        ImageU8L projected = ProjectSparse(small);
+
+        for (size_t y = 0; y < dims[1]; y++) {
+            CHECK(mip.data[y] == projected.data[y]);
+        }
+    }
+
+    // Anything else takes the nearest voxel, so growing by two copies each voxel
+    ImageU8L3D grown = Densify(ResizeLabels(sparse, 128, 80, 24));
+
+    for (size_t z = 0; z < 24; z++) {
+        for (size_t y = 0; y < 80; y++) {
+            for (size_t x = 0; x < 128; x++) {
+                CHECK(grown.data[z][y][x] == mask.data[z / 2][y / 2][x / 2]);
+            }
+        }
+    }
+
+    // Labels are never blended into new values
+    ImageU8L3D odd = Densify(ResizeLabels(sparse, 50, 33, 7));
+
+    for (size_t z = 0; z < 7; z++) {
+        for (size_t y = 0; y < 33; y++) {
+            for (size_t x = 0; x < 50; x++) {
+                uint8_t v = odd.data[z][y][x];
+                CHECK((v == 0 || v == 1 || v == 3 || v == 4));
+            }
+        }
+    }
+}
+
+TEST_CASE("Testing sparse save and load") {
+    SparseLabel3D sparse = ToSparse(TestMask());
+    std::vector<char> bytes = EncodeSparse(sparse);
+    std::string path = "./test_sparse.spans";
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    }
+
+    SparseLabel3D loaded;
+    REQUIRE(LoadSparse(path, loaded));
+    CHECK(loaded.width == sparse.width);
+    CHECK(loaded.height == sparse.height);
+    CHECK(loaded.depth == sparse.depth);
+    REQUIRE(loaded.spans.size() == sparse.spans.size());
+
+    for (size_t i = 0; i < sparse.spans.size(); i++) {
+        CHECK(loaded.spans[i].z == sparse.spans[i].z);
+        CHECK(loaded.spans[i].y == sparse.spans[i].y);
+        CHECK(loaded.spans[i].x0 == sparse.spans[i].x0);
+        CHECK(loaded.spans[i].x1 == sparse.spans[i].x1);
+        CHECK(loaded.spans[i].label == sparse.spans[i].label);
+    }
+
+    // Cut short, claiming more spans than it holds, or with a span outside the volume
+    auto rejects = [&] (std::vector<char> const &damaged) {
+        {
+            std::ofstream file(path, std::ios::binary);
+            file.write(damaged.data(), static_cast<std::streamsize>(damaged.size()));
+        }
+
+        SparseLabel3D untouched;
+        return !LoadSparse(path, untouched);
+    };
+
+    CHECK(rejects(std::vector<char>(bytes.begin(), bytes.end() - 4)));
+    std::vector<char> inflated = bytes;
+    uint64_t many = 1ull << 40;
+    std::memcpy(inflated.data() + 32, &many, sizeof(many));
+    CHECK(rejects(inflated));
+    std::vector<char> outside = bytes;
+    uint16_t wide = 1000;
+    std::memcpy(outside.data() + 40 + 6, &wide, sizeof(wide));
+    CHECK(rejects(outside));
+
+    std::remove(path.c_str());
+    CHECK(!LoadSparse(path, loaded));
+}
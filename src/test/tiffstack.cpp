@@ -0,0 +1,184 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "test/doctest.h"
+#include "tiffstack.hpp"
+
+using namespace imagine;
+
+uint16_t TestValue(size_t x, size_t y, size_t page) {
+    return static_cast<uint16_t>((x * 31 + y * 7 + page * 1009) & 0xffff);
+}
+
+void WriteTestTiff(std::string const &path, uint32_t width, uint32_t length, uint32_t rows_per_strip, uint16_t compression, uint16_t pages) {
+    TIFF *tif = TIFFOpen(path.c_str(), "w");
+    std::vector<uint16_t> row(width);
+
+    for (uint16_t page = 0; page < pages; page++) {
+        TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+        TIFFSetField(tif, TIFFTAG_IMAGELENGTH, length);
+        TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 16);
+        TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rows_per_strip);
+        TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+        TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+        TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+
+        for (uint32_t y = 0; y < length; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                row[x] = TestValue(x, y, page);
+            }
+            TIFFWriteScanline(tif, row.data(), y, 0);
+        }
+
+        TIFFWriteDirectory(tif);
+    }
+
+    TIFFClose(tif);
+}
+
+TEST_CASE("Testing channel and window selective stack reads") {
+    size_t width = 40, height = 12, channels = 2, stacksize = 5;
+    std::string path("./test_tiffstack.tif");
+
+    for (uint16_t compression : {COMPRESSION_NONE, COMPRESSION_LZW}) {
+        for (uint32_t rows_per_strip : {1u, 7u, 10000u}) {
+            WriteTestTiff(path, width, height * channels * stacksize, rows_per_strip, compression, 1);
+
+            StackWindow window;
+            window.x = 3;
+            window.y = 2;
+            window.z = 1;
+            window.width = 30;
+            window.height = 9;
+            window.depth = 3;
+
+            ImageU16L3D stacked = LoadTiffStack(path, channels, 1, stacksize, window);
+            CHECK(stacked.width == 30);
+            CHECK(stacked.height == 9);
+            CHECK(stacked.depth == 3);
+
+            bool same = true;
+
+            for (size_t d = 0; d < stacked.depth; d++) {
+                for (size_t y = 0; y < stacked.height; y++) {
+                    for (size_t x = 0; x < stacked.width; x++) {
+                        size_t row = (d + 1) * height * channels + height + y + 2;
+                        same = same && stacked.data[d][y][x] == TestValue(x + 3, row, 0);
+                    }
+                }
+            }
+
+            CHECK(same);
+
+            // A window past the edge is clamped
+            window.x = 35;
+            window.width = 20;
+            CHECK(LoadTiffStack(path, channels, 0, stacksize, window).width == 5);
+
+            // Both channels from one decode match a channel at a time
+            std::vector<ImageU16L3D> both = LoadTiffChannels(path, channels, {1, 0}, stacksize, StackWindow());
+            REQUIRE(both.size() == 2);
+            CHECK(both[0].data == LoadTiffStack(path, channels, 1, stacksize, StackWindow()).data);
+            CHECK(both[1].data == LoadTiffStack(path, channels, 0, stacksize, StackWindow()).data);
+
+            ImageU16L image = LoadTiffImage(path);
+            CHECK(image.height == height * channels * stacksize);
+            CHECK(image.data[image.height - 1][width - 1] == TestValue(width - 1, image.height - 1, 0));
+        }
+    }
+
+    std::remove(path.c_str());
+}
+
+// The per-voxel deinterleave the extractors used to each have a copy of
+ImageU16L3D ReferenceStack(ImageU16L const &image, size_t channels, size_t channel, size_t stacksize, size_t x0, size_t y0, size_t z0,
+        size_t width, size_t height, size_t depth) {
+    size_t h = image.height / (stacksize * channels);
+    ImageU16L3D stacked(width, height, depth);
+
+    for (size_t d = 0; d < depth; d++) {
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++) {
+                stacked.data[d][y][x] = image.data[((z0 + d) * h * channels) + (channel * h) + y0 + y][x0 + x];
+            }
+        }
+    }
+
+    return stacked;
+}
+
+TEST_CASE("Testing deinterleave against the old extractors") {
+    size_t width = 37, height = 11, channels = 2, stacksize = 7;
+    ImageU16L image(width, height * channels * stacksize);
+
+    for (size_t y = 0; y < image.height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            image.data[y][x] = TestValue(x, y, 0);
+        }
+    }
+
+    // StackTiff - the whole stack, bottom channel
+    std::vector<ImageU16L3D> whole = DeinterleaveStack(image, channels, {1}, stacksize, StackWindow());
+    REQUIRE(whole.size() == 1);
+    CHECK(whole[0].data == ReferenceStack(image, channels, 1, stacksize, 0, 0, 0, width, height, stacksize).data);
+
+    // TiffToFits - cropped to the ROI
+    StackWindow window;
+    window.x = 5;
+    window.y = 3;
+    window.z = 2;
+    window.width = 20;
+    window.height = 6;
+    window.depth = 4;
+    std::vector<ImageU16L3D> cropped = DeinterleaveStack(image, channels, {1}, stacksize, window);
+    CHECK(cropped[0].data == ReferenceStack(image, channels, 1, stacksize, 5, 3, 2, 20, 6, 4).data);
+
+    // TiffToStack in count - leaving off the last slice
+    StackWindow counted;
+    counted.depth = stacksize - 1;
+    std::vector<ImageU16L3D> count = DeinterleaveStack(image, channels, {1}, stacksize, counted);
+    CHECK(count[0].depth == stacksize - 1);
+    CHECK(count[0].data == ReferenceStack(image, channels, 1, stacksize, 0, 0, 0, width, height, stacksize - 1).data);
+
+    // Both channels at once, in the order asked for
+    std::vector<ImageU16L3D> both = DeinterleaveStack(image, channels, {1, 0}, stacksize, window);
+    REQUIRE(both.size() == 2);
+    CHECK(both[0].data == cropped[0].data);
+    CHECK(both[1].data == ReferenceStack(image, channels, 0, stacksize, 5, 3, 2, 20, 6, 4).data);
+
+    CHECK_THROWS(DeinterleaveStack(image, channels, {2}, stacksize, window));
+}
+
+TEST_CASE("Testing multi-page volume reads") {
+    std::string path("./test_tiffvolume.tif");
+    WriteTestTiff(path, 17, 13, 4, COMPRESSION_LZW, 6);
+    ImageU16L3D volume = LoadTiffVolume(path);
+    CHECK(volume.depth == 6);
+    CHECK(volume.data[0][0][0] == TestValue(0, 0, 0));
+    CHECK(volume.data[5][12][16] == TestValue(16, 12, 5));
+    CHECK(volume.data[3][7][2] == TestValue(2, 7, 3));
+    std::remove(path.c_str());
+
+    // More pages than threads, so each thread steps along a run of them
+    WriteTestTiff(path, 9, 5, 2, COMPRESSION_NONE, 37);
+    volume = LoadTiffVolume(path);
+    REQUIRE(volume.depth == 37);
+
+    for (size_t page = 0; page < 37; page++) {
+        CHECK(volume.data[page][0][0] == TestValue(0, 0, page));
+        CHECK(volume.data[page][4][8] == TestValue(8, 4, page));
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("Testing reads from a tiff held in memory") {
+    std::string path("./test_tiffbytes.tif");
+    WriteTestTiff(path, 23, 4 * 2 * 3, 5, COMPRESSION_LZW, 1);
+    TiffBytes bytes = ReadTiffBytes(path);
+    ImageU16L3D from_disk = LoadTiffStack(path, 2, 0, 3, StackWindow());
+    ImageU16L3D from_memory = LoadTiffStack(path, 2, 0, 3, StackWindow(), bytes);
+    CHECK(from_memory.data == from_disk.data);
+    CHECK(LoadTiffImage(path, bytes).data == LoadTiffImage(path).data);
+    std::remove(path.c_str());
+    CHECK_THROWS(ReadTiffBytes(path));
+}
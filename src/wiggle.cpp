@@ -25,15 +25,33 @@
 #include <glm/gtc/quaternion.hpp>
 #include <map>
 #include <utility>
+#include <thread>
+#include <future>
+#include <sstream>
 #include "volume.hpp"
 #include "image.hpp"
 #include "data.hpp"
 #include "rots.hpp"
 #include "pipe.hpp"
 #include "options.hpp"
+#include "queue.hpp"
+#include "budget.hpp"
 
 using namespace imagine;
 
+// One pair's files, read into memory by the loader thread. The
+// source is still being read when the pair is handed over.
+typedef struct {
+    Pair pair;
+    size_t slot = 0;            // Position in the list of pairs
+    unsigned int seed = 0;      // For this pair's random augmentations
+    StageKeys keys;             // For the journal and stage cache
+    bool done = false;          // Already built by an earlier run
+    TiffBytes anno_bytes;
+    std::shared_future<TiffBytes> input_bytes;
+    BudgetGrant files;          // What the files were charged as they were read
+} PairInput;
+
 
 bool is_csv_empty(std::string path) {
     std::ifstream file(path);
@@ -52,11 +70,29 @@ int main (int argc, char ** argv) {
     static struct option long_options[] = {
         {"no-interz", no_argument, NULL, 1},
         {"no-subpixel", no_argument, NULL, 2},
+        {"brick", required_argument, NULL, 5},
+        {"threads", required_argument, NULL, 6},
+        {"write-queue", required_argument, NULL, 8},
+        {"prefetch", required_argument, NULL, 7},
+        {"compress", no_argument, NULL, 9},
+        {"quantize", required_argument, NULL, 10},
+        {"tile", required_argument, NULL, 11},
+        {"shards", required_argument, NULL, 12},
+        {"precision", required_argument, NULL, 13},
+        {"preview-scale", required_argument, NULL, 14},
+        {"montage", no_argument, NULL, 15},
+        {"jobs", required_argument, NULL, 16},
+        {"manifest", required_argument, NULL, 17},
+        {"resume", no_argument, NULL, 18},
+        {"cache", no_argument, NULL, 19},
+        {"mem-budget", required_argument, NULL, 20},
+        {"combined", no_argument, NULL, 21},
+        {"count-channel", required_argument, NULL, 22},
         {NULL, 0, NULL, 0}
     };
 
     int option_index = 0;
-    int image_idx = 0;
+    bool offset_given = false;
 
     while ((c = getopt_long(argc, (char **)argv, "i:o:a:p:rtfdmuxvn:z:w:h:l:c:s:j:q:k:g:e:?", long_options, &option_index)) != -1) {
         switch (c) {
@@ -70,7 +106,6 @@ int main (int argc, char ** argv) {
                 break;
             case 'o' :
                 options.output_path = std::string(optarg);
-                image_idx = GetOffetNumber(options.output_path);
                 break;
             case 'p' :
                 options.prefix = std::string(optarg);
@@ -101,7 +136,7 @@ int main (int argc, char ** argv) {
                 break;
             case 'n':
                 options.offset_number = libcee::FromString<int>(optarg);
-                image_idx = options.offset_number;
+                offset_given = true;
                 break;
             case 'c':
                 options.cutoff = libcee::FromString<int>(optarg);
@@ -139,9 +174,86 @@ int main (int argc, char ** argv) {
             case 2 :
                 options.subpixel = false;
                 break;
+            case 5 :
+                options.bricked = true;
+                options.brick_dim = libcee::FromString<size_t>(optarg);
+
+                if (options.brick_dim != 4 && options.brick_dim != 8) {
+                    std::cout << "Brick size must be 4 or 8. Using 8." << std::endl;
+                    options.brick_dim = 8;
+                }
+                break;
+            case 6 :
+                options.threads = std::max(0, libcee::FromString<int>(optarg));
+                SetPoolSize(static_cast<size_t>(options.threads));
+                break;
+            case 8 :
+                options.write_queue = std::max(1, libcee::FromString<int>(optarg));
+                SetWriterDepth(options.write_queue);
+                break;
+            case 7 :
+                options.prefetch = std::max(1, libcee::FromString<int>(optarg));
+                break;
+            case 9 :
+                options.fits.compress = true;
+                break;
+            case 10 :
+                options.fits.quantize = libcee::FromString<float>(optarg);
+                break;
+            case 11 :
+                if (!ParseTile(std::string(optarg), options.fits)) {
+                    std::cout << "Tile size should be of the form 64x64x1." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 12 :
+                options.shards = true;
+                options.shard_records = libcee::FromString<size_t>(optarg);
+                break;
+            case 13 :
+                if (!ParsePrecision(std::string(optarg), options.precision)) {
+                    std::cout << "Precision should be one of f32, f16 or u16." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 14 :
+                options.preview_scale = libcee::FromString<size_t>(optarg);
+                break;
+            case 15 :
+                options.montage = true;
+                break;
+            case 16 :
+                options.jobs = std::max(1, libcee::FromString<int>(optarg));
+                break;
+            case 17 :
+                options.manifest = std::string(optarg);
+                break;
+            case 18 :
+                options.resume = true;
+                break;
+            case 19 :
+                options.stage_cache = true;
+                break;
+            case 20 :
+                if (!ParseBytes(std::string(optarg), options.mem_budget)) {
+                    std::cout << "Memory budget should be a size such as 16000M or 32G." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 21 :
+                options.combined = true;
+                break;
+            case 22 :
+                options.count_channel = libcee::FromString<int>(optarg);
+                break;
         }
     }
 
+    if (options.count_channel < 0 || options.count_channel >= options.channels) {
+        std::cout << "Count channel should be between 0 and " << options.channels - 1 << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+
     //return EXIT_FAILURE;
     std::cout << "Loading annotation images from " << options.annotation_path << std::endl;
     std::cout << "Offset: " << options.offset_number << ", rename: " << options.rename << std::endl;
@@ -150,126 +262,408 @@ int main (int argc, char ** argv) {
     // Rotations for the augmentation
     std::vector<glm::quat> ROTS;
 
-    // First, find and sort the annotation files
-    std::vector<std::string> tiff_anno_files = FindAnnotations(options.annotation_path);
-
-    // Next, find the annotation dat files
-    std::vector<std::string> dat_files = FindDatFiles(options.annotation_path);
-
-    // Next, find the annotation log files
-    std::vector<std::string> log_files = FindLogFiles(options.annotation_path);
-
-    // Now find the input files
-    std::cout << "Loading input images from " << options.image_path << std::endl;
+    // One acquisition, or every acquisition in the manifest
+    std::vector<Acquisition> acquisitions;
+
+    if (!options.manifest.empty()) {
+        acquisitions = ReadManifest(options.manifest);
+        std::cout << "Building from " << acquisitions.size() << " acquisitions in " << options.manifest << std::endl;
+    } else {
+        Acquisition acquisition;
+        acquisition.image_path = options.image_path;
+        acquisition.annotation_path = options.annotation_path;
+        acquisitions.push_back(acquisition);
+    }
 
-    std::vector<std::string> tiff_input_files = FindInputFiles(options.image_path);
-    
-    // The supporting CSV file for the dataset
+    // The supporting CSV file for the dataset. With shards, its rows go in the shard index instead.
     std::string csv_file_path = options.output_path + "/master_dataset.csv";
     std::ofstream out_csv_stream; //ofstream is the class for fstream package
-    out_csv_stream.open(csv_file_path, std::ios::app);
 
     // For our fits versions, lets get the path replacements in
     std::vector<std::pair<std::string, std::string>> fits_replacements = { {std::make_pair("ins-6-mCherry/", "mcherry_fits/")}, {std::make_pair("ins-6-mCherry_2/", "mcherry_2_fits/")}};
 
-    if (is_csv_empty(csv_file_path)) {
-        out_csv_stream << "ogsource,ogmask,fitssource,fitsmask,annolog,annodat,newsource,newmask,roix,roiy,roiz,roiwh,roid,back" << std::endl;
+    // With a journal, the CSV is written from it at the end instead
+    std::string csv_header = "ogsource,ogmask,fitssource,fitsmask,annolog,annodat,newsource,newmask,roix,roiy,roiz,roiwh,roid,back";
+    Journal journal;
+
+    if (options.resume) {
+        journal.Open(options.output_path);
     }
 
-    // Pair up the tiffs with their log file and then the input and process them.
-    for (std::string tiff_anno : tiff_anno_files) {
+    if (options.shards) {
+        size_t depth = options.flatten ? 1 : options.final_depth;
+
+        // Existing shards with another layout can't be added to
+        try {
+            SharedShards().Open(options.output_path, MakeShardLayout(options.final_width, options.final_height, depth, options.shard_records, options.precision));
+        } catch (const std::exception &e) {
+            std::cout << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    } else if (!options.resume) {
+        bool empty = is_csv_empty(csv_file_path);
+        out_csv_stream.open(csv_file_path, std::ios::app);
+
+        if (empty) {
+            out_csv_stream << csv_header << std::endl;
+        }
+    }
+
+    // A combined run also writes what count and db would, from the same loads. With a
+    // journal, these are written from it at the end too.
+    std::string counts_path = options.output_path + "/counts.csv";
+    std::string neurons_path = options.output_path + "/neurons.csv";
+    std::string counts_header = "fileraw,filemask,asi1,asi2,asj1,asj2,basi1,basi2,basj1,basj2";
+    std::string neurons_header = "tifffile,logfile,datfile,x,y,z,fl,mode_fl,min_fl,bg,rsize,type";
+    std::ofstream out_counts_stream;
+    std::ofstream out_neurons_stream;
+
+    if (options.combined && !options.resume) {
+        bool counts_empty = is_csv_empty(counts_path);
+        bool neurons_empty = is_csv_empty(neurons_path);
+        out_counts_stream.open(counts_path, std::ios::app);
+        out_neurons_stream.open(neurons_path, std::ios::app);
+
+        if (counts_empty) {
+            out_counts_stream << counts_header << std::endl;
+        }
+
+        if (neurons_empty) {
+            out_neurons_stream << neurons_header << std::endl;
+        }
+    }
+
+    // Pair up the tiffs with their log file and input, then process them. Every acquisition
+    // is scanned up front, so pairs get their index across the whole dataset.
+    std::vector<Pair> pairs;
+
+    for (Acquisition const &acquisition : acquisitions) {
+        // Find the annotations, logs, dats and input files in one scan of each directory
+        std::cout << "Loading input images from " << acquisition.image_path << std::endl;
+        DataIndex index = IndexData(acquisition.annotation_path, acquisition.image_path);
+        std::vector<std::string> unpaired, unused;
+        std::vector<Pair> found = PairData(index, true, unpaired, unused);
+        ReportUnmatched(unpaired, unused);
+        pairs.insert(pairs.end(), found.begin(), found.end());
+    }
+
+    std::cout << "Found " << pairs.size() << " pairs" << std::endl;
+
+    // Each pair's output index and random seed are set up front, so the names and
+    // augmentations are the same however many pairs are processed at once.
+    int base_idx = FirstPairIndex(options, offset_given);
+    std::vector<unsigned int> seeds(pairs.size());
+
+    for (unsigned int &seed : seeds) {
+        seed = static_cast<unsigned int>(RANDROT_GENERATOR());
+    }
+
+    // The loader thread reads each pair's files into memory ahead of the workers. The
+    // annotation is handed over first, so the source is read while the mask is being built.
+    // The queue stops the loader getting more than options.prefetch pairs ahead.
+    BoundedQueue<PairInput> loaded(std::max(options.prefetch, options.jobs));
+
+    // Pairs only start once they fit in the memory budget, if there is one. Files read
+    // ahead are charged to it too, until their pair takes over the charge.
+    MemoryBudget budget;
+    budget.SetBudget(options.mem_budget);
+
+    std::thread loader([&] () {
+        for (size_t slot = 0; slot < pairs.size(); slot++) {
+            Pair const &pair = pairs[slot];
+            PairInput input;
+            input.pair = pair;
+            input.slot = slot;
+            input.seed = seeds[slot];
+            std::promise<TiffBytes> source;
+            input.input_bytes = source.get_future().share();
+
+            if (options.resume || options.stage_cache) {
+                input.keys = MakeStageKeys(options, pair, input.seed);
+            }
+
+            // Pairs already built, with the same inputs and options, aren't read at all
+            JournalEntry entry;
+
+            if (options.resume && journal.Find(base_idx + static_cast<int>(slot), entry) &&
+                SameKeys(entry.keys, input.keys) && OutputsValid(entry.outputs)) {
+                input.done = true;
+                source.set_value(nullptr);
+
+                if (!loaded.Push(input)) {
+                    break;
+                }
+
+                continue;
+            }
+
+            input.files = budget.Reserve(FileBytes(pair.anno) + FileBytes(pair.input));
+
+            try {
+                input.anno_bytes = ReadTiffBytes(pair.anno);
+            } catch (const std::exception &e) {
+                // ProcessMask will try again from disk and report the problem
+                input.anno_bytes = nullptr;
+            }
+
+            if (!loaded.Push(input)) {
+                break;
+            }
+
+            try {
+                source.set_value(ReadTiffBytes(pair.input));
+            } catch (...) {
+                source.set_exception(std::current_exception());
+            }
+        }
+
+        loaded.Close();
+    });
+
+    // Rows are committed in pair order, whichever pair finishes first
+    InOrder committer;
+
+    auto process = [&] (PairInput const &input) {
+        std::string tiff_anno = input.pair.anno;
+        std::string log = input.pair.log;
+        std::string dat = input.pair.dat;
+        std::string tiff_input = input.pair.input;
+        int pair_idx = base_idx + static_cast<int>(input.slot);
+        std::vector<std::function<void()>> rows;
         bool paired = false;
-        std::vector<std::string> tokens = libcee::SplitStringChars(libcee::FilenameFromPath(tiff_anno), "_.-");
-        std::string id = tokens[0];
-
-        for (std::string log : log_files) {
-            std::vector<std::string> tokens_log = libcee::SplitStringChars(libcee::FilenameFromPath(log), "_.-");
-            if (tokens_log[0] == id) {
-
-                for (std::string dat : dat_files) {
-                    std::vector<std::string> tokens_dat = libcee::SplitStringChars(libcee::FilenameFromPath(dat), "_.-");
-                    if (tokens_dat[0] == id) {
-                        
-                        for (std::string tiff_input : tiff_input_files) {
-                            // Find the matching input stack
-                            std::vector<std::string> tokens1 = libcee::SplitStringChars(libcee::FilenameFromPath(tiff_input), "_.-");
-                            int tidx = 0;
-
-                            for (std::string t : tokens1) {
-                                if (libcee::StringContains(t, "AutoStack")) {
-                                    break;
-                                }
-                                tidx += 1;
-                            }
-                            
-                            int ida = libcee::FromString<int>(libcee::StringRemove(tokens1[tidx], "0xAutoStack"));
-                            int idb = libcee::FromString<int>(libcee::StringRemove(id, "ID"));
-
-                            if (ida == idb) {
-                                try {
-                                    std::vector<Transform> transforms;
-                                    Transform master_t;
-                                    std::cout << "Masking: " << dat << std::endl;
-
-                                    if (ProcessMask(options, tiff_anno, log, dat, image_idx, master_t, transforms)) {
-                                        std::cout << "Stacking: " << tiff_input << std::endl;
-                                        int background = TiffToFits(options, master_t, transforms, tiff_input, image_idx);
-                                        std::cout << "Pairing " << tiff_anno << " with " << dat << " and " << tiff_input << std::endl;
-
-                                        /* CSV Line 
-                                        original source, original mask, fits source, fits mask, annotation log,
-                                        annotation dat, new source name, new mask name, ROI X, Y, Z, WidthHeight,
-                                        Depth, background */
-
-                                        std::string fits_source = tiff_input;
-                                        std::string fits_mask = tiff_anno;
-
-                                        // TODO - ideally the pipe would return these path or be passed it I think.
-                                        std::string output_mask_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_mask.fits";
-                                        std::string output_source_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_layered.fits";
-                                     
-                                        for (auto rep : fits_replacements) {
-                                            fits_source = libcee::StringReplace(fits_source, rep.first, rep.second);
-                                            fits_mask = libcee::StringReplace(fits_mask, rep.first, rep.second);
-                                        }
-
-                                        // ROI only really matters on the first 
-                                        if (options.num_augs > 1) {
-                                            for (int ci = 0; ci < options.num_augs; ci++) {
-                                                std::string aug_id  = libcee::IntToStringLeadingZeroes(ci, 2);
-                                                output_mask_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_" + aug_id + "_mask.fits";
-                                                output_source_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(image_idx, 5) + "_" + aug_id + "_layered.fits";
-                                                ROI roi = transforms[ci].roi;
-
-                                                out_csv_stream << tiff_input << "," << tiff_anno << "," << fits_source << "," << fits_mask << "," 
-                                                    << log << "," << dat << "," << output_source_name << "," << output_mask_name << ","
-                                                    << roi.x << "," << roi.y << "," << roi.z << "," << roi.xy_dim << "," << roi.depth << "," << background << "\n";
-                                            }
-                                        } else {
-                                            ROI roi = transforms[0].roi;
-                                            out_csv_stream << tiff_input << "," << tiff_anno << "," << fits_source << "," << fits_mask << "," 
-                                            << log << "," << dat << "," << output_source_name << "," << output_mask_name << ","
-                                            << roi.x << "," << roi.y << "," << roi.z << "," << roi.xy_dim << "," << roi.depth << "," << background << "\n";
-                                        }
-                                       
-                                        paired = true;
-                                        image_idx +=1;
-                                        break;
-                                    }
-                                
-                                } catch (const std::exception &e) {
-                                    std::cout << "An exception occured with" << tiff_anno << " and " <<  tiff_input << std::endl;
-                                }
+
+        if (input.done) {
+            std::cout << "Already built " << tiff_anno << std::endl;
+            committer.Commit(input.slot, [] () {});
+            return;
+        }
+
+        JournalEntry entry;
+        entry.idx = pair_idx;
+        entry.keys = input.keys;
+        std::string cache_path;
+
+        // A pair done again keeps its shard records
+        std::vector<size_t> old_records;
+
+        if (options.resume) {
+            JournalEntry old;
+
+            if (options.shards && journal.Find(pair_idx, old)) {
+                old_records = old.records;
+            }
+
+            journal.Forget(pair_idx);
+            entry.outputs = PairOutputs(options, tiff_input, pair_idx);
+        }
+
+        if (options.stage_cache) {
+            cache_path = StageCachePath(options.output_path, input.keys);
+        }
+
+        RANDROT_GENERATOR.seed(input.seed);
+
+        // A big pair may run fewer augmentations at once, rather than wait for the others
+        Options pair_options = options;
+        PairMemory memory;
+        size_t width = 0, height = 0;
+
+        if (TiffSize(tiff_anno, input.anno_bytes, width, height)) {
+            memory = EstimatePairMemory(options, width, height / static_cast<size_t>(options.stacksize));
+        } else {
+            // With no idea of its size, the pair runs on its own
+            memory.base = options.mem_budget;
+        }
+
+        size_t max_augs = options.aug_width == 0 ? static_cast<size_t>(options.num_augs) : options.aug_width;
+        BudgetGrant grant = budget.Admit(memory, max_augs, input.files);
+        pair_options.aug_width = grant.augs;
+        pair_options.records = old_records;
+
+        // Every file for the pair reports here, so its rows can be held back if one fails
+        std::shared_ptr<WriteGroup> writes = std::make_shared<WriteGroup>();
+        pair_options.writes = writes;
+
+        try {
+            std::vector<Transform> transforms;
+            Transform master_t;
+            SparseLabel3D full_mask;
+            std::cout << "Masking: " << dat << std::endl;
+
+            if (ProcessMask(pair_options, tiff_anno, log, dat, pair_idx, master_t, transforms, input.anno_bytes, options.combined ? &full_mask : nullptr)) {
+                std::cout << "Stacking: " << tiff_input << std::endl;
+                int background = TiffToFits(pair_options, master_t, transforms, tiff_input, pair_idx, input.input_bytes.get(), cache_path);
+                std::cout << "Pairing " << tiff_anno << " with " << dat << " and " << tiff_input << std::endl;
+
+                /* CSV Line 
+                original source, original mask, fits source, fits mask, annotation log,
+                annotation dat, new source name, new mask name, ROI X, Y, Z, WidthHeight,
+                Depth, background */
+
+                std::string fits_source = tiff_input;
+                std::string fits_mask = tiff_anno;
+
+                // TODO - ideally the pipe would return these path or be passed it I think.
+                std::string output_mask_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(pair_idx, 5) + "_mask.fits";
+                std::string output_source_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(pair_idx, 5) + "_layered.fits";
+             
+                for (auto rep : fits_replacements) {
+                    fits_source = libcee::StringReplace(fits_source, rep.first, rep.second);
+                    fits_mask = libcee::StringReplace(fits_mask, rep.first, rep.second);
+                }
+
+                // One row per augmentation - in the master CSV, or the shard index
+                auto write_row = [&] (int ci, std::string source_name, std::string mask_name) {
+                    ROI roi = transforms[ci].roi;
+                    size_t record = transforms[ci].record;
+
+                    if (options.shards) {
+                        source_name = SharedShards().ShardPath(record);
+                        mask_name = source_name;
+                    }
+
+                    std::stringstream row;
+                    row << tiff_input << "," << tiff_anno << "," << fits_source << "," << fits_mask << "," 
+                        << log << "," << dat << "," << source_name << "," << mask_name << ","
+                        << roi.x << "," << roi.y << "," << roi.z << "," << roi.xy_dim << "," << roi.depth << "," << background;
+                    std::string line = row.str();
+                    entry.rows.push_back(line);
+
+                    if (options.shards) {
+                        entry.records.push_back(record);
+                        ShardMeta meta;
+                        meta.image_idx = static_cast<uint32_t>(pair_idx);
+                        meta.aug = static_cast<uint32_t>(ci);
+                        meta.roi_x = roi.x;
+                        meta.roi_y = roi.y;
+                        meta.roi_z = roi.z;
+                        meta.roi_xy = roi.xy_dim;
+                        meta.roi_depth = roi.depth;
+                        meta.background = background;
+                        rows.push_back([record, meta, line] () { SharedShards().QueueMeta(record, meta, line); });
+                    } else if (!options.resume) {
+                        rows.push_back([&out_csv_stream, line] () { out_csv_stream << line << "\n"; });
+                    }
+                };
+
+                // ROI only really matters on the first 
+                if (options.num_augs > 1) {
+                    for (int ci = 0; ci < options.num_augs; ci++) {
+                        std::string aug_id  = libcee::IntToStringLeadingZeroes(ci, 2);
+                        output_mask_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(pair_idx, 5) + "_" + aug_id + "_mask.fits";
+                        output_source_name = options.output_path + "/" +  libcee::IntToStringLeadingZeroes(pair_idx, 5) + "_" + aug_id + "_layered.fits";
+                        write_row(ci, output_source_name, output_mask_name);
+                    }
+                } else {
+                    write_row(0, output_source_name, output_mask_name);
+                }
+               
+                // The count and database rows, from the mask and source already in memory
+                CombinedRows combined;
+
+                if (options.combined) {
+                    CombinedOutputs(pair_options, full_mask, input.pair, pair_idx, input.input_bytes.get(), combined);
+
+                    if (combined.neurons.empty()) {
+                        std::cout << "No database rows for " << dat << ", it should hold four neurons" << std::endl;
+                    }
+
+                    entry.counts.push_back(combined.count);
+                    entry.neurons = combined.neurons;
+
+                    if (!options.resume) {
+                        rows.push_back([&out_counts_stream, &out_neurons_stream, combined] () {
+                            out_counts_stream << combined.count << "\n";
+
+                            for (std::string const &line : combined.neurons) {
+                                out_neurons_stream << line << "\n";
                             }
-                        }
+                        });
                     }
                 }
+
+                paired = true;
+
+                // The journal entry goes to the writer after the pair's files, so it is only there once they are
+                if (options.resume) {
+                    rows.push_back([&journal, entry] () { journal.Queue(entry); });
+                }
             }
+        
+        } catch (const std::exception &e) {
+            std::cout << "An exception occured with" << tiff_anno << " and " <<  tiff_input << std::endl;
+            rows.clear();
         }
 
+        budget.Release(grant);
+
         if (!paired){
             std::cout << "Failed to pair " << tiff_anno << std::endl;
         }
+
+        // Even a failed pair commits, so the pairs after it are not held up. The rows go through
+        // the writer behind the pair's files, and only if every one of them was written.
+        committer.Commit(input.slot, [rows, writes, tiff_anno] () {
+            WriteJob job;
+            job.done = [rows, writes, tiff_anno] (bool) {
+                if (writes->failed > 0) {
+                    std::cout << "Leaving " << tiff_anno << " out, " << writes->failed << " of its files failed to write" << std::endl;
+                    return;
+                }
+
+                for (auto const &row : rows) {
+                    row();
+                }
+            };
+
+            SharedWriter().Write(job);
+        });
+
+        SharedWriter().Report();
+    };
+
+    // Each worker takes the next loaded pair. They share the pool with the work inside each pair.
+    ParallelFor(static_cast<size_t>(options.jobs), [&loaded, &process] (size_t) {
+        PairInput input;
+
+        while (loaded.Pop(input)) {
+            process(input);
+        }
+    });
+
+    loader.join();
+    committer.Finish();
+    budget.Report();
+    SharedWriter().Finish();
+
+    if (options.resume && !options.shards) {
+        journal.RewriteCSV(csv_file_path, csv_header);
+    }
+
+    if (options.resume && options.combined) {
+        journal.RewriteCSV(counts_path, counts_header, &JournalEntry::counts);
+        journal.RewriteCSV(neurons_path, neurons_header, &JournalEntry::neurons);
+    }
+
+    // Pairs done again added their index lines a second time, so the index comes from the journal too
+    if (options.resume && options.shards) {
+        std::vector<std::pair<size_t, std::string>> records;
+
+        for (JournalEntry const &done : journal.All()) {
+            for (size_t i = 0; i < done.records.size() && i < done.rows.size(); i++) {
+                records.push_back(std::make_pair(done.records[i], done.rows[i]));
+            }
+        }
+
+        SharedShards().RewriteIndex(records);
+    }
+
+    SharedPreviewSheets().Finish();
+    SharedPreviewWriter().Finish();
+
+    if (SharedWriter().Stats().failed > 0) {
+        std::cout << SharedWriter().Stats().failed << " files failed to write" << std::endl;
+        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;